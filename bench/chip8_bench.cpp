@@ -0,0 +1,714 @@
+#include "chip8/core.hpp"
+#include "chip8/jit.hpp"
+#include "chip8/save_state.hpp"
+#include "chip8/timer.hpp"
+#include "test_roms.hpp"
+
+#ifdef CHIP8_BENCH_RENDER
+#include "chip8/chip8.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the interpreter, the sprite path, the renderer and the
+// frame timer, plus end-to-end instruction rates on the ROMs in test_roms.hpp.
+// The alloc/, idle/ and jit/ rows are checks; the exit status is non-zero if
+// any of them fails.
+// Results go to stdout as CSV (or JSON) with one row per measurement, so runs
+// can be diffed or plotted over time.
+
+using bench_clock = std::chrono::steady_clock;
+
+struct Measurement {
+    std::string name;
+    double value;
+    const char *unit;
+    std::size_t samples;
+};
+
+struct Options {
+    bool json = false;
+    // Time spent per measurement, split into samples
+    double seconds = 0.2;
+    std::size_t timer_frames = 60;
+    std::string filter;
+};
+
+static std::vector<Measurement> results;
+static Options options;
+
+// Keeps results observable so the measured work is not optimized away
+static volatile uint64_t sink;
+
+// Set by checkIdleSkipping when skipping idle loops changes a run
+static bool idle_failed = false;
+
+// Set by checkJit when a translated block leaves a different state
+static bool jit_failed = false;
+
+// Every heap allocation in the process goes through these, so the alloc/
+// checks can tell whether running frames touches the heap
+static std::atomic<uint64_t> allocations{0};
+static bool allocation_failed = false;
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+static void report(const std::string& name, double value, const char *unit, std::size_t samples) {
+    results.push_back({name, value, unit, samples});
+}
+
+static bool selected(const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// Runs fn(batch) repeatedly and reports the median cost of one operation
+template<typename F>
+static void measure(const std::string& name, std::size_t batch, F fn) {
+    if (!selected(name))
+        return;
+
+    fn(batch); // warm up caches and lazily decoded instructions
+
+    std::vector<double> per_op;
+    auto deadline = bench_clock::now() + std::chrono::duration<double>(options.seconds);
+    do {
+        auto start = bench_clock::now();
+        fn(batch);
+        std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+        per_op.push_back(elapsed.count() / batch);
+    } while (bench_clock::now() < deadline || per_op.size() < 5);
+
+    std::nth_element(per_op.begin(), per_op.begin() + per_op.size() / 2, per_op.end());
+    report(name, per_op[per_op.size() / 2], "ns/op", per_op.size());
+}
+
+// Reports the heap allocations fn makes; any at all is a failure
+template<typename F>
+static void countAllocations(const std::string& name, F fn) {
+    if (!selected(name))
+        return;
+
+    uint64_t before = allocations.load(std::memory_order_relaxed);
+    fn();
+    uint64_t count = allocations.load(std::memory_order_relaxed) - before;
+
+    report(name, static_cast<double>(count), "allocations", 1);
+    if (count) {
+        std::cerr << name << ": " << count << " heap allocations while running frames" << std::endl;
+        allocation_failed = true;
+    }
+}
+
+// Scratch RAM well clear of the benchmark ROMs, for Fx33/Fx55/Fx65
+constexpr uint16_t DATA_ADDRESS = 0xE00;
+
+// Core with V0 = vx, V1 = vy and I set, everything else at power-on
+static void setRegisters(Chip8Core& core, uint8_t vx, uint8_t vy, uint16_t i) {
+    Chip8Core::State state = core.getState();
+    state.V[0] = vx;
+    state.V[1] = vy;
+    state.I = i;
+    core.setState(state);
+}
+
+struct Opcode {
+    const char *name;
+    uint16_t instruction;
+    // Run after each one to undo it, so a call is always paired with a
+    // return and neither faults on the call stack; 0 for none
+    uint16_t partner;
+};
+
+static const Opcode OPCODES[] = {
+    {"00E0", 0x00E0, 0},     {"2nnn+00EE", 0x2204, 0x00EE}, {"1nnn", 0x1200, 0}, {"3xkk", 0x3212, 0},
+    {"4xkk", 0x4212, 0},     {"5xy0", 0x5230, 0},  {"6xkk", 0x6212, 0},  {"7xkk", 0x7212, 0},
+    {"8xy0", 0x8230, 0},     {"8xy1", 0x8231, 0},  {"8xy2", 0x8232, 0},  {"8xy3", 0x8233, 0},
+    {"8xy4", 0x8234, 0},     {"8xy5", 0x8235, 0},  {"8xy6", 0x8236, 0},  {"8xy7", 0x8237, 0},
+    {"8xyE", 0x823E, 0},     {"9xy0", 0x9230, 0},  {"Annn", 0xA300, 0},  {"Bnnn", 0xB200, 0},
+    {"Cxkk", 0xC2FF, 0},     {"Dxyn", 0xD015, 0},  {"Ex9E", 0xE29E, 0},  {"ExA1", 0xE2A1, 0},
+    {"Fx07", 0xF207, 0},     {"Fx0A", 0xF20A, 0},  {"Fx15", 0xF215, 0},  {"Fx18", 0xF218, 0},
+    {"Fx1E", 0xF21E, 0},     {"Fx29", 0xF229, 0},  {"Fx33", 0xF233, 0},  {"Fx55", 0xF255, 0},
+    {"Fx65", 0xF265, 0},
+};
+
+static void benchOpcodes() {
+    for (const Opcode& op : OPCODES) {
+        // Decoded and dispatched per call, as the JIT's fallback does
+        Chip8Core core;
+        core.seed(0);
+        setRegisters(core, 8, 4, DATA_ADDRESS);
+        measure(std::string("execute/") + op.name, 4096, [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) {
+                core.executeInstruction(op.instruction);
+                if (op.partner)
+                    core.executeInstruction(op.partner);
+            }
+            sink = core.getState().V[2];
+        });
+
+        // Through the predecoded fetch/dispatch loop: a ROM full of the
+        // instruction, then a field of jumps back so skips land on a jump too.
+        // A pair is one instruction, a jump back and its partner at 0x204.
+        std::vector<uint8_t> rom;
+        if (op.partner) {
+            const uint16_t pair[] = {op.instruction, 0x1200, op.partner};
+            for (uint16_t instruction : pair) {
+                rom.push_back(instruction >> 8);
+                rom.push_back(instruction & 0xFF);
+            }
+        } else {
+            for (int i = 0; i < 256; i++) {
+                rom.push_back(op.instruction >> 8);
+                rom.push_back(op.instruction & 0xFF);
+            }
+            for (int i = 0; i < 8; i++) {
+                rom.push_back(0x12);
+                rom.push_back(0x00);
+            }
+        }
+
+        Chip8Core fused;
+        fused.seed(0);
+        fused.loadRom(rom.data(), rom.size());
+        setRegisters(fused, 8, 4, DATA_ADDRESS);
+        measure(std::string("fused/") + op.name, 4096, [&](std::size_t n) {
+            fused.step(n);
+            sink = fused.getState().V[2];
+        });
+    }
+}
+
+static void benchSprites() {
+    struct SpriteCase {
+        const char *name;
+        uint8_t x;
+        uint8_t y;
+        uint8_t height;
+    };
+
+    static const SpriteCase CASES[] = {
+        {"h1_aligned", 0, 0, 1},
+        {"h5_aligned", 8, 4, 5},
+        {"h15_aligned", 16, 8, 15},
+        {"h5_unaligned", 3, 4, 5},
+        {"h15_unaligned", 13, 8, 15},
+        {"h5_clip_right", 60, 4, 5},
+        {"h15_clip_bottom", 8, 28, 15},
+        {"h5_wrap_start", 70, 40, 5},
+    };
+
+    for (const SpriteCase& c : CASES) {
+        Chip8Core core;
+        // I = 0 points at the font, which has 80 bytes of sprite data
+        setRegisters(core, c.x, c.y, 0);
+        const uint16_t instruction = 0xD010 | c.height;
+        measure(std::string("dxyn/") + c.name, 4096, [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                core.executeInstruction(instruction);
+            sink = core.hashDisplay();
+        });
+    }
+
+    // High resolution draws: Dxyn at 128x64 and the 16x16 Dxy0
+    for (const SpriteCase& c : CASES) {
+        Chip8Core core;
+        core.setVariant(Variant::SuperChip);
+        core.executeInstruction(0x00FF);
+        setRegisters(core, c.x * 2, c.y * 2, 0);
+        const uint16_t instruction = 0xD010 | c.height;
+        measure(std::string("dxyn_hires/") + c.name, 4096, [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                core.executeInstruction(instruction);
+            sink = core.hashDisplay();
+        });
+    }
+
+    Chip8Core core;
+    measure("clear/00E0", 4096, [&](std::size_t n) {
+        for (std::size_t i = 0; i < n; i++)
+            core.executeInstruction(0x00E0);
+        sink = core.getDisplay()[0][0][0];
+    });
+}
+
+#ifdef CHIP8_BENCH_RENDER
+// Drives the frontend's texture upload and present against an offscreen window
+struct RenderBench {
+    static void run() {
+        if (!selected("render/"))
+            return;
+
+        SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+        SDL_SetHint(SDL_HINT_AUDIO_DRIVER, "dummy");
+
+        Chip8 chip8;
+        if (!chip8.init()) {
+            std::cerr << "Skipping render benchmarks: no offscreen renderer" << std::endl;
+            return;
+        }
+
+        // Fill the framebuffer with something that is not a solid colour
+        chip8.core.loadRom(test_roms::SPRITES, sizeof(test_roms::SPRITES));
+        chip8.core.runFrames(60);
+
+        measure("render/all_rows", 64, [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                chip8.renderDisplay(chip8.core.getDisplay(), chip8.core.isHires(), ~uint64_t(0));
+        });
+        measure("render/one_row", 64, [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                chip8.renderDisplay(chip8.core.getDisplay(), chip8.core.isHires(), uint64_t(1) << (i % WINDOW_HEIGHT));
+        });
+        measure("render/present_only", 64, [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                chip8.renderDisplay(chip8.core.getDisplay(), chip8.core.isHires(), 0);
+        });
+
+        // One pass of the serial run() loop minus event polling and pacing
+        auto frame = [&] {
+            Chip8::clock::time_point now = Chip8::clock::now();
+            chip8.emulateFrame(now - std::chrono::milliseconds(16), now);
+            uint64_t dirty_rows = chip8.core.consumeDirtyRows();
+            chip8.renderDisplay(chip8.core.getDisplay(), chip8.core.isHires(), dirty_rows);
+            chip8.audio.update(chip8.core);
+        };
+        frame();
+        countAllocations("alloc/frontend_frame", [&] {
+            for (int i = 0; i < 600; i++)
+                frame();
+        });
+    }
+};
+#endif
+
+static void benchTimer() {
+    if (!selected("timer/"))
+        return;
+
+    // How late each Timer<FPS>::sleep wakes up relative to its ideal deadline
+    Timer<FPS> timer;
+    std::vector<double> late_us;
+    auto start = bench_clock::now();
+    timer.reset();
+    for (std::size_t frame = 1; frame <= options.timer_frames; frame++) {
+        timer.sleep();
+        auto deadline = start + std::chrono::duration_cast<bench_clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(frame) / FPS));
+        late_us.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - deadline).count());
+    }
+
+    std::sort(late_us.begin(), late_us.end());
+    auto percentile = [&](double p) { return late_us[static_cast<std::size_t>(p * (late_us.size() - 1))]; };
+    report("timer/late_p50", percentile(0.50), "us", late_us.size());
+    report("timer/late_p90", percentile(0.90), "us", late_us.size());
+    report("timer/late_p99", percentile(0.99), "us", late_us.size());
+    report("timer/late_max", late_us.back(), "us", late_us.size());
+}
+
+// Snapshots are meant for rewinding and rollback, which take one every frame
+constexpr double SNAPSHOT_BUDGET_NS = 1000;
+
+// getState/setState in memory, against the budget, and a save_state file round trip
+static void benchSnapshots() {
+    Chip8Core core;
+    core.loadRom(test_roms::MIXED, sizeof(test_roms::MIXED));
+    core.setVariant(Variant::XoChip);
+    core.runFrames(10);
+    Chip8Core::State snapshot = core.getState();
+
+    const std::size_t first = results.size();
+    measure("state/snapshot", 1000, [&](std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            snapshot = core.getState();
+            sink = snapshot.rng_state;
+        }
+    });
+    measure("state/restore", 1000, [&](std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            core.setState(snapshot);
+            sink = core.getState().PC;
+        }
+    });
+    for (std::size_t i = first; i < results.size(); i++) {
+        if (results[i].value > SNAPSHOT_BUDGET_NS)
+            std::cerr << results[i].name << ": " << results[i].value << " ns is over the 1 us budget" << std::endl;
+    }
+
+    const std::string path = (std::filesystem::temp_directory_path() / "chip8_bench.state").string();
+    measure("state/save_load", 10, [&](std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            save_state::save(path.c_str(), snapshot);
+            save_state::load(path.c_str(), snapshot);
+        }
+    });
+    std::remove(path.c_str());
+}
+
+struct Rom {
+    const char *name;
+    const uint8_t *data;
+    std::size_t size;
+};
+
+static const Rom ROMS[] = {
+    {"alu", test_roms::ALU, sizeof(test_roms::ALU)},
+    {"sprites", test_roms::SPRITES, sizeof(test_roms::SPRITES)},
+    {"mixed", test_roms::MIXED, sizeof(test_roms::MIXED)},
+    {"hires", test_roms::HIRES, sizeof(test_roms::HIRES)},
+    {"idle", test_roms::IDLE, sizeof(test_roms::IDLE)},
+};
+
+static void benchRoms() {
+    for (const Rom& rom : ROMS) {
+        for (Variant variant : {Variant::Chip8, Variant::SuperChip, Variant::XoChip, Variant::Vip}) {
+            // Plain CHIP-8 has no high resolution mode
+            if (rom.data == test_roms::HIRES && (variant == Variant::Chip8 || variant == Variant::Vip))
+                continue;
+
+            for (bool use_jit : {false, true}) {
+                std::string name = std::string("ips/") + rom.name + "/" + variantName(variant) + (use_jit ? "/jit" : "/interpreter");
+                if (!selected(name) || (use_jit && !Chip8Jit::isSupported()))
+                    continue;
+
+                Chip8Core core;
+                core.seed(0);
+                core.loadRom(rom.data, rom.size);
+                core.setVariant(variant);
+                core.setInstructionsPerFrame(1000);
+                std::unique_ptr<Chip8Jit> jit;
+                if (use_jit)
+                    jit = std::make_unique<Chip8Jit>(core);
+
+                // Frames at 1000 instructions each, timers ticking as in a real run
+                std::vector<double> ips;
+                auto deadline = bench_clock::now() + std::chrono::duration<double>(options.seconds);
+                do {
+                    uint64_t before = core.getInstructionCount();
+                    auto start = bench_clock::now();
+                    if (use_jit)
+                        jit->runFrames(100);
+                    else
+                        core.runFrames(100);
+                    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+                    ips.push_back((core.getInstructionCount() - before) / elapsed.count());
+                } while (bench_clock::now() < deadline || ips.size() < 5);
+
+                sink = core.hashDisplay();
+                std::nth_element(ips.begin(), ips.begin() + ips.size() / 2, ips.end());
+                report(name, ips[ips.size() / 2], "instructions/s", ips.size());
+            }
+        }
+    }
+}
+
+// Once warmed up, running frames must not touch the heap on either path
+static void checkAllocations() {
+    for (const Rom& rom : ROMS) {
+        for (Variant variant : {Variant::Chip8, Variant::SuperChip, Variant::XoChip, Variant::Vip}) {
+            for (bool use_jit : {false, true}) {
+                std::string name = std::string("alloc/") + rom.name + "/" + variantName(variant) + (use_jit ? "/jit" : "/interpreter");
+                if (!selected(name) || (use_jit && !Chip8Jit::isSupported()))
+                    continue;
+
+                Chip8Core core;
+                core.seed(0);
+                core.loadRom(rom.data, rom.size);
+                core.setVariant(variant);
+                core.setInstructionsPerFrame(1000);
+                std::unique_ptr<Chip8Jit> jit;
+                if (use_jit)
+                    jit = std::make_unique<Chip8Jit>(core);
+
+                // Only the steady state counts, after the first decodes and translations
+                auto run = [&](std::size_t frames) {
+                    if (use_jit)
+                        jit->runFrames(frames);
+                    else
+                        core.runFrames(frames);
+                };
+                run(60);
+                countAllocations(name, [&] { run(600); });
+                sink = core.hashDisplay();
+            }
+        }
+    }
+}
+
+// Skipping idle loops must leave every ROM exactly where running them would
+static void checkIdleSkipping() {
+    enum class Mode { Interpreter, VipTiming, Jit };
+    const std::pair<Mode, const char *> modes[] = {
+        {Mode::Interpreter, "interpreter"}, {Mode::VipTiming, "vip"}, {Mode::Jit, "jit"},
+    };
+
+    for (const Rom& rom : ROMS) {
+        for (Variant variant : {Variant::Chip8, Variant::SuperChip, Variant::XoChip, Variant::Vip}) {
+            if (rom.data == test_roms::HIRES && (variant == Variant::Chip8 || variant == Variant::Vip))
+                continue;
+
+            for (const auto& [mode, mode_name] : modes) {
+                std::string name = std::string("idle/") + rom.name + "/" + variantName(variant) + "/" + mode_name;
+                if (!selected(name) || (mode == Mode::Jit && !Chip8Jit::isSupported()))
+                    continue;
+
+                Chip8Core skipping, reference;
+                reference.setIdleSkipping(false);
+                for (Chip8Core *core : {&skipping, &reference}) {
+                    core->seed(0);
+                    core->loadRom(rom.data, rom.size);
+                    core->setVariant(variant);
+                    if (mode == Mode::VipTiming) {
+                        core->setCycleCosts(&Chip8Core::VIP_CYCLES);
+                        core->setInstructionsPerSecond(Chip8Core::VIP_CYCLES_PER_SECOND);
+                    } else {
+                        core->setInstructionsPerFrame(1000);
+                    }
+                }
+                std::unique_ptr<Chip8Jit> jit;
+                if (mode == Mode::Jit)
+                    jit = std::make_unique<Chip8Jit>(skipping);
+
+                for (int frame = 0; frame < 600; frame++) {
+                    if (jit)
+                        jit->runFrames(1);
+                    else
+                        skipping.runFrames(1);
+                    reference.runFrames(1);
+
+                    const Chip8Core::State& a = skipping.getState();
+                    const Chip8Core::State& b = reference.getState();
+                    if (a.V != b.V || a.I != b.I || a.PC != b.PC || a.SP != b.SP || a.RAM != b.RAM ||
+                        a.delay_timer != b.delay_timer || a.instruction_count != b.instruction_count ||
+                        a.cycle_budget != b.cycle_budget || skipping.hashDisplay() != reference.hashDisplay()) {
+                        std::cerr << name << ": differs from running every instruction at frame " << frame << std::endl;
+                        idle_failed = true;
+                        break;
+                    }
+                }
+
+                report(name, 100.0 * skipping.getIdleInstructionCount() / skipping.getInstructionCount(), "% skipped", 600);
+            }
+        }
+    }
+}
+
+// Random program of instructions the JIT translates, mixed with ones it
+// hands to the interpreter. Calls, returns and Bnnn are left out and I only
+// points at data past the program, so control stays inside the program and
+// nothing faults.
+static std::vector<uint8_t> randomProgram(std::mt19937& rng) {
+    static const uint16_t TEMPLATES[] = {
+        0x6000, 0x7000, 0x8000, 0x8001, 0x8002, 0x8003, 0x8004, 0x8005, 0x8006, 0x8007, 0x800E,
+        0x3000, 0x4000, 0x5000, 0x9000, 0xA000, 0xF01E, 0xF007, 0xF015, 0xF018, 0xF029,
+        0x1000, 0xC000, 0xD000, 0xE09E, 0xE0A1, 0xF033, 0xF055, 0xF065,
+    };
+    constexpr std::size_t LENGTH = 256;
+    constexpr uint16_t DATA_START = Chip8Core::ROM_START + 2 * LENGTH + 8;
+    // Room after I for a 16x16 sprite or all of V
+    constexpr uint16_t DATA_END = 0xFFF - 32;
+
+    std::vector<uint8_t> rom;
+    auto put = [&](uint16_t instruction) {
+        rom.push_back(instruction >> 8);
+        rom.push_back(instruction & 0xFF);
+    };
+    auto setI = [&] {
+        put(static_cast<uint16_t>(0xA000 | (DATA_START + rng() % (DATA_END - DATA_START))));
+    };
+
+    while (rom.size() < 2 * LENGTH) {
+        const uint16_t base = TEMPLATES[rng() % (sizeof(TEMPLATES) / sizeof(TEMPLATES[0]))];
+        const uint16_t x = static_cast<uint16_t>((rng() & 0xF) << 8);
+        const uint16_t y = static_cast<uint16_t>((rng() & 0xF) << 4);
+        switch (base >> 12)
+        {
+        case 0x1:
+            put(static_cast<uint16_t>(base | (Chip8Core::ROM_START + 2 * (rng() % LENGTH))));
+            break;
+        case 0xA:
+            setI();
+            break;
+        case 0x3: case 0x4: case 0x6: case 0x7: case 0xC:
+            put(static_cast<uint16_t>(base | x | (rng() & 0xFF)));
+            break;
+        case 0x5: case 0x8: case 0x9:
+            put(base | x | y);
+            break;
+        case 0xD:
+            put(static_cast<uint16_t>(base | x | y | (rng() & 0xF)));
+            break;
+        default:
+            put(base | x);
+            // These can carry I anywhere; the next instruction brings it back
+            if (base == 0xF01E || base == 0xF055 || base == 0xF065)
+                setI();
+            break;
+        }
+    }
+    // Back to the start, twice in case the last instruction skips
+    put(0x1000 | Chip8Core::ROM_START);
+    put(0x1000 | Chip8Core::ROM_START);
+    return rom;
+}
+
+// The JIT must leave every register, RAM, the display and the timers exactly
+// where the interpreter does, compared after each run of a few instructions
+static void checkJit() {
+    constexpr int PROGRAMS = 200;
+    constexpr int FRAMES = 30;
+
+    for (Variant variant : {Variant::Chip8, Variant::SuperChip, Variant::XoChip, Variant::Vip}) {
+        std::string name = std::string("jit/random/") + variantName(variant);
+        if (!selected(name) || !Chip8Jit::isSupported())
+            continue;
+
+        std::mt19937 rng(1);
+        uint64_t compared = 0;
+        for (int program = 0; program < PROGRAMS && !jit_failed; program++) {
+            const std::vector<uint8_t> rom = randomProgram(rng);
+            Chip8Core translated, reference;
+            for (Chip8Core *core : {&translated, &reference}) {
+                core->seed(program);
+                core->loadRom(rom.data(), rom.size());
+                core->setVariant(variant);
+            }
+            Chip8Jit jit(translated);
+
+            for (int frame = 0; frame < FRAMES && !jit_failed; frame++) {
+                const uint16_t keys = static_cast<uint16_t>(rng());
+                for (uint8_t key = 0; key < 16; key++) {
+                    translated.setKey(key, (keys >> key) & 1);
+                    reference.setKey(key, (keys >> key) & 1);
+                }
+
+                // Runs of different lengths split blocks at different places
+                for (int run = 0; run < 8; run++) {
+                    const std::size_t n = 1 + rng() % 32;
+                    jit.step(n);
+                    reference.step(n);
+                    compared++;
+
+                    const Chip8Core::State& a = translated.getState();
+                    const Chip8Core::State& b = reference.getState();
+                    const char *differs = a.V != b.V ? "V" : a.I != b.I ? "I" : a.PC != b.PC ? "PC" :
+                                          a.SP != b.SP || a.stack != b.stack ? "the stack" :
+                                          a.RAM != b.RAM ? "RAM" : a.display != b.display ? "the display" :
+                                          a.delay_timer != b.delay_timer || a.sound_timer != b.sound_timer ? "the timers" :
+                                          a.instruction_count != b.instruction_count ? "the instruction count" : nullptr;
+                    if (differs) {
+                        std::cerr << name << ": program " << program << " leaves " << differs
+                                  << " different from the interpreter in frame " << frame << ", PC 0x" << std::hex
+                                  << a.PC << " vs 0x" << b.PC << std::dec << std::endl;
+                        jit_failed = true;
+                        break;
+                    }
+                }
+                translated.tickTimers();
+                reference.tickTimers();
+            }
+        }
+
+        report(name, static_cast<double>(compared), "runs compared", PROGRAMS);
+    }
+}
+
+static void printResults() {
+    if (!options.json) {
+        std::cout << "name,value,unit,samples\n";
+        for (const Measurement& m : results)
+            std::cout << m.name << ',' << m.value << ',' << m.unit << ',' << m.samples << '\n';
+        std::cout.flush();
+        return;
+    }
+
+    std::cout << "[\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Measurement& m = results[i];
+        std::cout << "  {\"name\": \"" << m.name << "\", \"value\": " << m.value
+                  << ", \"unit\": \"" << m.unit << "\", \"samples\": " << m.samples << "}"
+                  << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "]" << std::endl;
+}
+
+static void printUsage() {
+    std::cout << "Usage: chip8_bench [--format csv|json] [--seconds <per measurement>]\n"
+              << "                   [--timer-frames <n>] [--filter <name substring>]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--format") == 0 && has_value) {
+            const char *format = argv[++i];
+            if (strcmp(format, "json") != 0 && strcmp(format, "csv") != 0) {
+                printUsage();
+                return 1;
+            }
+            options.json = strcmp(format, "json") == 0;
+        } else if (strcmp(argv[i], "--seconds") == 0 && has_value) {
+            options.seconds = std::strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--timer-frames") == 0 && has_value) {
+            options.timer_frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            options.filter = argv[++i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    benchOpcodes();
+    benchSprites();
+#ifdef CHIP8_BENCH_RENDER
+    RenderBench::run();
+#endif
+    if (options.timer_frames > 0)
+        benchTimer();
+    benchRoms();
+    benchSnapshots();
+    checkAllocations();
+    checkIdleSkipping();
+    checkJit();
+
+    printResults();
+    return allocation_failed || idle_failed || jit_failed ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+
+// Small ROMs built into chip8_bench so the end-to-end numbers do not depend on
+// what happens to be in roms/. Each one loops forever.
+namespace test_roms {
+    // Register arithmetic, a skip and a back jump; no memory or display access
+    constexpr uint8_t ALU[] = {
+        0x60, 0x00,  // 200: V0 = 0
+        0x61, 0x05,  // 202: V1 = 5
+        0xA3, 0x00,  // 204: I = 0x300
+        0x70, 0x01,  // 206: V0 += 1
+        0x80, 0x14,  // 208: V0 += V1 (carry in VF)
+        0x82, 0x06,  // 20A: V2 = V0 >> 1
+        0x83, 0x13,  // 20C: V3 ^= V1
+        0x84, 0x21,  // 20E: V4 |= V2
+        0x40, 0x00,  // 210: skip if V0 != 0
+        0x71, 0x01,  // 212: V1 += 1
+        0x90, 0x10,  // 214: skip if V0 != V1
+        0x72, 0x01,  // 216: V2 += 1
+        0x85, 0x24,  // 218: V5 += V2
+        0x12, 0x06,  // 21A: jump 206
+    };
+
+    // Draws font glyphs across the screen, wrapping and clipping at the edges
+    constexpr uint8_t SPRITES[] = {
+        0x60, 0x00,  // 200: V0 = 0 (x)
+        0x61, 0x00,  // 202: V1 = 0 (y)
+        0x62, 0x00,  // 204: V2 = 0 (glyph)
+        0xF2, 0x29,  // 206: I = glyph V2
+        0xD0, 0x15,  // 208: draw 8x5 at (V0, V1)
+        0x70, 0x05,  // 20A: x += 5
+        0x71, 0x03,  // 20C: y += 3
+        0x72, 0x01,  // 20E: next glyph
+        0x63, 0x0F,  // 210: V3 = 15
+        0x82, 0x32,  // 212: glyph &= 15
+        0x12, 0x06,  // 214: jump 206
+    };
+
+    // A mix of ALU, calls, BCD, memory transfers, sprites, random numbers and
+    // skips, roughly in the proportions of a typical game loop
+    constexpr uint8_t MIXED[] = {
+        0x60, 0x00,  // 200: V0 = 0
+        0x61, 0x05,  // 202: V1 = 5
+        0xA3, 0x00,  // 204: I = 0x300
+        0x70, 0x01,  // 206: V0 += 1
+        0x80, 0x14,  // 208: V0 += V1
+        0x82, 0x06,  // 20A: V2 = V0 >> 1
+        0x22, 0x40,  // 20C: call 240
+        0x30, 0x00,  // 20E: skip if V0 == 0
+        0x12, 0x20,  // 210: jump 220
+        0x71, 0x01,  // 212: V1 += 1
+        0x63, 0x08,  // 214: V3 = 8
+        0x64, 0x10,  // 216: V4 = 16
+        0xD3, 0x45,  // 218: draw 8x5 at (V3, V4)
+        0x85, 0x00,  // 21A: V5 = V0
+        0x85, 0x13,  // 21C: V5 ^= V1
+        0x85, 0x0E,  // 21E: V5 <<= 1
+        0x45, 0x00,  // 220: skip if V5 != 0
+        0x75, 0x01,  // 222: V5 += 1
+        0x90, 0x50,  // 224: skip if V0 != V5
+        0xC0, 0x7F,  // 226: V0 = random & 0x7F
+        0x12, 0x06,  // 228: jump 206
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 22A
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xA3, 0x00,  // 240: I = 0x300
+        0xF0, 0x33,  // 242: BCD of V0 at I
+        0xF2, 0x65,  // 244: V0..V2 = [I]
+        0xF0, 0x1E,  // 246: I += V0
+        0xA3, 0x00,  // 248: I = 0x300
+        0x00, 0xEE,  // 24A: return
+    };
+
+    // SUPER-CHIP / XO-CHIP: big digits and a 16x16 sprite at 128x64, with scrolling
+    constexpr uint8_t HIRES[] = {
+        0x00, 0xFF,  // 200: high resolution
+        0x60, 0x00,  // 202: V0 = 0 (x)
+        0x61, 0x00,  // 204: V1 = 0 (y)
+        0x62, 0x00,  // 206: V2 = 0 (digit)
+        0xF2, 0x30,  // 208: I = big digit V2
+        0xD0, 0x1A,  // 20A: draw 8x10 at (V0, V1)
+        0xA2, 0x20,  // 20C: I = 0x220
+        0xD0, 0x10,  // 20E: draw 16x16 at (V0, V1)
+        0x00, 0xC1,  // 210: scroll down 1
+        0x00, 0xFB,  // 212: scroll right 4
+        0x70, 0x09,  // 214: x += 9
+        0x71, 0x03,  // 216: y += 3
+        0x72, 0x01,  // 218: next digit (Fx30 masks it to 0-F)
+        0x12, 0x08,  // 21A: jump 208
+        0x00, 0x00, 0x00, 0x00,  // 21C
+        0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F,  // 220: 16x16 sprite
+        0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0,
+        0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F,
+        0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0,
+    };
+
+    // Mostly waiting: polls the delay timer for 5 frames, then draws a glyph
+    constexpr uint8_t IDLE[] = {
+        0x60, 0x05,  // 200: V0 = 5
+        0xF0, 0x15,  // 202: delay = V0
+        0xF1, 0x07,  // 204: V1 = delay
+        0x31, 0x00,  // 206: skip if V1 == 0
+        0x12, 0x04,  // 208: jump 204
+        0x72, 0x01,  // 20A: next glyph
+        0x64, 0x0F,  // 20C: V4 = 15
+        0x82, 0x42,  // 20E: glyph &= 15
+        0xF2, 0x29,  // 210: I = glyph V2
+        0x00, 0xE0,  // 212: clear
+        0xD3, 0x35,  // 214: draw 8x5 at (V3, V3)
+        0x73, 0x01,  // 216: move diagonally
+        0x12, 0x00,  // 218: jump 200
+    };
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "chip8/core.hpp"
+#include "chip8/variant.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Runtime for ROMs compiled ahead of time by chip8_aot. The generated C++ has
+// one function per basic block of the ROM's control-flow graph; this class
+// dispatches to them by guest PC and interprets everything else: addresses
+// the graph did not reach (e.g. Bnnn targets) and blocks whose bytes in RAM
+// no longer match the ROM they were compiled from.
+class Chip8Aot {
+public:
+    // Runs the block's instructions and leaves the next guest PC in state.PC
+    using block_fn_t = void (*)(Chip8Core::State& state, Chip8Core& core);
+
+    struct Block {
+        uint16_t start;
+        // One past the last byte of the block
+        uint16_t end;
+        uint16_t length;
+        block_fn_t fn;
+    };
+
+    // Everything chip8_aot emits for one ROM
+    struct Program {
+        const char *name;
+        Variant variant;
+        const uint8_t *rom;
+        std::size_t rom_size;
+        const Block *blocks;
+        std::size_t block_count;
+    };
+
+    // The core must already hold the program's ROM and variant
+    Chip8Aot(Chip8Core& core, const Program& program);
+
+    // Same contract as Chip8Core::step/runFrames: exactly n guest instructions
+    void step(std::size_t n);
+    void runFrames(std::size_t n);
+
+    // Instructions that went through the interpreter instead of a block
+    uint64_t getInterpretedCount() const { return interpreted; }
+
+    // Headless runner behind the generated main():
+    //     [--frames <n>] [--seed <n>] [--ips <n>] [--validate]
+    // --validate runs an interpreter alongside and compares every frame.
+    static int main(const Program& program, int argc, char **argv);
+
+    // Cxkk for generated blocks, which cannot reach the core's generator
+    static uint8_t nextRandom(Chip8Core::State& state) { return Chip8Core::nextRandom(state.rng_state); }
+
+private:
+    static constexpr int32_t NO_BLOCK = -1;
+
+    Chip8Core& core;
+    Program program;
+
+    // Block index per guest address, or NO_BLOCK
+    std::array<int32_t, 4096> block_index;
+    // Guest addresses some block was compiled from
+    std::array<bool, 4096> compiled{};
+    // Per block: its bytes in RAM still match the ROM
+    std::vector<uint8_t> valid;
+    uint64_t interpreted = 0;
+
+    void revalidate(uint16_t lo, uint16_t hi);
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "chip8/core.hpp"
+#include "chip8/spsc_ring.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <SDL3/SDL.h>
+
+// Beeper output. The device runs continuously at its native rate and the
+// callback synthesizes either a band-limited square tone from a wavetable or
+// the XO-CHIP pattern buffer, ramping the gate over a couple of milliseconds
+// so it never clicks. The emulator only queues sound state changes through a
+// lock-free ring; it never pauses the device or takes a lock.
+class AudioEngine {
+public:
+    // Sound state for the callback, sent whenever it changes
+    struct Command {
+        bool gate;
+        bool use_pattern;
+        uint8_t pitch;
+        std::array<uint8_t, 16> pattern;
+    };
+
+    AudioEngine() = default;
+    ~AudioEngine();
+
+    AudioEngine(const AudioEngine&) = delete;
+    AudioEngine& operator=(const AudioEngine&) = delete;
+
+    bool open();
+    void close();
+
+    // Emulator side, once per frame: forward the core's sound timer and XO-CHIP audio state
+    void update(const Chip8Core& core);
+    // Keep the gate closed, e.g. while fast forwarding; update() applies it
+    void setMuted(bool enabled) { muted = enabled; }
+
+    // Fill out with count mono samples; called from the device callback
+    void render(float *out, int count);
+    // Build the tables for a sample rate; open() does this for the device's rate
+    void prepare(int rate);
+
+    int getSampleRate() const { return sample_rate; }
+
+private:
+    static constexpr std::size_t TABLE_BITS = 11;
+    static constexpr std::size_t TABLE_SIZE = std::size_t(1) << TABLE_BITS;
+    static constexpr float TONE_HZ = 440.0f;
+    static constexpr float VOLUME = 0.25f;
+    static constexpr float RAMP_SECONDS = 0.002f;
+
+    SDL_AudioStream *stream = nullptr;
+    int sample_rate = 0;
+
+    // Emulator side
+    SpscRing<Command, 64> commands;
+    Command sent{};
+    bool has_sent = false;
+    bool muted = false;
+
+    // Callback side
+    Command current{};
+    // One cycle of the square tone, plus a guard sample for interpolation
+    std::vector<float> wavetable;
+    uint32_t tone_phase = 0;
+    uint32_t tone_step = 0;
+    // Position in the 128-bit pattern, in bits with 32 fractional bits
+    uint64_t pattern_phase = 0;
+    uint64_t pattern_step = 0;
+    float level = 0.0f;
+    float ramp_step = 0.0f;
+
+    void apply(const Command& command);
+    float patternSample();
+
+    static void SDLCALL feed(void *userdata, SDL_AudioStream *astream, int additional_amount, int total_amount);
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "chip8/core.hpp"
+#include "chip8/worker_queue.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Records the display to an animated GIF, and the sound timer's gate to a
+// text file next to it (<path>.audio, one "<frame> on|off" line per change).
+// The emulation side only copies each finished frame into a preallocated
+// slot of a WorkerQueue. A background thread compares it with the
+// previous frame and encodes only the rectangle that changed, so a still
+// screen costs no image data at all. When the encoder falls a whole queue
+// behind, frames are dropped rather than waited for.
+class FrameCapture {
+public:
+    // Output pixels per high resolution pixel; low resolution pixels are twice that
+    static constexpr int DEFAULT_SCALE = 4;
+
+    FrameCapture() = default;
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Background, first plane, second plane and both planes as 0xRRGGBB; call before open()
+    void setPalette(const std::array<uint32_t, 4>& colors) { palette = colors; }
+    bool open(const char *path, int scale = DEFAULT_SCALE);
+    // Writes the frames still queued and finishes both files
+    void close();
+    bool isOpen() const { return frames.isRunning(); }
+
+    // Emulation side, once per finished frame (after endFrame). Never blocks
+    // unless wait is set, for runs faster than real time that must not drop.
+    void addFrame(const Chip8Core& core, bool wait = false);
+
+    uint64_t getFrameCount() const { return frames_added; }
+    // Frames dropped because the encoder was a whole queue behind
+    uint64_t getDroppedCount() const { return dropped; }
+
+private:
+    struct Frame {
+        Chip8Core::display_t display;
+        bool hires;
+        bool sound;
+        // Frames since open(), counting dropped ones, so time stays exact
+        uint64_t index;
+    };
+
+    static constexpr std::size_t QUEUE_SIZE = 32;
+    // GIF frame delays are in hundredths of a second, and most viewers show
+    // anything shorter than 2 as 10; frames shorter than that are merged
+    static constexpr uint64_t MIN_DELAY = 2;
+
+    WorkerQueue<Frame, QUEUE_SIZE> frames;
+
+    uint64_t frames_added = 0;
+    uint64_t dropped = 0;
+    std::array<uint32_t, 4> palette = {0x000000, 0xFFFFFF, 0xFF6600, 0x662200};
+    int scale = DEFAULT_SCALE;
+
+    // Encoder thread only. Frames are kept as one palette index per pixel
+    // at 128x64, low resolution frames doubled.
+    using pixels_t = std::array<uint8_t, HIRES_WIDTH * HIRES_HEIGHT>;
+    std::ofstream gif;
+    std::ofstream audio;
+    // What the GIF shows so far, and the frame waiting for its delay to be known
+    pixels_t canvas{};
+    pixels_t pending{};
+    pixels_t current{};
+    bool has_canvas = false;
+    bool has_pending = false;
+    uint64_t shown_delay = 0;
+    uint64_t last_index = 0;
+    bool sound = false;
+    std::vector<uint8_t> image;
+
+    void encode(const Frame& frame);
+    void writePending(uint64_t delay);
+    void writeHeader();
+
+    static void render(const Frame& frame, pixels_t& out);
+    // Time of frame index since open() in hundredths of a second, rounded
+    static uint64_t centiseconds(uint64_t index) { return (index * 100 + FPS / 2) / FPS; }
+};
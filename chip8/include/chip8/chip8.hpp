@@ -1,54 +1,128 @@
 #pragma once
 
+#include "chip8/audio.hpp"
+#include "chip8/capture.hpp"
+#include "chip8/core.hpp"
+#include "chip8/debugger.hpp"
+#include "chip8/input_log.hpp"
+#include "chip8/jit.hpp"
+#include "chip8/netplay.hpp"
+#include "chip8/profile.hpp"
+#include "chip8/rom_library.hpp"
+#include "chip8/spsc_ring.hpp"
 #include "chip8/timer.hpp"
+#include "chip8/triple_buffer.hpp"
 #include "chip8/defines.h"
 
 #include <array>
-#include <stack>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <filesystem>
-#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include <SDL3/SDL.h>
-#include <map>
 
 class Chip8 {
+    // chip8_bench times renderDisplay against an offscreen window
+    friend struct RenderBench;
+
 public:
     Chip8();
     ~Chip8();
 
-    Chip8(const Chip8&) = default;
+    // Owns the window, renderer and audio device; rollback and save states
+    // copy Chip8Core::State instead
+    Chip8(const Chip8&) = delete;
+    Chip8& operator=(const Chip8&) = delete;
 
     bool init();
-    bool loadRom(const char *rom_path);
+    // Map a ROM file, directory or ROM archive and start the named ROM (the
+    // first without a name); Page Up and Page Down switch ROMs while running
+    bool openLibrary(const char *path, const char *rom_name = nullptr);
+    // Instruction set and quirks; call after openLibrary() and before setJit().
+    // In a library it overrides the variant detected for every ROM.
+    void setVariant(Variant variant);
     void run();
     void clean();
 
-private:
-    using display_t = std::array<std::array<bool, WINDOW_WIDTH>, WINDOW_HEIGHT>;
-
-    std::array<uint8_t, 4096> RAM;
-    // Registers
-    std::array<uint8_t, 16> V;
-    
-    // Special registers
-    uint16_t I;
-    uint8_t delay_timer;
-    uint8_t sound_timer;
-
-    // Program counter
-    uint16_t PC;
+    void setTurbo(bool enabled);
+    // Emulated speed: "0.25", "0.5", "1", "2", "4" or "max" (the same as turbo);
+    // [ and ] step through them while running
+    bool setSpeed(const char *name);
+    // Emulate on a thread of its own, handing frames to the main thread for
+    // presentation, so a slow present does not stall the CPU; call before run()
+    void setThreaded(bool enabled) { threaded = enabled; }
+    // Run translated blocks through the x86-64 recompiler instead of interpreting
+    bool setJit(bool enabled);
+
+    // CPU clock, adjustable at runtime with - and =
+    void setInstructionsPerSecond(uint32_t rate);
+    // Charge approximate COSMAC VIP cycle costs per opcode (interpreter only)
+    bool setVipTiming(bool enabled);
+    // Log the time from each keypress to the first framebuffer change presented after it,
+    // and a summary on exit. Meant for ROMs whose screen is still until a key is pressed.
+    void setLatencyProbe(bool enabled) { latency_probe = enabled; }
+    // Pace frames off the display's vertical sync instead of the OS timer; call after init()
+    bool setVsync(bool enabled);
+    // 60 Hz ticks run back to back after a host stall before the rest are dropped
+    void setMaxCatchUp(std::size_t ticks) { fps_cap_timer.setMaxCatchUp(ticks); }
+
+    void setSeed(uint64_t seed) { core.seed(seed); }
+    // Log keypad transitions to a file for InputReplayer; call before run()
+    bool startRecording(const char *path);
+    // Record the display to an animated GIF and the sound gate to <path>.audio,
+    // encoded on a background thread; call before run()
+    bool startCapture(const char *path);
+    // Two-player rollback session with another instance running the same ROM,
+    // clock and cycle costs; waits up to timeout for it. Call after the rest
+    // of the configuration and before run(). Keys take effect at frame starts
+    // and run on the interpreter.
+    bool startNetplay(uint16_t local_port, const char *host, uint16_t port, std::chrono::milliseconds timeout);
+    // Rewrite frame time histograms and guest counters to a file every few
+    // seconds and on exit (CHIP8_PROFILE builds only). Threaded runs only
+    // write the guest counters, on exit.
+    bool setStatsFile(const char *path);
+    // Open the debugger monitor before the first instruction; call before run().
+    // The monitor reads commands from the terminal and needs the serial loop.
+    void setBreakAtStart(bool enabled) { break_at_start = enabled; }
 
-    std::stack<uint16_t> stack;
-
-    std::array<bool, 16> keypad;
-    bool waiting_for_key_release;
-    std::map<SDL_Scancode, uint8_t> key_bindings;
+private:
+    Chip8Core core;
+    std::unique_ptr<Chip8Jit> jit;
+    InputRecorder recorder;
+    FrameCapture capture;
+    Netplay netplay;
+    // Local keypad as a mask, bit n = key n
+    uint16_t netplay_keys = 0;
+
+    RomLibrary library;
+    std::string library_path;
+    std::size_t library_index = 0;
+    bool has_forced_variant = false;
+    Variant forced_variant = Variant::Chip8;
+    // Load library ROM index, keeping the clock, cycle costs and JIT
+    void switchRom(std::size_t index);
+
+    // Quick save slot next to the ROM (<rom>.state), F5 to save and F9 to load
+    std::string save_path;
+    void quickSave();
+    void quickLoad();
+
+    // Keypad key per scancode, NO_KEY when unbound
+    static constexpr uint8_t NO_KEY = 0xFF;
+    std::array<uint8_t, SDL_SCANCODE_COUNT> key_bindings;
 
-    display_t display;
     SDL_Window *window;
     SDL_Renderer *renderer;
+    // High resolution framebuffer copy, scaled up by the renderer; low
+    // resolution frames use its top-left 64x32 corner
+    SDL_Texture *texture;
+    bool needs_present;
 
     Timer<FPS> fps_cap_timer;
+    using clock = Timer<FPS>::clock;
 
     struct color {
         uint8_t r;
@@ -59,83 +133,153 @@ private:
 
     color background_color;
     color draw_color;
-    bool draw_to_screen = false;
-    
-    std::ifstream rom;
+    // XO-CHIP: pixels set on the second plane only, and on both planes
+    color plane2_color;
+    color both_color;
 
     bool is_running;
     bool is_paused;
+    // Skip the frame cap and run as fast as the host allows
+    bool turbo;
+    bool vsync;
+    bool threaded;
+
+    // Fast forward and slow motion: guest frames per 60 Hz host tick as a
+    // fraction, so the timers keep ticking once per guest frame. Only 1x
+    // plays sound.
+    struct Speed {
+        uint8_t frames;
+        uint8_t ticks;
+        const char *name;
+    };
+    static constexpr Speed SPEEDS[] = {{1, 4, "0.25"}, {1, 2, "0.5"}, {1, 1, "1"}, {2, 1, "2"}, {4, 1, "4"}};
+    static constexpr std::size_t NORMAL_SPEED = 2;
+    static constexpr std::size_t SPEED_COUNT = sizeof(SPEEDS) / sizeof(SPEEDS[0]);
+    std::size_t speed_index = NORMAL_SPEED;
+    // Guest frames owed in units of 1 / ticks, carried between host ticks
+    uint32_t frame_credit = 0;
+    // One step along 0.25x ... 4x and then uncapped
+    void changeSpeed(int direction);
+
+    // Sustained emulated speed, shown in the window title once a second
+    static constexpr double SPEED_SAMPLE_SECONDS = 1.0;
+    clock::time_point speed_sample_time;
+    uint64_t speed_sample_frames = 0;
+    uint64_t speed_sample_instructions = 0;
+    void updateSpeedDisplay(uint64_t frames, uint64_t instructions);
+
+    // Keypad transition with the time the host saw it
+    struct KeyEvent {
+        clock::time_point time;
+        uint8_t key;
+        bool pressed;
+    };
+    // Waiting for the frame whose time span they fall in, oldest first
+    static constexpr std::size_t MAX_PENDING_KEYS = 256;
+    std::vector<KeyEvent> pending_keys;
+    clock::time_point last_frame_end;
+
+    // Run the guest frames of the 60 Hz ticks that came due, at the current speed
+    void emulateTicks(std::size_t ticks);
+    // Turbo: as many frames as fit before the next 60 Hz present, so the
+    // display is updated at most at that rate however fast the CPU runs
+    void emulateUncapped();
+    // One frame covering host time [begin, end): the CPU budget for it, with
+    // each pending key applied at the same fraction of the budget as its
+    // arrival time is of the span, then the delay and sound timers
+    void emulateFrame(clock::time_point begin, clock::time_point end);
+    // Run the frame budget down to leave, on the JIT or the interpreter
+    void runFrameBudget(int32_t leave);
+    // A netplay frame: the pending keys before end, then one frame (or a wait
+    // for the peer) with any rollback it needs
+    void emulateNetplayFrame(clock::time_point end);
+
+    // Actions from the keyboard that change emulation state. Applied directly,
+    // or by the emulation thread when it owns the core.
+    enum class Control : uint8_t {
+        TogglePause, ToggleTurbo, SpeedUp, SlowDown, FastForward, SlowMotion, QuickSave, QuickLoad, NextRom, PreviousRom,
+        Break
+    };
+    void control(Control action);
+    void applyControl(Control action);
+    void queueKey(const KeyEvent& event);
+
+    // Host time of an SDL event, on the frame timer's clock
+    static clock::time_point eventTime(const SDL_Event& event);
+
+    // Keypress to presented framebuffer change, main thread only
+    bool latency_probe = false;
+    bool probe_waiting = false;
+    clock::time_point probe_start;
+    std::vector<double> latency_ms;
+    void probePresented();
+    void logLatencySummary() const;
+
+    // Threaded mode. Everything below is shared with the emulation thread only
+    // through the atomics, the control ring and the frame triple buffer.
+    std::thread emulation_thread;
+    std::atomic<bool> emulation_running{false};
+    SpscRing<Control, 64> controls;
+    // Timestamped keypad transitions; the emulation thread moves them to pending_keys
+    SpscRing<KeyEvent, MAX_PENDING_KEYS> key_events;
+    struct Frame {
+        Chip8Core::display_t display;
+        bool hires;
+        // For the speed display, which must not read the core
+        uint64_t frame_count;
+        uint64_t instruction_count;
+    };
+    TripleBuffer<Frame> published_frames;
+
+    // Emulation thread side
+    void emulationLoop();
+
+    // Main thread side: the frame on screen
+    Frame shown_frame{};
+    void runSerial();
+    void runThreaded();
+    void stopEmulationThread();
+
+#ifdef CHIP8_PROFILE
+    using stats_clock = std::chrono::steady_clock;
+    static constexpr double FRAME_BUDGET_US = 1e6 / FPS;
+    static constexpr std::chrono::seconds STATS_INTERVAL{5};
+
+    std::string stats_path;
+    stats_clock::time_point last_stats_write;
+    profile::Histogram emulate_time{FRAME_BUDGET_US};
+    profile::Histogram render_time{FRAME_BUDGET_US};
+    profile::Histogram sleep_time{FRAME_BUDGET_US};
+    profile::Histogram frame_time{FRAME_BUDGET_US};
+
+    void recordFrame(stats_clock::time_point start, stats_clock::time_point emulated, stats_clock::time_point rendered);
+    void writeStats() const;
+#endif
 
     void clearWindow();
-    void renderDisplay();
-
-    std::string get_memory_region_label(std::size_t address) const;
-    void showRamContent() const;
-
-    void handleInput(const SDL_Scancode& key, const Uint32& event_type);
-
-    static void SDLCALL FeedTheAudioStreamMore(void *userdata, SDL_AudioStream *astream, int additional_amount, int total_amount);
-
-    bool configureSound();
-    void playSound();
-    void stopSound();
-    static int current_sine_sample;
-    SDL_AudioStream *stream;
-
-    void executeInstruction(uint16_t instruction);
-    // Standard Chip-8 Instructions
-    void instr_set_0(uint16_t instruction);
-    void instr_00E0();
-    void instr_00EE(); 
-
-    void instr_0nnn(uint16_t nnn);
-    void instr_1nnn(uint16_t nnn);
-    void instr_2nnn(uint16_t nnn);
-    
-    void instr_3xkk(uint8_t x, uint8_t kk);
-    void instr_4xkk(uint8_t x, uint8_t kk);
-
-    void instr_5xy0(uint8_t x, uint8_t y);
-
-    void instr_6xkk(uint8_t x, uint8_t kk);
-    void instr_7xkk(uint8_t x, uint8_t kk);
-
-    void instr_set_8(uint16_t instruction, uint8_t x, uint8_t y);
-    void instr_8xy0(uint8_t x, uint8_t y);
-    void instr_8xy1(uint8_t x, uint8_t y);
-    void instr_8xy2(uint8_t x, uint8_t y);
-    void instr_8xy3(uint8_t x, uint8_t y);
-    void instr_8xy4(uint8_t x, uint8_t y);
-    void instr_8xy5(uint8_t x, uint8_t y);
-    void instr_8xy6(uint8_t x, uint8_t y);
-    void instr_8xy7(uint8_t x, uint8_t y);
-
-    void instr_8xyE(uint8_t x, uint8_t y);
-
-    void instr_9xy0(uint8_t x, uint8_t y);
-
-    void instr_Annn(uint16_t nnn);
-    void instr_Bnnn(uint16_t nnn);
-
-    void instr_Cxkk(uint8_t x, uint8_t kk);
-
-    void instr_Dxyn(uint8_t x, uint8_t y, uint8_t n);
-
-    void instr_set_E(uint16_t instruction, uint8_t x);
-    void instr_Ex9E(uint8_t x);
-    void instr_ExA1(uint8_t x);
-
-    void instr_set_F(uint16_t instruction, uint8_t x);
-    void instr_Fx07(uint8_t x);
-    void instr_Fx0A(uint8_t x);
-    void instr_Fx15(uint8_t x);
-    void instr_Fx18(uint8_t x);
-    void instr_Fx1E(uint8_t x);
-    void instr_Fx29(uint8_t x);
-    void instr_Fx33(uint8_t x);
-    void instr_Fx55(uint8_t x);
-    void instr_Fx65(uint8_t x);
-
-    // TODO Add Other Chip-8 Variants Instructions
-    
-};  
+    static uint32_t toPixel(const color& c);
+    void updateTextureRows(const Chip8Core::display_t& display, bool hires, int first, int last);
+    void renderDisplay(const Chip8Core::display_t& display, bool hires, uint64_t dirty_rows);
+
+    const char *get_memory_region_label(std::size_t address) const;
+    // Hex and ASCII dump of the 16-byte rows covering [from, to)
+    void showRamContent(std::size_t from = 0, std::size_t to = 4096) const;
+    void showRegisters() const;
+
+    // Breakpoints and watchpoints, attached to the core only while one is
+    // set, so the core runs without debugging code the rest of the time.
+    // Hitting one, or the ` key, opens a command monitor on the terminal;
+    // the window stands still until it continues.
+    Debugger debugger;
+    bool break_at_start = false;
+    // Until continue or quit; false on quit
+    bool runMonitor();
+    // One command line; false to leave the monitor
+    bool monitorCommand(const std::string& line);
+    void showStop() const;
+    void listBreakpoints() const;
+
+    void handleInput(const SDL_Event& event);
+
+    AudioEngine audio;
+};
@@ -0,0 +1,386 @@
+#pragma once
+
+#include "chip8/defines.h"
+#include "chip8/profile.hpp"
+#include "chip8/variant.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <type_traits>
+
+class Debugger;
+class TraceWriter;
+
+// SDL-free Chip-8 machine: CPU, RAM, timers and framebuffer.
+// The SDL frontend (Chip8) drives one of these, but it can also be run
+// headless as fast as the host allows. It runs CHIP-8, SUPER-CHIP or XO-CHIP
+// (see variant.hpp); XO-CHIP within the same 4 KiB address space.
+class Chip8Core {
+    friend class Chip8Jit;
+    friend class Chip8Lanes;
+    friend class Chip8Aot;
+
+public:
+    // One bit per pixel, two words per row of up to 128 pixels. Bit 63 of the
+    // first word is the leftmost pixel (x = 0). Low resolution screens only use
+    // the top-left 64x32 pixels, i.e. the first word of rows 0 to 31.
+    using display_row_t = std::array<uint64_t, 2>;
+    using display_plane_t = std::array<display_row_t, HIRES_HEIGHT>;
+    // XO-CHIP draws into two bitplanes; the other variants only use the first
+    using display_t = std::array<display_plane_t, 2>;
+    using ram_t = std::array<uint8_t, 4096>;
+
+    static constexpr uint16_t ROM_START = 0x200;
+    static constexpr std::size_t MAX_ROM_SIZE = 4096 - ROM_START;
+    static constexpr std::size_t STACK_SIZE = 16;
+    // SUPER-CHIP 8x10 digits for Fx30, after the 4x5 font
+    static constexpr uint16_t BIG_FONT_ADDRESS = 0x50;
+
+    // Everything the guest can observe, in one trivially copyable block so a
+    // snapshot or restore is a single copy
+    struct State {
+        ram_t RAM;
+        // Registers
+        std::array<uint8_t, 16> V;
+
+        // Special registers
+        uint16_t I;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+
+        // Program counter
+        uint16_t PC;
+
+        // Call stack and stack pointer (number of entries in use). Calls on a
+        // full stack and returns on an empty one are logged and ignored.
+        std::array<uint16_t, STACK_SIZE> stack;
+        uint8_t SP;
+
+        std::array<bool, 16> keypad;
+        bool waiting_for_key_release;
+
+        // XO-CHIP audio: F002 loads 128 one-bit samples, played while the sound
+        // timer runs at 4000 * 2^((pitch - 64) / 48) Hz; Fx3A sets the pitch
+        std::array<uint8_t, 16> audio_pattern;
+        uint8_t pitch;
+        bool audio_pattern_loaded;
+
+        display_t display;
+        // SUPER-CHIP/XO-CHIP: 128x64 mode, the bitplanes drawn to (XO-CHIP Fn01)
+        // and the RPL user flags saved by Fx75
+        bool hires;
+        uint8_t planes;
+        std::array<uint8_t, 16> rpl_flags;
+
+        uint64_t rng_state;
+        uint64_t instruction_count;
+        uint64_t frame_count;
+
+        // Scheduler carry: the fraction of an instruction (or cycle) per frame
+        // left over by the rate, in 1/FPS units, and the budget of the frame in
+        // progress (negative when the last instruction overran it)
+        uint32_t rate_remainder;
+        int32_t cycle_budget;
+    };
+
+    static constexpr uint8_t DEFAULT_PITCH = 64;
+
+    // Cycles charged per opcode class (see profile::opcodeClass)
+    using CycleCosts = std::array<uint16_t, profile::OPCODE_CLASSES>;
+    // Approximate COSMAC VIP interpreter timings in machine cycles, and the rate
+    // to go with them: 1.76 MHz / 8, less about half taken by the display DMA
+    static const CycleCosts VIP_CYCLES;
+    static constexpr uint32_t VIP_CYCLES_PER_SECOND = 110000;
+
+    Chip8Core();
+
+    // Back to power-on state (font loaded, ROM area cleared)
+    void reset();
+    bool loadRom(const uint8_t *data, std::size_t size);
+    bool loadRom(const char *rom_path);
+
+    // Fetch, decode and execute n instructions, or fewer if an attached
+    // debugger stops before one of them
+    void step(std::size_t n = 1);
+    // Run n frames of the scheduled budget, each followed by a 60 Hz timer tick
+    void runFrames(std::size_t n = 1);
+    void tickTimers();
+
+    // A frame is beginFrame(), any number of runBudget() calls and endFrame().
+    // beginFrame adds rate / FPS to the budget, carrying the remainder, so the
+    // long run rate is exact. endFrame drops budget left unused (e.g. paused)
+    // but keeps an overrun, then ticks the timers.
+    void beginFrame();
+    // Execute until no more than leave of the frame budget is left, or until
+    // max_instructions ran; returns the instructions run
+    std::size_t runBudget(std::size_t max_instructions = SIZE_MAX, int32_t leave = 0);
+    // Hand the budget above leave to an external executor (the JIT); one
+    // instruction per unit, so only without cycle costs
+    std::size_t takeInstructionBudget(int32_t leave = 0);
+    void endFrame();
+
+    // If PC sits in a loop whose iterations leave the machine unchanged (a
+    // jump to itself, a delay timer poll, Fx0A with no key), account whole
+    // iterations of it out of n instructions without running them; returns
+    // how many instructions that was, including one iteration it may have to
+    // run first. Keys and timers only change between calls, so the outcome
+    // is the same as executing them. runBudget() does this by itself;
+    // executors given takeInstructionBudget() call it first.
+    std::size_t skipIdle(std::size_t n);
+    // On by default; off runs every instruction, e.g. to time the interpreter
+    void setIdleSkipping(bool enabled) { idle_skipping = enabled; }
+    // Instructions accounted by skipIdle() since reset()
+    uint64_t getIdleInstructionCount() const { return idle_instructions; }
+
+    // Run an instruction that was not fetched: at the current PC, or at
+    // address with PC already past it (as after a fetch)
+    void executeInstruction(uint16_t instruction);
+    void executeInstruction(uint16_t instruction, uint16_t address);
+
+    // Calls on a full stack and returns on an empty one since reset(); only
+    // the first is logged
+    uint64_t getCallStackFaultCount() const { return call_stack_faults; }
+
+    // Record every instruction executed, with the registers it changed, until
+    // set back to nullptr (TraceWriter does both). Idle loops are run rather
+    // than skipped meanwhile, so the trace has every instruction.
+    void setTracer(TraceWriter *writer) { tracer = writer; }
+    bool isTracing() const { return tracer != nullptr; }
+
+    // Check breakpoints and watchpoints before every instruction until set
+    // back to nullptr; step() and runBudget() return early when it stops. Idle
+    // loops are run rather than skipped meanwhile.
+    void setDebugger(Debugger *attached) { debugger = attached; }
+    bool isDebugging() const { return debugger != nullptr; }
+
+    // Predecoded instruction: handler plus operands extracted once per RAM word
+    struct DecodedOp {
+        using handler_t = void (*)(Chip8Core&, const DecodedOp&);
+
+        handler_t handler;
+        uint16_t nnn;
+        uint8_t x;
+        uint8_t y;
+        uint8_t n;
+        uint8_t kk;
+        // Budget charged by runBudget, 1 unless cycle costs are set
+        uint16_t cycles;
+    };
+
+    static DecodedOp decode(uint16_t instruction, Variant variant = Variant::Chip8);
+
+    // Instruction set and quirks; reset() and loadRom() keep it
+    void setVariant(Variant variant);
+    Variant getVariant() const { return active_variant; }
+
+    // Instructions per second, or cycles per second when cycle costs are set
+    void setInstructionsPerSecond(uint32_t rate) { instructions_per_second = rate; }
+    uint32_t getInstructionsPerSecond() const { return instructions_per_second; }
+    void setInstructionsPerFrame(std::size_t ipf) { instructions_per_second = static_cast<uint32_t>(ipf * FPS); }
+
+    // Charge each instruction its opcode's cost against the budget instead of
+    // one; nullptr goes back to counting instructions
+    void setCycleCosts(const CycleCosts *costs);
+    bool hasCycleCosts() const { return cycle_costs != nullptr; }
+
+    // Budget for one frame at rate per second, advancing the carried remainder
+    static uint32_t frameBudget(uint32_t rate, uint32_t& remainder);
+
+    void setKey(uint8_t key, bool pressed) { state.keypad[key & 0xF] = pressed; }
+
+    const State& getState() const { return state; }
+    // Restore a snapshot taken with getState() from a core running the same ROM or any other
+    void setState(const State& snapshot);
+
+    // Cxkk draws from a per-instance xorshift generator. reset() and loadRom()
+    // restart it from the seed, so a given seed and input always replay the same.
+    void seed(uint64_t value);
+    uint64_t getSeed() const { return rng_seed; }
+
+    const display_t& getDisplay() const { return state.display; }
+    bool getPixel(int x, int y, int plane = 0) const { return (state.display[plane][y][x >> 6] >> (63 - (x & 63))) & 1; }
+    // 128x64 rather than 64x32
+    bool isHires() const { return state.hires; }
+    const ram_t& getRam() const { return state.RAM; }
+    bool isSoundActive() const { return state.sound_timer > 0; }
+
+    // Bit per framebuffer row (bit 0 = row 0) changed since the last call
+    uint64_t consumeDirtyRows();
+
+    // FNV-1a hash of the framebuffer, for comparing runs
+    uint64_t hashDisplay() const { return hashDisplay(state.display); }
+    static uint64_t hashDisplay(const display_t& display);
+
+    uint64_t getInstructionCount() const { return state.instruction_count; }
+    uint64_t getFrameCount() const { return state.frame_count; }
+
+    // Reports the RAM range [lo, hi) written by Fx33/Fx55 since the last call,
+    // so translated code covering it can be dropped
+    bool consumeCodeWrite(uint16_t& lo, uint16_t& hi);
+
+    // Opcode counts, hottest addresses and PC heatmap (CHIP8_PROFILE builds only)
+    void writeProfile(std::ostream& out) const;
+
+private:
+    State state;
+    static_assert(std::is_trivially_copyable<State>::value, "State must stay trivially copyable");
+
+    uint64_t dirty_rows;
+
+#ifdef CHIP8_PROFILE
+    profile::GuestCounters profile_counters;
+#endif
+
+    uint64_t call_stack_faults;
+    // Set while executeInstruction runs, so a fault reports the right address
+    bool direct_execute;
+    uint16_t direct_pc;
+    void callStackFault(const char *message);
+
+    uint64_t rng_seed;
+    uint8_t nextRandom() { return nextRandom(state.rng_state); }
+
+    // Generator state for a seed, and one xorshift64* step of it
+    static uint64_t seedState(uint64_t value);
+    static uint8_t nextRandom(uint64_t& rng_state);
+
+    uint32_t instructions_per_second;
+    const CycleCosts *cycle_costs;
+
+    // Longest idle loop recognised, and instructions between idle checks
+    // inside one long budget
+    static constexpr std::size_t MAX_IDLE_LOOP = 8;
+    static constexpr std::size_t IDLE_CHECK_INTERVAL = 1024;
+
+    bool idle_skipping;
+    uint64_t idle_instructions;
+
+    TraceWriter *tracer;
+    Debugger *debugger;
+    // step() recording every instruction and checking it against the
+    // debugger; returns the instructions run
+    std::size_t stepHooked(std::size_t n);
+    // runBudget() one instruction at a time, for cycle costs or a debugger;
+    // HOOKED while tracing or debugging
+    template<bool HOOKED> std::size_t runCycles(std::size_t max_instructions, int32_t leave);
+    // Run op, fetched from pc, and record it
+    void executeTraced(uint16_t pc, const DecodedOp& op);
+
+    // Instructions in one iteration of the loop at PC that comes back to PC
+    // without writing memory or drawing (0 if there is none), with the budget
+    // the iteration costs and the addresses it runs. settled is false when
+    // the iteration still changes registers, e.g. to pick up a new timer value.
+    std::size_t idleLoop(uint32_t& cost, std::array<uint16_t, MAX_IDLE_LOOP>& addresses, bool& settled) const;
+    void accountIdle(std::size_t iterations, std::size_t length, const std::array<uint16_t, MAX_IDLE_LOOP>& addresses);
+
+    Variant active_variant;
+    // op_decode for the active variant
+    DecodedOp::handler_t undecoded;
+
+    // One entry per RAM address (PC may be odd). Entries start as op_decode,
+    // which decodes on first execution, and are reset by writes into RAM.
+    std::array<DecodedOp, 4096> decode_cache;
+
+    // Union of RAM writes not yet reported through consumeCodeWrite (empty when lo >= hi)
+    uint16_t code_write_lo;
+    uint16_t code_write_hi;
+
+    void invalidateDecodeCache();
+    void invalidateDecodeCache(uint16_t address, std::size_t length);
+
+    // Predecoded handlers, see decode.cpp. Everything a variant changes is a
+    // template on its policy struct, so each variant gets its own handlers
+    // with the quirks compiled in rather than tested per instruction.
+    template<class V> static void op_decode(Chip8Core& c, const DecodedOp& op);
+    template<class V> static DecodedOp decodeFor(uint16_t instruction);
+    static void op_nop(Chip8Core& c, const DecodedOp& op);
+    template<void (Chip8Core::*fn)()> static void op_none(Chip8Core& c, const DecodedOp& op);
+    template<void (Chip8Core::*fn)(uint8_t)> static void op_n(Chip8Core& c, const DecodedOp& op);
+    template<void (Chip8Core::*fn)(uint16_t)> static void op_nnn(Chip8Core& c, const DecodedOp& op);
+    template<void (Chip8Core::*fn)(uint8_t)> static void op_x(Chip8Core& c, const DecodedOp& op);
+    template<void (Chip8Core::*fn)(uint8_t, uint8_t)> static void op_xkk(Chip8Core& c, const DecodedOp& op);
+    template<void (Chip8Core::*fn)(uint8_t, uint8_t)> static void op_xy(Chip8Core& c, const DecodedOp& op);
+    template<void (Chip8Core::*fn)(uint8_t, uint8_t, uint8_t)> static void op_xyn(Chip8Core& c, const DecodedOp& op);
+
+    // Skip the next instruction (all four bytes of an XO-CHIP F000 nnnn)
+    template<class V> void skipNext();
+    // Dxyn into the selected planes at the current resolution
+    template<class V, int BYTES> void drawSprite(uint8_t x, uint8_t y, uint8_t rows);
+    // One plane of a WIDTH x HEIGHT screen; true on collision
+    template<bool WRAP, int WIDTH, int HEIGHT, int BYTES>
+    bool drawPlane(display_plane_t& plane, uint8_t vx, uint8_t vy, uint16_t address, uint8_t rows);
+    // Selected planes by whole rows (down < 0 is up) or by pixels (right < 0 is left)
+    void scrollPlanes(int down, int right);
+
+    // Standard Chip-8 Instructions
+    template<class V> void instr_00E0();
+    void instr_00EE();
+
+    void instr_0nnn(uint16_t nnn);
+    void instr_1nnn(uint16_t nnn);
+    void instr_2nnn(uint16_t nnn);
+
+    template<class V> void instr_3xkk(uint8_t x, uint8_t kk);
+    template<class V> void instr_4xkk(uint8_t x, uint8_t kk);
+
+    template<class V> void instr_5xy0(uint8_t x, uint8_t y);
+
+    void instr_6xkk(uint8_t x, uint8_t kk);
+    void instr_7xkk(uint8_t x, uint8_t kk);
+
+    void instr_8xy0(uint8_t x, uint8_t y);
+    template<class V> void instr_8xy1(uint8_t x, uint8_t y);
+    template<class V> void instr_8xy2(uint8_t x, uint8_t y);
+    template<class V> void instr_8xy3(uint8_t x, uint8_t y);
+    void instr_8xy4(uint8_t x, uint8_t y);
+    void instr_8xy5(uint8_t x, uint8_t y);
+    template<class V> void instr_8xy6(uint8_t x, uint8_t y);
+    void instr_8xy7(uint8_t x, uint8_t y);
+
+    template<class V> void instr_8xyE(uint8_t x, uint8_t y);
+
+    template<class V> void instr_9xy0(uint8_t x, uint8_t y);
+
+    void instr_Annn(uint16_t nnn);
+    template<class V> void instr_Bnnn(uint16_t nnn);
+
+    void instr_Cxkk(uint8_t x, uint8_t kk);
+
+    template<class V> void instr_Dxyn(uint8_t x, uint8_t y, uint8_t n);
+
+    template<class V> void instr_Ex9E(uint8_t x);
+    template<class V> void instr_ExA1(uint8_t x);
+
+    void instr_Fx07(uint8_t x);
+    void instr_Fx0A(uint8_t x);
+    void instr_Fx15(uint8_t x);
+    void instr_Fx18(uint8_t x);
+    void instr_Fx1E(uint8_t x);
+    void instr_Fx29(uint8_t x);
+    void instr_Fx33(uint8_t x);
+    template<class V> void instr_Fx55(uint8_t x);
+    template<class V> void instr_Fx65(uint8_t x);
+
+    // SUPER-CHIP
+    void instr_00Cn(uint8_t n);
+    void instr_00FB();
+    void instr_00FC();
+    void instr_00FD();
+    void instr_00FE();
+    void instr_00FF();
+    template<class V> void instr_Dxy0(uint8_t x, uint8_t y);
+    void instr_Fx30(uint8_t x);
+    void instr_Fx75(uint8_t x);
+    void instr_Fx85(uint8_t x);
+
+    // XO-CHIP
+    void instr_00Dn(uint8_t n);
+    void instr_5xy2(uint8_t x, uint8_t y);
+    void instr_5xy3(uint8_t x, uint8_t y);
+    void instr_F000();
+    void instr_Fn01(uint8_t n);
+    void instr_F002();
+    void instr_Fx3A(uint8_t x);
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class Chip8Core;
+
+// PC breakpoints and RAM watchpoints for Chip8Core::setDebugger, one bit per
+// address each. While attached the core tests one bit per instruction before
+// running it; only addresses with a breakpoint (or every address while any
+// watchpoint is set) go on to the full check. Detached, the core's loops
+// carry no debugging code at all, so attach it only while something is set.
+class Debugger {
+public:
+    // Why the core stopped
+    enum class Stop : uint8_t { None, Breakpoint, Read, Write };
+
+    // Accesses a watchpoint stops on, combinable
+    static constexpr uint8_t READ = 1;
+    static constexpr uint8_t WRITE = 2;
+
+    void setBreakpoint(uint16_t address, bool enabled);
+    bool hasBreakpoint(uint16_t address) const { return test(breakpoints, address); }
+    // Stop before an instruction reads or writes [address, address + length);
+    // access 0 stops watching the range
+    void watch(uint16_t address, std::size_t length, uint8_t access);
+    uint8_t getWatch(uint16_t address) const;
+    void clear();
+    // Nothing set, so there is no need to attach it
+    bool empty() const { return !any_breakpoint && !any_watch; }
+
+    // The core stopped before running the instruction at getStopPc(); for a
+    // watchpoint, getStopAddress() is the first watched byte it would touch
+    Stop getStop() const { return stop_reason; }
+    bool hasStopped() const { return stop_reason != Stop::None; }
+    uint16_t getStopPc() const { return stop_pc; }
+    uint16_t getStopAddress() const { return stop_address; }
+    // Clear the stop and let the instruction at the core's PC run, without
+    // stopping on it, the next time the core steps
+    void resume(const Chip8Core& core);
+
+    // Core side: whether the instruction at pc needs the full check
+    bool checks(uint16_t pc) const { return test(check_bits, pc); }
+    // The full check; true to stop before running it
+    bool stop(const Chip8Core& core, uint16_t pc);
+
+    // RAM the instruction at pc reads or writes when run now, as [address,
+    // address + length); false if it does not touch data memory. wraps is set
+    // when the range continues at 0 past the end of RAM instead of stopping.
+    static bool dataAccess(const Chip8Core& core, uint16_t pc, uint16_t& address, std::size_t& length, bool& write, bool& wraps);
+
+private:
+    using bitmap_t = std::array<uint64_t, 64>;
+
+    bitmap_t breakpoints{};
+    bitmap_t reads{};
+    bitmap_t writes{};
+    // Breakpoints, or every address while a watchpoint is set
+    bitmap_t check_bits{};
+    bool any_breakpoint = false;
+    bool any_watch = false;
+
+    Stop stop_reason = Stop::None;
+    uint16_t stop_pc = 0;
+    uint16_t stop_address = 0;
+    // The next check, if at resume_pc, lets the instruction run
+    bool resuming = false;
+    uint16_t resume_pc = 0;
+
+    static bool test(const bitmap_t& bits, uint16_t address) {
+        address &= 0xFFF;
+        return (bits[address >> 6] >> (address & 63)) & 1;
+    }
+    static void assign(bitmap_t& bits, uint16_t address, bool value);
+    static bool any(const bitmap_t& bits);
+    void update();
+};
@@ -3,6 +3,10 @@
 #define WINDOW_WIDTH 64
 #define WINDOW_HEIGHT 32
 
+// SUPER-CHIP and XO-CHIP high resolution mode
+#define HIRES_WIDTH 128
+#define HIRES_HEIGHT 64
+
 #define SCALE 10
 
 #define INSTRUCTION_PER_SECOND 700
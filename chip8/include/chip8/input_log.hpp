@@ -0,0 +1,90 @@
+#pragma once
+
+#include "chip8/core.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+// Binary keypad log. The header holds the PRNG seed, the instructions (or cycles)
+// per second, the cycle cost table and the variant in use.
+// Each record after it is
+//     varint frame delta, varint instruction delta, event byte
+// and the log ends with an END record that marks the last frame of the session.
+namespace input_log {
+    constexpr char MAGIC[4] = {'C', '8', 'I', 'N'};
+    constexpr uint16_t VERSION = 3;
+
+    // Header byte naming the cycle cost table
+    constexpr uint8_t COSTS_NONE = 0;
+    constexpr uint8_t COSTS_VIP = 1;
+
+    // Event byte: low nibble is the key for KEY_UP/KEY_DOWN
+    constexpr uint8_t KEY_UP = 0x00;
+    constexpr uint8_t KEY_DOWN = 0x10;
+    constexpr uint8_t PAUSE_OFF = 0x20;
+    constexpr uint8_t PAUSE_ON = 0x21;
+    constexpr uint8_t END = 0xFF;
+
+    struct Event {
+        uint64_t frame;
+        uint64_t instruction;
+        uint8_t code;
+    };
+}
+
+class InputRecorder {
+public:
+    InputRecorder() = default;
+    ~InputRecorder();
+
+    // Open right after the ROM is loaded; positions are counted from power-on
+    bool open(const char *path, const Chip8Core& core);
+    bool isOpen() const { return out.is_open(); }
+
+    void recordKey(const Chip8Core& core, uint8_t key, bool pressed);
+    void recordPause(const Chip8Core& core, bool paused);
+
+    // Writes the END record and closes the file
+    void finish(const Chip8Core& core);
+
+private:
+    std::ofstream out;
+    uint64_t last_frame = 0;
+    uint64_t last_instruction = 0;
+
+    void write(const Chip8Core& core, uint8_t code);
+    void writeVarint(uint64_t value);
+};
+
+// Feeds a recorded log back into a core, applying every event at the exact
+// frame and instruction it was recorded at
+class InputReplayer {
+public:
+    bool open(const char *path);
+
+    // Seeds a freshly loaded core and restores the recorded rate, cycle costs and variant
+    void start(Chip8Core& core);
+
+    // Run one frame; returns false once the recorded session has ended
+    bool runFrame(Chip8Core& core);
+
+    uint64_t getEndFrame() const { return end_frame; }
+    // True if an event was due at an instruction the core had already passed
+    bool isDesynced() const { return desynced; }
+
+private:
+    uint64_t seed = 0;
+    uint32_t instructions_per_second = 0;
+    uint8_t costs = input_log::COSTS_NONE;
+    Variant variant = Variant::Chip8;
+    uint64_t end_frame = 0;
+
+    std::vector<input_log::Event> events;
+    std::size_t next_event = 0;
+    bool paused = false;
+    bool desynced = false;
+
+    void apply(Chip8Core& core, const input_log::Event& event);
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "chip8/core.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Optional x86-64 dynamic recompiler for a Chip8Core.
+// Straight-line runs of register, timer and branch instructions are translated
+// into native basic blocks that keep the guest V registers, I and PC in host
+// registers. Everything else (sprites, keypad, calls, memory access) runs
+// through the core's interpreter one instruction at a time.
+// On hosts without x86-64 support every step falls back to the interpreter.
+class Chip8Jit {
+public:
+    explicit Chip8Jit(Chip8Core& core);
+    ~Chip8Jit();
+
+    Chip8Jit(const Chip8Jit&) = delete;
+    Chip8Jit& operator=(const Chip8Jit&) = delete;
+
+    static bool isSupported();
+
+    // Same contract as Chip8Core::step/runFrames: exactly n guest instructions
+    void step(std::size_t n);
+    void runFrames(std::size_t n);
+
+    // Drop every translated block
+    void flush();
+
+    std::size_t getBlockCount() const { return blocks.size(); }
+
+private:
+    using block_fn_t = void (*)(Chip8Core*);
+
+    struct Block {
+        block_fn_t fn;
+        uint16_t start;
+        uint16_t end;
+        uint16_t length;
+    };
+
+    static constexpr int32_t NOT_TRANSLATED = -1;
+    static constexpr int32_t UNTRANSLATABLE = -2;
+    static constexpr std::size_t MAX_BLOCK_LENGTH = 64;
+    static constexpr std::size_t CODE_BUFFER_SIZE = 1 << 20;
+    static constexpr std::size_t MAX_BLOCKS = 16384;
+    static constexpr std::size_t EMIT_BUFFER_SIZE = 16384;
+
+    Chip8Core& core;
+
+    // Block index per guest address, or NOT_TRANSLATED/UNTRANSLATABLE
+    std::array<int32_t, 4096> block_index;
+    std::vector<Block> blocks;
+
+    uint8_t *code;
+    std::size_t code_used;
+
+    // Scratch space reused by every translation, so the JIT does not touch
+    // the heap once it is running
+    std::vector<uint16_t> block_instructions;
+    std::vector<uint8_t> emit_buffer;
+
+    int32_t translate(uint16_t pc);
+    void invalidate(uint16_t lo, uint16_t hi);
+};
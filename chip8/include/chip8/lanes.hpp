@@ -0,0 +1,111 @@
+#pragma once
+
+#include "chip8/core.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Runs many copies of one ROM in lockstep. V, I, PC, the timers and the keypad
+// of every copy (lane) are kept in struct-of-arrays layout, so lanes sitting at
+// the same PC execute that instruction together with SIMD (AVX2 when built
+// with CHIP8_LANES_AVX2, SSE2 on other x86-64 builds, plain loops elsewhere).
+// Lanes that diverge are split into groups and each group runs on its own.
+// Every lane behaves exactly like a Chip8Core in the CHIP-8 variant seeded and
+// driven the same way.
+class Chip8Lanes {
+public:
+    explicit Chip8Lanes(std::size_t lane_count);
+
+    // Every lane gets the same ROM and is reset to power-on state
+    bool loadRom(const uint8_t *data, std::size_t size);
+    bool loadRom(const char *rom_path);
+
+    // Back to power-on state with the loaded ROM still in RAM
+    void restart();
+
+    // Same contract as Chip8Core: every lane executes exactly n instructions
+    void step(std::size_t n = 1);
+    void runFrames(std::size_t n = 1);
+    void tickTimers();
+
+    // Same frame budgets as Chip8Core, without cycle costs
+    void setInstructionsPerSecond(uint32_t rate) { instructions_per_second = rate; }
+    uint32_t getInstructionsPerSecond() const { return instructions_per_second; }
+
+    void seed(std::size_t lane, uint64_t value);
+    void setKey(std::size_t lane, uint8_t key, bool pressed);
+
+    std::size_t getLaneCount() const { return lane_count; }
+    // Gathers one lane into the layout used by Chip8Core
+    Chip8Core::State getLaneState(std::size_t lane) const;
+    uint64_t hashDisplay(std::size_t lane) const;
+
+    uint64_t getInstructionCount() const { return instruction_count; }
+    uint64_t getFrameCount() const { return frame_count; }
+    // Lockstep groups executed so far; equal to the instruction count while no lane diverges
+    uint64_t getGroupCount() const { return group_count; }
+
+private:
+    // State only touched by the per-lane (non-SIMD) instructions
+    struct LaneMemory {
+        Chip8Core::ram_t RAM;
+        // CHIP-8 only draws to 64x32, so one word per row of the first plane
+        std::array<uint64_t, WINDOW_HEIGHT> display;
+        std::array<uint16_t, Chip8Core::STACK_SIZE> stack;
+        uint64_t rng_state;
+        uint8_t SP;
+        bool waiting_for_key_release;
+        std::array<uint8_t, 16> audio_pattern;
+        uint8_t pitch;
+        bool audio_pattern_loaded;
+    };
+
+    std::size_t lane_count;
+    // lane_count rounded up to the SIMD width; padding lanes are never active
+    std::size_t padded_count;
+
+    // Struct-of-arrays registers: V[r * padded_count + lane]
+    std::vector<uint8_t> V;
+    std::vector<uint16_t> I;
+    std::vector<uint16_t> PC;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    // Bit k set while key k is held
+    std::vector<uint16_t> keypad;
+
+    std::vector<LaneMemory> memory;
+    std::vector<uint64_t> rng_seed;
+
+    // RAM as loaded, identical in every lane until Fx33/Fx55 write to it.
+    // written[a] is set once any lane has stored to address a.
+    Chip8Core::ram_t ram_image;
+    std::array<uint8_t, 4096> written;
+
+    // True while every lane sits at the same PC, so step() can skip grouping
+    bool converged = true;
+
+    // Lane masks (0xFF for an active lane); all_lanes is constant, the rest is scratch for step()
+    std::vector<uint8_t> all_lanes;
+    std::vector<uint8_t> pending;
+    std::vector<uint8_t> active;
+    std::vector<uint8_t> condition;
+
+    uint32_t instructions_per_second;
+    uint32_t rate_remainder = 0;
+    uint64_t instruction_count = 0;
+    uint64_t frame_count = 0;
+    uint64_t group_count = 0;
+
+    uint8_t *reg(uint8_t r) { return V.data() + r * padded_count; }
+    uint16_t fetch(std::size_t lane, uint16_t pc) const;
+
+    bool allLanesAt(uint16_t pc) const;
+    static bool mayDiverge(uint16_t instruction);
+
+    // Executes the instruction for every lane in mask (PC already advanced)
+    void execute(uint16_t instruction, const uint8_t *mask);
+    // Instructions that touch RAM, the stack, the display or the generator
+    void executeLane(std::size_t lane, uint16_t instruction);
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "chip8/core.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Two-player rollback sessions over UDP. Both players share the keypad, each
+// pressing their own keys; a frame's keypad is the OR of both players' keys.
+// Every frame each side sends its key mask and runs on without waiting,
+// predicting that the other player's keys have not changed. When a mask
+// arrives that differs from the prediction, the core goes back to the
+// snapshot taken before that frame and runs the frames since again, headless,
+// before the next frame is shown. Snapshots are Chip8Core::State copies.
+//
+// Packets, little-endian after the magic, version and type bytes:
+//     HELLO  seed, ROM hash, rate, variant, cycle costs, ready
+//     INPUT  ack, first frame, count, count key masks
+// An INPUT packet repeats every mask the peer has not acknowledged yet, so a
+// lost packet is covered by the next one.
+namespace netplay {
+    constexpr char MAGIC[4] = {'C', '8', 'N', 'P'};
+    constexpr uint8_t VERSION = 1;
+
+    constexpr uint8_t HELLO = 1;
+    constexpr uint8_t INPUT = 2;
+
+    // Frames a side runs ahead of the last input it has from the other
+    // before it waits; each one may have to be simulated again
+    constexpr uint32_t MAX_ROLLBACK = 8;
+    // Snapshot and input history, enough for both sides to be MAX_ROLLBACK
+    // ahead of each other
+    constexpr uint32_t HISTORY = 4 * MAX_ROLLBACK;
+    constexpr std::size_t MAX_PACKET_SIZE = 6 + 4 + 4 + 1 + 2 * HISTORY;
+}
+
+class Netplay {
+public:
+    Netplay() = default;
+    ~Netplay();
+
+    Netplay(const Netplay&) = delete;
+    Netplay& operator=(const Netplay&) = delete;
+
+    // UDP sockets need a POSIX host
+    static bool isSupported();
+
+    // Bind local_port on every interface and send to host:port
+    bool open(uint16_t local_port, const char *host, uint16_t port);
+    void close();
+    bool isOpen() const { return socket_fd >= 0; }
+
+    // Exchange HELLO packets until both sides have the other's, on a freshly
+    // loaded core. Fails if the ROM, variant, rate or cycle costs differ.
+    // Both sides then seed Cxkk with the lower of their two seeds.
+    bool connect(Chip8Core& core, std::chrono::milliseconds timeout);
+
+    // Take in packets, roll back and run again any frames run with a wrong
+    // prediction, then run the next frame with local_keys (bit n = key n).
+    // Returns false, running nothing, while MAX_ROLLBACK frames ahead of the
+    // peer's input.
+    bool runFrame(Chip8Core& core, uint16_t local_keys);
+    // Take in packets, correct past frames and resend unacknowledged input,
+    // without running a new frame
+    void poll(Chip8Core& core);
+
+    // Frames run so far, and how many of them have the peer's actual input
+    uint32_t getFrame() const { return frame; }
+    uint32_t getConfirmedFrame() const { return remote_frames < frame ? remote_frames : frame; }
+    // Frames the peer has all of this side's input for
+    uint32_t getAcknowledgedFrame() const { return local_acked; }
+
+    uint64_t getRollbackCount() const { return rollbacks; }
+    uint64_t getResimulatedFrames() const { return resimulated; }
+    uint64_t getStallCount() const { return stalls; }
+    std::chrono::steady_clock::time_point getLastReceiveTime() const { return last_receive; }
+
+private:
+    int socket_fd = -1;
+    // sockaddr_in of the peer
+    std::array<uint8_t, 16> peer_address{};
+
+    bool connected = false;
+    // While connecting: the peer's HELLO arrived, the peer has ours, and its
+    // HELLO did not match
+    bool has_peer = false;
+    bool peer_ready = false;
+    bool mismatch = false;
+    uint64_t peer_seed = 0;
+
+    uint64_t seed = 0;
+    uint64_t rom_hash = 0;
+    uint32_t rate = 0;
+    uint8_t variant = 0;
+    uint8_t costs = 0;
+
+    // Indexed by frame % HISTORY. snapshots[f] is the state before frame f
+    // ran; used_remote[f] the peer's keys it ran with, actual or predicted.
+    std::array<Chip8Core::State, netplay::HISTORY> snapshots;
+    std::array<uint16_t, netplay::HISTORY> local_input{};
+    std::array<uint16_t, netplay::HISTORY> remote_input{};
+    std::array<uint16_t, netplay::HISTORY> used_remote{};
+
+    uint32_t frame = 0;
+    // The peer's input is known for frames before remote_frames
+    uint32_t remote_frames = 0;
+    // The peer has this side's input for frames before local_acked
+    uint32_t local_acked = 0;
+    // Earliest frame run with a wrong prediction, NO_ROLLBACK when none
+    static constexpr uint32_t NO_ROLLBACK = UINT32_MAX;
+    uint32_t rollback_from = NO_ROLLBACK;
+
+    uint64_t rollbacks = 0;
+    uint64_t resimulated = 0;
+    uint64_t stalls = 0;
+    std::chrono::steady_clock::time_point last_receive;
+
+    void receive();
+    void handleHello(const uint8_t *data);
+    void handleInput(const uint8_t *data, std::size_t size);
+    void sendHello(bool ready);
+    void sendInput();
+    void send(const uint8_t *data, std::size_t size);
+    void rollBack(Chip8Core& core);
+
+    uint16_t remoteKeys(uint32_t f) const;
+    // Run frame f from the core's current state, snapshotting it first
+    void simulate(Chip8Core& core, uint32_t f);
+
+    static uint64_t hashRom(const Chip8Core& core);
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Hot-path instrumentation. Configure with -DCHIP8_PROFILE=ON to compile the
+// hooks in; otherwise CHIP8_PROFILE_ONLY(...) expands to nothing and the
+// interpreter, JIT and frame loop are exactly as without it.
+#ifdef CHIP8_PROFILE
+#define CHIP8_PROFILE_ONLY(...) __VA_ARGS__
+#else
+#define CHIP8_PROFILE_ONLY(...)
+#endif
+
+namespace profile {
+    constexpr bool ENABLED =
+#ifdef CHIP8_PROFILE
+        true;
+#else
+        false;
+#endif
+
+    // Opcode classes in the order the reports list them (00E0, 00EE, 0nnn, 1nnn, ... Fx65,
+    // F002, Fx3A, then the SUPER-CHIP and XO-CHIP additions, other)
+    constexpr std::size_t OPCODE_CLASSES = 52;
+    std::size_t opcodeClass(uint16_t instruction);
+    const char *opcodeName(std::size_t opcode_class);
+
+    // Host time distribution in power-of-two microsecond buckets:
+    // bucket 0 is < 1 us, bucket b is [2^(b-1), 2^b) us, the last one is open ended
+    class Histogram {
+    public:
+        static constexpr std::size_t BUCKETS = 24;
+
+        // Samples longer than budget microseconds (e.g. a whole 1/60 s frame) are counted separately
+        explicit Histogram(double budget) : budget_us(budget) {}
+
+        void record(std::chrono::steady_clock::duration elapsed);
+
+        uint64_t getCount() const { return count; }
+        uint64_t getOverBudget() const { return over_budget; }
+
+        void write(std::ostream& out, const char *name) const;
+
+    private:
+        double budget_us;
+        std::array<uint64_t, BUCKETS> buckets{};
+        uint64_t count = 0;
+        uint64_t over_budget = 0;
+        double total_us = 0.0;
+        double max_us = 0.0;
+    };
+
+    // Guest-side counters kept by Chip8Core. The hot loop only bumps the PC
+    // heatmap; executions are attributed to opcodes lazily, from whatever
+    // instruction sits at each address, and folded in before RAM under an
+    // address changes so self-modifying code is still counted exactly.
+    struct GuestCounters {
+        std::array<uint64_t, 4096> pc_heat{};
+        std::array<uint64_t, 4096> folded{};
+        std::array<uint64_t, OPCODE_CLASSES> opcode_counts{};
+
+        void fold(const std::array<uint8_t, 4096>& ram, std::size_t first, std::size_t last);
+    };
+
+    // Opcode table, hottest addresses and a 64x64 heatmap of the 4 KiB of RAM
+    void writeGuestReport(std::ostream& out, const GuestCounters& counters, const std::array<uint8_t, 4096>& ram);
+}
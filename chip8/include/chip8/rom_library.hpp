@@ -0,0 +1,82 @@
+#pragma once
+
+#include "chip8/core.hpp"
+#include "chip8/variant.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Packed ROM archive: the header, then for each ROM
+//     u16 name length, name, u32 size, data
+// with every field little-endian.
+namespace rom_archive {
+    constexpr char MAGIC[4] = {'C', '8', 'R', 'L'};
+    constexpr uint16_t VERSION = 1;
+}
+
+using sha1_t = std::array<uint8_t, 20>;
+sha1_t sha1(const uint8_t *data, std::size_t size);
+std::string sha1Hex(const sha1_t& digest);
+
+// A set of ROMs mapped into memory once, from a directory, a packed archive or
+// a single ROM file. Every ROM is hashed and checked against the RAM size when
+// the library is opened, so loading one later is a copy straight from the
+// mapping into the core's RAM, with no file access.
+class RomLibrary {
+public:
+    struct Entry {
+        // File name, or the name stored in the archive
+        std::string name;
+        sha1_t sha1;
+        const uint8_t *data;
+        uint32_t size;
+        // Detected from the name's extension, see variantForRom()
+        Variant variant;
+        Quirks quirks;
+    };
+
+    RomLibrary() = default;
+    ~RomLibrary();
+
+    RomLibrary(const RomLibrary&) = delete;
+    RomLibrary& operator=(const RomLibrary&) = delete;
+
+    // Directories are mapped file by file (non-recursive, sorted by name).
+    // ROMs that are empty or do not fit above 0x200 are left out with a warning.
+    bool open(const char *path);
+    void close();
+
+    const std::vector<Entry>& getEntries() const { return entries; }
+    std::size_t size() const { return entries.size(); }
+    // Opened from a packed archive, so entry names are not file paths
+    bool isArchive() const { return archive; }
+
+    // Index of the ROM with the given name, file name or hex SHA-1 (or that
+    // digest), or size() if there is none
+    std::size_t find(const std::string& name) const;
+    std::size_t find(const sha1_t& digest) const;
+
+    // Resets the core with the ROM and its detected variant
+    void load(std::size_t index, Chip8Core& core) const;
+
+    // Packs ROM files into one archive
+    static bool writeArchive(const char *path, const std::vector<std::string>& rom_paths);
+
+private:
+    struct Mapping {
+        void *address;
+        std::size_t length;
+    };
+    std::vector<Mapping> mappings;
+    // Files read on hosts without mmap
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<Entry> entries;
+    bool archive = false;
+
+    bool mapFile(const std::string& path, const uint8_t *& data, std::size_t& size);
+    void addRom(const std::string& name, const uint8_t *data, std::size_t size);
+    bool indexArchive(const std::string& path, const uint8_t *data, std::size_t size);
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "chip8/core.hpp"
+
+// Versioned on-disk format for Chip8Core::State. Fields are written one by one
+// in little-endian order, so files do not depend on the host's struct layout.
+namespace save_state {
+    constexpr char MAGIC[4] = {'C', '8', 'S', 'V'};
+    constexpr uint16_t VERSION = 4;
+
+    bool save(const char *path, const Chip8Core::State& state);
+    bool load(const char *path, Chip8Core::State& state);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded single-producer single-consumer queue. push and pop never block,
+// lock or allocate, so a realtime consumer such as the audio callback can
+// drain it. One thread may push and one other thread may pop.
+template<typename T, std::size_t CAPACITY>
+class SpscRing {
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Producer side; false when the ring is full
+    bool push(const T& value) {
+        std::size_t tail = write_pos.load(std::memory_order_relaxed);
+        if (tail - read_pos.load(std::memory_order_acquire) == CAPACITY)
+            return false;
+
+        slots[tail & (CAPACITY - 1)] = value;
+        write_pos.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; false when the ring is empty
+    bool pop(T& value) {
+        std::size_t head = read_pos.load(std::memory_order_relaxed);
+        if (head == write_pos.load(std::memory_order_acquire))
+            return false;
+
+        value = slots[head & (CAPACITY - 1)];
+        read_pos.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return read_pos.load(std::memory_order_acquire) == write_pos.load(std::memory_order_acquire);
+    }
+
+private:
+    // Each index on its own cache line so the two threads do not share one
+    alignas(64) std::atomic<std::size_t> write_pos{0};
+    alignas(64) std::atomic<std::size_t> read_pos{0};
+    std::array<T, CAPACITY> slots{};
+};
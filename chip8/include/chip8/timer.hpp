@@ -1,32 +1,84 @@
 #pragma once
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <thread>
-#include <type_traits>
 
-template<std::intmax_t FPS>
+// Fixed rate tick schedule. Tick k is due exactly k / TICKS_PER_SECOND after
+// reset(), computed in integer nanoseconds, so however late the caller wakes
+// up the long run rate never drifts.
+template<std::intmax_t TICKS_PER_SECOND>
 class Timer {
 public:
-    // Define the duration type as 1/FPS seconds
-    using frame_duration_t = std::chrono::duration<double, std::ratio<1, FPS>>;
+    using clock = std::chrono::steady_clock;
 
-    // Constructor initializes to current time
-    Timer() : tp{std::chrono::steady_clock::now()} {}
+    // Constructor starts the schedule at the current time
+    Timer() { reset(); }
 
-    // Duration between frames (1/FPS seconds)
-    static constexpr frame_duration_t time_between_frames{1};
+    // Start pacing again from the current time
+    void reset() {
+        start = clock::now();
+        ticks = 0;
+    }
 
-    void sleep() {
-        // Advance the timer to the next frame
-        tp += time_between_frames;
+    clock::time_point nextTick() const {
+        return start + offset(ticks + 1);
+    }
+
+    // Ticks consumed since reset(), and when a given one was due
+    uint64_t getTicks() const { return ticks; }
+    clock::time_point tickTime(uint64_t tick) const {
+        return start + offset(tick);
+    }
+
+    // Consume the ticks that have come due by now. When a host stall left
+    // more than max_catch_up of them, the excess is dropped and the schedule
+    // moves forward instead of bursting through all of them.
+    std::size_t advance(clock::time_point now = clock::now()) {
+        uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+        uint64_t due = elapsed * TICKS_PER_SECOND / NS_PER_SECOND;
+        if (now < start || due <= ticks)
+            return 0;
 
-        // Sleep most of the way there
-        std::this_thread::sleep_until(tp - std::chrono::microseconds(100));
+        uint64_t owed = due - ticks;
+        if (owed > max_catch_up) {
+            uint64_t skipped = owed - max_catch_up;
+            dropped += skipped;
+            start += offset(ticks + skipped);
+            ticks = 0;
+            owed = max_catch_up;
+        }
+
+        ticks += owed;
+        return static_cast<std::size_t>(owed);
+    }
 
-        // Busy wait the last ~100 microseconds
-        while(std::chrono::steady_clock::now() < tp) {}
+    // Block on the OS timer until the next tick is due; no busy wait
+    void waitForNextTick() const {
+        std::this_thread::sleep_until(nextTick());
     }
 
+    // Wait for the next tick and consume it
+    void sleep() {
+        waitForNextTick();
+        ticks++;
+    }
+
+    // 0 resumes from now after any stall, SIZE_MAX always runs every missed tick
+    void setMaxCatchUp(std::size_t max_ticks) { max_catch_up = max_ticks; }
+    std::size_t getMaxCatchUp() const { return static_cast<std::size_t>(max_catch_up); }
+    uint64_t getDroppedTicks() const { return dropped; }
+
 private:
-    std::chrono::time_point<std::chrono::steady_clock, frame_duration_t> tp;
+    static constexpr uint64_t NS_PER_SECOND = 1000000000;
+
+    clock::time_point start;
+    uint64_t ticks = 0;
+    uint64_t max_catch_up = 6;
+    uint64_t dropped = 0;
+
+    static clock::duration offset(uint64_t tick) {
+        return std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(tick * NS_PER_SECOND / TICKS_PER_SECOND));
+    }
 };
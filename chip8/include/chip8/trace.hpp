@@ -0,0 +1,170 @@
+#pragma once
+
+#include "chip8/variant.hpp"
+#include "chip8/worker_queue.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+
+class Chip8Core;
+
+// Binary execution trace. The header holds the variant and the PC, I and V
+// registers when tracing started. Each instruction is then one record:
+//     flags byte, [PC], [opcode], [I], [V mask, changed V values]
+// all little-endian. PC is only stored when it is not the previous one + 2,
+// the opcode only when it differs from the last one seen at that address,
+// and I and V only when the instruction changed them. A FRAME record marks
+// the end of each frame.
+namespace trace_log {
+    constexpr char MAGIC[4] = {'C', '8', 'T', 'R'};
+    constexpr uint16_t VERSION = 1;
+
+    // Record flags
+    constexpr uint8_t HAS_PC = 0x01;
+    constexpr uint8_t HAS_OPCODE = 0x02;
+    constexpr uint8_t HAS_I = 0x04;
+    // Followed by a 16-bit mask of the changed registers and their values
+    constexpr uint8_t HAS_V = 0x08;
+    // Alone: the frame ended
+    constexpr uint8_t FRAME = 0x80;
+
+    // flags, PC, opcode, I, V mask and all 16 registers
+    constexpr std::size_t MAX_RECORD_SIZE = 1 + 2 + 2 + 2 + 2 + 16;
+
+    // Machine state after one traced instruction
+    struct Record {
+        uint64_t instruction;
+        uint64_t frame;
+        uint16_t pc;
+        uint16_t opcode;
+        uint16_t I;
+        std::array<uint8_t, 16> V;
+    };
+}
+
+// Records a core's execution to a file. The core encodes into fixed blocks
+// and hands full ones to a writer thread through a WorkerQueue, so it
+// never waits on the disk unless every block is still queued for writing.
+class TraceWriter {
+public:
+    TraceWriter() = default;
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Starts from the core's current registers and attaches to it
+    bool open(const char *path, Chip8Core& core);
+    // Detaches, writes what is buffered and stops the writer thread
+    void close();
+    bool isOpen() const { return core != nullptr; }
+
+    // Core side, from its fetch loop
+    void record(uint16_t pc, uint16_t opcode, const std::array<uint8_t, 16>& v_before, uint16_t i_before,
+                const std::array<uint8_t, 16>& v_after, uint16_t i_after) {
+        if (block_used + trace_log::MAX_RECORD_SIZE > BLOCK_SIZE)
+            submitBlock();
+
+        uint8_t *start = blocks[current_block].data.data() + block_used;
+        uint8_t *p = start + 1;
+        uint8_t flags = 0;
+        if (pc != next_pc) {
+            flags |= trace_log::HAS_PC;
+            p = put16(p, pc);
+        }
+        if (opcodes[pc & 0xFFF] != opcode) {
+            flags |= trace_log::HAS_OPCODE;
+            p = put16(p, opcode);
+            opcodes[pc & 0xFFF] = opcode;
+        }
+        if (i_after != i_before) {
+            flags |= trace_log::HAS_I;
+            p = put16(p, i_after);
+        }
+        uint16_t mask = 0;
+        for (int x = 0; x < 16; x++)
+            mask |= static_cast<uint16_t>(v_after[x] != v_before[x]) << x;
+        if (mask) {
+            flags |= trace_log::HAS_V;
+            p = put16(p, mask);
+            for (int x = 0; x < 16; x++) {
+                if (mask & (1 << x))
+                    *p++ = v_after[x];
+            }
+        }
+
+        *start = flags;
+        block_used += p - start;
+        next_pc = (pc + 2) & 0xFFF;
+        recorded++;
+    }
+
+    void frame() {
+        if (block_used + 1 > BLOCK_SIZE)
+            submitBlock();
+        blocks[current_block].data[block_used++] = trace_log::FRAME;
+    }
+
+    uint64_t getRecordCount() const { return recorded; }
+    // Times the core had to wait for the writer thread to free a block
+    uint64_t getStallCount() const { return stalls; }
+
+private:
+    static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+    static constexpr std::size_t BLOCK_COUNT = 16;
+
+    struct Block {
+        std::array<uint8_t, BLOCK_SIZE> data;
+        std::size_t size;
+    };
+
+    Chip8Core *core = nullptr;
+    std::ofstream out;
+
+    WorkerQueue<Block, BLOCK_COUNT> blocks;
+    uint8_t current_block = 0;
+    std::size_t block_used = 0;
+
+    // Decoder state, mirrored by TraceReader
+    uint16_t next_pc = 0;
+    std::array<uint16_t, 4096> opcodes{};
+
+    uint64_t recorded = 0;
+    uint64_t stalls = 0;
+
+    static uint8_t *put16(uint8_t *p, uint16_t value) {
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+        return p + 2;
+    }
+
+    void submitBlock();
+};
+
+// Streams the records of a trace file back
+class TraceReader {
+public:
+    bool open(const char *path);
+
+    // False at the end of the trace or on a truncated record
+    bool next(trace_log::Record& record);
+
+    Variant getVariant() const { return variant; }
+    // Registers when tracing started
+    const trace_log::Record& getStart() const { return start; }
+    // The file ended in the middle of a record
+    bool isTruncated() const { return truncated; }
+
+private:
+    std::ifstream in;
+    Variant variant = Variant::Chip8;
+    trace_log::Record start{};
+    trace_log::Record current{};
+    uint16_t next_pc = 0;
+    std::array<uint16_t, 4096> opcodes{};
+    bool truncated = false;
+
+    bool read16(uint16_t& value);
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the latest value from one producer thread to one
+// consumer thread. The producer always has a buffer of its own to fill and
+// the consumer always reads a complete one; values published faster than the
+// consumer takes them are simply skipped, and neither side ever waits.
+template<typename T>
+class TripleBuffer {
+public:
+    // Producer: the buffer to fill, then publish() to hand it over
+    T& back() { return buffers[back_index]; }
+
+    void publish() {
+        uint8_t previous = middle.exchange(static_cast<uint8_t>(back_index | FRESH), std::memory_order_acq_rel);
+        back_index = previous & INDEX_MASK;
+    }
+
+    // Consumer: switch front() to the newest published value; false if
+    // nothing was published since the last call
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+
+        uint8_t previous = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = previous & INDEX_MASK;
+        return true;
+    }
+
+    const T& front() const { return buffers[front_index]; }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    // Set in middle when it holds a value the consumer has not seen
+    static constexpr uint8_t FRESH = 0x4;
+
+    std::array<T, 3> buffers{};
+    // Index of the buffer in between the two threads, plus FRESH
+    alignas(64) std::atomic<uint8_t> middle{1};
+    // Owned by the producer and the consumer respectively
+    alignas(64) uint8_t back_index = 0;
+    alignas(64) uint8_t front_index = 2;
+};
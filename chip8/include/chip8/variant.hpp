@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+
+// CHIP-8 dialects the core can run. Each is an instruction set plus a set of
+// quirks. Chip8Core instantiates its handlers once per variant from the policy
+// structs below, so choosing a variant costs nothing per instruction.
+enum class Variant : uint8_t { Chip8, SuperChip, XoChip, Vip };
+
+// Behaviours that differ between interpreters for the same opcode
+struct Quirks {
+    // 8xy1/8xy2/8xy3 clear VF
+    bool logic_resets_vf;
+    // 8xy6/8xyE shift Vy into Vx; otherwise Vx is shifted in place
+    bool shift_reads_vy;
+    // Fx55/Fx65 leave I pointing past the last register
+    bool load_store_moves_i;
+    // Bxnn jumps to xnn + Vx instead of nnn + V0
+    bool jump_adds_vx;
+    // Sprites wrap around the screen edges instead of being clipped
+    bool wrap_sprites;
+};
+
+namespace variant {
+    // Plain CHIP-8 with the quirks this interpreter always had: Vx shifted in
+    // place, VF and I left alone, sprites clipped
+    struct Chip8 {
+        static constexpr Variant ID = Variant::Chip8;
+        static constexpr Quirks QUIRKS = {false, false, false, false, false};
+        // 00Cn, 00FB-00FF, Dxy0, Fx30, Fx75, Fx85 and the 128x64 mode
+        static constexpr bool SUPERCHIP_OPS = false;
+        // 00Dn, 5xy2, 5xy3, F000 nnnn, Fn01 and the second bitplane
+        static constexpr bool XOCHIP_OPS = false;
+    };
+
+    // SUPER-CHIP 1.1 (HP 48)
+    struct SuperChip {
+        static constexpr Variant ID = Variant::SuperChip;
+        static constexpr Quirks QUIRKS = {false, false, false, true, false};
+        static constexpr bool SUPERCHIP_OPS = true;
+        static constexpr bool XOCHIP_OPS = false;
+    };
+
+    // XO-CHIP as specified by Octo
+    struct XoChip {
+        static constexpr Variant ID = Variant::XoChip;
+        static constexpr Quirks QUIRKS = {false, true, true, false, true};
+        static constexpr bool SUPERCHIP_OPS = true;
+        static constexpr bool XOCHIP_OPS = true;
+    };
+
+    // CHIP-8 as the COSMAC VIP interpreter ran it
+    struct Vip {
+        static constexpr Variant ID = Variant::Vip;
+        static constexpr Quirks QUIRKS = {true, true, true, false, false};
+        static constexpr bool SUPERCHIP_OPS = false;
+        static constexpr bool XOCHIP_OPS = false;
+    };
+}
+
+// The policy's quirks for code that picks the variant at run time (the JIT)
+Quirks variantQuirks(Variant variant);
+
+// "chip8", "schip", "xochip" or "vip"
+const char *variantName(Variant variant);
+bool parseVariant(const char *name, Variant& variant);
+
+// By the usual ROM file extensions: .sc8 is SUPER-CHIP, .xo8 XO-CHIP and
+// anything else CHIP-8
+Variant variantForRom(const char *rom_path);
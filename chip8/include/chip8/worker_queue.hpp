@@ -0,0 +1,91 @@
+#pragma once
+
+#include "chip8/spsc_ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Hands fixed slots from one producer thread to a background thread. Every
+// slot is allocated by start(), so the producer never allocates: it takes a
+// free slot, fills it and submits it, and the background thread passes each
+// submitted slot to the consumer before freeing it again. Neither side takes
+// a lock; the background thread sleeps briefly whenever nothing is queued.
+template<typename Slot, std::size_t COUNT>
+class WorkerQueue {
+    static_assert(COUNT <= 256, "slot indices are bytes");
+
+public:
+    WorkerQueue() = default;
+    ~WorkerQueue() { stop(); }
+
+    WorkerQueue(const WorkerQueue&) = delete;
+    WorkerQueue& operator=(const WorkerQueue&) = delete;
+
+    void start(std::function<void(Slot&)> consumer) {
+        stop();
+        consume = std::move(consumer);
+        slots.resize(COUNT);
+        for (std::size_t i = 0; i < COUNT; i++)
+            free_slots.push(static_cast<uint8_t>(i));
+        stopping.store(false);
+        worker = std::thread(&WorkerQueue::run, this);
+    }
+
+    // Consumes every slot submitted so far, then frees the slots
+    void stop() {
+        if (!worker.joinable())
+            return;
+
+        stopping.store(true, std::memory_order_release);
+        worker.join();
+
+        uint8_t index;
+        while (free_slots.pop(index)) {}
+        slots.clear();
+        slots.shrink_to_fit();
+    }
+
+    bool isRunning() const { return worker.joinable(); }
+
+    // Producer side: a free slot, false while every one is queued
+    bool acquire(uint8_t& index) { return free_slots.pop(index); }
+    Slot& operator[](uint8_t index) { return slots[index]; }
+    // The ring holds every slot, so this always fits
+    void submit(uint8_t index) { full_slots.push(index); }
+
+private:
+    // How long the background thread sleeps when no slot is waiting
+    static constexpr std::chrono::milliseconds IDLE{1};
+
+    std::vector<Slot> slots;
+    SpscRing<uint8_t, COUNT> free_slots;
+    SpscRing<uint8_t, COUNT> full_slots;
+    std::function<void(Slot&)> consume;
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+
+    void run() {
+        for (;;) {
+            // Read before draining, so slots submitted before the stop are consumed
+            const bool stop = stopping.load(std::memory_order_acquire);
+
+            uint8_t index;
+            bool consumed = false;
+            while (full_slots.pop(index)) {
+                consume(slots[index]);
+                free_slots.push(index);
+                consumed = true;
+            }
+
+            if (stop)
+                break;
+            if (!consumed)
+                std::this_thread::sleep_for(IDLE);
+        }
+    }
+};
@@ -0,0 +1,160 @@
+#include "chip8/aot.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+Chip8Aot::Chip8Aot(Chip8Core& core_, const Program& program_) : core(core_), program(program_), valid(program_.block_count) {
+    block_index.fill(NO_BLOCK);
+    for (std::size_t i = 0; i < program.block_count; i++) {
+        const Block& block = program.blocks[i];
+        block_index[block.start] = static_cast<int32_t>(i);
+        for (std::size_t a = block.start; a < block.end; a++)
+            compiled[a] = true;
+    }
+
+    // Compiled for another variant, the blocks would bake in the wrong quirks
+    if (core.getVariant() != program.variant) {
+        std::cerr << "AOT program " << program.name << " was compiled for " << variantName(program.variant)
+                  << ", interpreting " << variantName(core.getVariant()) << std::endl;
+        return;
+    }
+
+    uint16_t lo, hi;
+    core.consumeCodeWrite(lo, hi);
+    revalidate(0, static_cast<uint16_t>(block_index.size()));
+}
+
+void Chip8Aot::revalidate(uint16_t lo, uint16_t hi) {
+    // Most writes are to data, well away from any compiled code
+    bool touches_code = false;
+    for (std::size_t a = lo; a < hi && a < compiled.size() && !touches_code; a++)
+        touches_code = compiled[a];
+    if (!touches_code || core.getVariant() != program.variant)
+        return;
+
+    const uint8_t *ram = core.state.RAM.data();
+    for (std::size_t i = 0; i < program.block_count; i++) {
+        const Block& block = program.blocks[i];
+        if (block.start < hi && block.end > lo) {
+            const uint8_t *original = program.rom + (block.start - Chip8Core::ROM_START);
+            valid[i] = memcmp(ram + block.start, original, block.end - block.start) == 0;
+        }
+    }
+}
+
+void Chip8Aot::step(std::size_t n) {
+    // Pick up RAM changes made outside of step(), e.g. a restored snapshot
+    uint16_t lo, hi;
+    if (core.consumeCodeWrite(lo, hi))
+        revalidate(lo, hi);
+
+    // A trace records every instruction and a debugger checks each one,
+    // which translated blocks do not
+    if (core.isTracing() || core.isDebugging()) {
+        core.step(n);
+        return;
+    }
+
+    // A ROM waiting on a timer or key costs nothing for the rest of the budget
+    n -= core.skipIdle(n);
+
+    while (n > 0) {
+        const uint16_t pc = core.state.PC;
+        const int32_t index = pc < block_index.size() ? block_index[pc] : NO_BLOCK;
+
+        // A block runs whole, so it only fits if the budget covers all of it
+        if (index != NO_BLOCK && valid[index] && program.blocks[index].length <= n) {
+            const Block& block = program.blocks[index];
+            block.fn(core.state, core);
+            core.state.instruction_count += block.length;
+            n -= block.length;
+        } else {
+            core.step(1);
+            interpreted++;
+            n--;
+        }
+
+        if (core.consumeCodeWrite(lo, hi))
+            revalidate(lo, hi);
+    }
+}
+
+void Chip8Aot::runFrames(std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        core.beginFrame();
+        step(core.takeInstructionBudget());
+        core.endFrame();
+    }
+}
+
+int Chip8Aot::main(const Program& program, int argc, char **argv) {
+    std::size_t frames = 600;
+    uint64_t seed = 0;
+    uint32_t instructions_per_second = 0;
+    bool validate = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--ips") == 0 && has_value) {
+            instructions_per_second = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--validate") == 0) {
+            validate = true;
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--frames <n>] [--seed <n>] [--ips <n>] [--validate]" << std::endl;
+            return 1;
+        }
+    }
+
+    auto boot = [&](Chip8Core& core) {
+        core.seed(seed);
+        core.setVariant(program.variant);
+        core.loadRom(program.rom, program.rom_size);
+        if (instructions_per_second)
+            core.setInstructionsPerSecond(instructions_per_second);
+    };
+
+    Chip8Core core;
+    boot(core);
+    Chip8Aot aot(core, program);
+
+    // The reference runs every instruction, idle loops included
+    Chip8Core reference;
+    reference.setIdleSkipping(false);
+    if (validate)
+        boot(reference);
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t frame = 0; frame < frames; frame++) {
+        aot.runFrames(1);
+        if (!validate)
+            continue;
+
+        reference.runFrames(1);
+        const Chip8Core::State& a = core.getState();
+        const Chip8Core::State& b = reference.getState();
+        if (core.hashDisplay() != reference.hashDisplay() || a.V != b.V || a.I != b.I || a.PC != b.PC || a.RAM != b.RAM) {
+            std::cout << program.name << ": frame " << frame << " differs from the interpreter (PC 0x" << std::hex
+                      << a.PC << " vs 0x" << b.PC << ", display hash " << core.hashDisplay() << " vs "
+                      << reference.hashDisplay() << std::dec << ")" << std::endl;
+            return 1;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double ips = elapsed.count() > 0 ? core.getInstructionCount() / elapsed.count() : 0.0;
+    std::cout << "frames: " << core.getFrameCount()
+              << ", instructions: " << core.getInstructionCount()
+              << ", interpreted: " << aot.getInterpretedCount()
+              << ", seconds: " << elapsed.count()
+              << ", IPS: " << static_cast<uint64_t>(ips)
+              << ", display hash: " << std::hex << core.hashDisplay() << std::dec << std::endl;
+    if (validate)
+        std::cout << "Matches the interpreter over " << frames << " frames" << std::endl;
+    return 0;
+}
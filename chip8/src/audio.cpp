@@ -0,0 +1,160 @@
+#include "chip8/audio.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    constexpr double PI = 3.14159265358979323846;
+    constexpr double FRACTION = 4294967296.0;  // 2^32
+    constexpr uint64_t PATTERN_BITS = 128;
+
+    // XO-CHIP: the pattern plays at 4000 * 2^((pitch - 64) / 48) bits per second
+    double patternRate(uint8_t pitch) {
+        return 4000.0 * std::pow(2.0, (static_cast<int>(pitch) - 64) / 48.0);
+    }
+
+    bool patternBit(const std::array<uint8_t, 16>& pattern, uint64_t bit) {
+        bit %= PATTERN_BITS;
+        return (pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+    }
+}
+
+AudioEngine::~AudioEngine() {
+    close();
+}
+
+bool AudioEngine::open() {
+    // Generate at the device's own rate so SDL does not have to resample
+    SDL_AudioSpec spec;
+    int sample_frames = 0;
+    if (!SDL_GetAudioDeviceFormat(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, &sample_frames) || spec.freq <= 0)
+        spec.freq = 48000;
+    spec.channels = 1;
+    spec.format = SDL_AUDIO_F32;
+
+    prepare(spec.freq);
+
+    stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, feed, this);
+    if (!stream) {
+        SDL_Log("Couldn't create audio stream: %s", SDL_GetError());
+        return false;
+    }
+
+    // Runs for the whole session; silence is just a zero gate
+    SDL_ResumeAudioStreamDevice(stream);
+    return true;
+}
+
+void AudioEngine::close() {
+    if (stream)
+        SDL_DestroyAudioStream(stream);
+    stream = NULL;
+}
+
+void AudioEngine::prepare(int rate) {
+    sample_rate = rate;
+
+    // Square wave from its odd harmonics below Nyquist, with Lanczos sigma
+    // factors to keep the ringing at the edges down
+    wavetable.assign(TABLE_SIZE + 1, 0.0f);
+    const int harmonics = static_cast<int>(rate / 2 / TONE_HZ);
+    for (int k = 1; k <= harmonics; k += 2) {
+        double x = PI * k / (harmonics + 1);
+        double sigma = std::sin(x) / x;
+        for (std::size_t i = 0; i < TABLE_SIZE; i++)
+            wavetable[i] += static_cast<float>(4.0 / PI * sigma * std::sin(2.0 * PI * k * i / TABLE_SIZE) / k);
+    }
+    wavetable[TABLE_SIZE] = wavetable[0];
+
+    tone_step = static_cast<uint32_t>(TONE_HZ / rate * FRACTION);
+    pattern_step = static_cast<uint64_t>(patternRate(Chip8Core::DEFAULT_PITCH) / rate * FRACTION);
+    ramp_step = 1.0f / (RAMP_SECONDS * rate);
+}
+
+void AudioEngine::update(const Chip8Core& core) {
+    const Chip8Core::State& state = core.getState();
+
+    Command command{};
+    command.gate = core.isSoundActive() && !muted;
+    command.use_pattern = state.audio_pattern_loaded;
+    command.pitch = state.pitch;
+    command.pattern = state.audio_pattern;
+
+    if (has_sent && memcmp(&command, &sent, sizeof(Command)) == 0)
+        return;
+
+    // When the ring is full the change is retried next frame
+    if (commands.push(command)) {
+        sent = command;
+        has_sent = true;
+    }
+}
+
+void AudioEngine::apply(const Command& command) {
+    if (command.pitch != current.pitch && sample_rate)
+        pattern_step = static_cast<uint64_t>(patternRate(command.pitch) / sample_rate * FRACTION);
+    current = command;
+}
+
+float AudioEngine::patternSample() {
+    // Average the pattern over the span of this output sample (a box filter),
+    // so rates above the sample rate alias far less than point sampling
+    uint64_t from = pattern_phase;
+    uint64_t to = pattern_phase + pattern_step;
+    double sum = 0.0;
+    while (from < to) {
+        uint64_t bit_end = ((from >> 32) + 1) << 32;
+        uint64_t end = std::min(bit_end, to);
+        sum += (patternBit(current.pattern, from >> 32) ? 1.0 : -1.0) * static_cast<double>(end - from);
+        from = end;
+    }
+
+    pattern_phase = to % (PATTERN_BITS << 32);
+    return pattern_step ? static_cast<float>(sum / static_cast<double>(pattern_step)) : 0.0f;
+}
+
+void AudioEngine::render(float *out, int count) {
+    Command command;
+    while (commands.pop(command))
+        apply(command);
+
+    const float target = current.gate ? 1.0f : 0.0f;
+    for (int i = 0; i < count; i++) {
+        if (level < target)
+            level = std::min(target, level + ramp_step);
+        else if (level > target)
+            level = std::max(target, level - ramp_step);
+
+        if (level == 0.0f) {
+            out[i] = 0.0f;
+            continue;
+        }
+
+        float sample;
+        if (current.use_pattern) {
+            sample = patternSample();
+        } else {
+            // Linear interpolation between table entries
+            uint32_t index = tone_phase >> (32 - TABLE_BITS);
+            float frac = static_cast<float>(tone_phase & ((uint32_t(1) << (32 - TABLE_BITS)) - 1)) / (uint32_t(1) << (32 - TABLE_BITS));
+            sample = wavetable[index] + (wavetable[index + 1] - wavetable[index]) * frac;
+            tone_phase += tone_step;
+        }
+        out[i] = sample * level * VOLUME;
+    }
+}
+
+void SDLCALL AudioEngine::feed(void *userdata, SDL_AudioStream *astream, int additional_amount, int)
+{
+    AudioEngine *engine = static_cast<AudioEngine*>(userdata);
+
+    additional_amount /= sizeof (float);
+    while (additional_amount > 0) {
+        float samples[256];
+        const int total = SDL_min(additional_amount, SDL_arraysize(samples));
+        engine->render(samples, total);
+        SDL_PutAudioStreamData(astream, samples, total * sizeof (float));
+        additional_amount -= total;
+    }
+}
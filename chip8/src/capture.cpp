@@ -0,0 +1,309 @@
+#include "chip8/capture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace {
+    // Four colors: two bits per pixel
+    constexpr int COLOR_BITS = 2;
+    constexpr uint16_t CLEAR_CODE = 1 << COLOR_BITS;
+    constexpr uint16_t MAX_CODE = 4095;
+
+    void put16(std::vector<uint8_t>& out, uint16_t value) {
+        out.push_back(value & 0xFF);
+        out.push_back(value >> 8);
+    }
+
+    // GIF's variable width LZW, packed LSB first into 255-byte sub-blocks
+    class LzwEncoder {
+    public:
+        explicit LzwEncoder(std::vector<uint8_t>& out_) : out(out_) {
+            out.push_back(COLOR_BITS);
+            reset();
+            write(CLEAR_CODE);
+        }
+
+        void add(uint8_t index) {
+            if (!has_prefix) {
+                prefix = index;
+                has_prefix = true;
+                return;
+            }
+
+            const uint16_t next = children[prefix * (1 << COLOR_BITS) + index];
+            if (next) {
+                prefix = next;
+                return;
+            }
+
+            write(prefix);
+            children[prefix * (1 << COLOR_BITS) + index] = ++last_code;
+            if (last_code >= (1u << code_size))
+                code_size++;
+            if (last_code == MAX_CODE) {
+                write(CLEAR_CODE);
+                reset();
+            }
+            prefix = index;
+        }
+
+        void finish() {
+            if (has_prefix) {
+                write(prefix);
+                // Unless it was the first code since a clear, the decoder adds
+                // an entry on reading it and may widen its codes before the end
+                if (last_code > CLEAR_CODE + 1 && ++last_code >= (1u << code_size) && code_size < 12)
+                    code_size++;
+            }
+            write(CLEAR_CODE + 1);
+            if (bit_count)
+                putByte(static_cast<uint8_t>(bits));
+            if (block_size)
+                endBlock();
+            out.push_back(0);
+        }
+
+    private:
+        std::vector<uint8_t>& out;
+        // Code for a prefix code followed by a pixel, 0 for none
+        std::array<uint16_t, (MAX_CODE + 1) * (1 << COLOR_BITS)> children;
+        uint16_t last_code;
+        uint32_t code_size;
+        uint16_t prefix = 0;
+        bool has_prefix = false;
+
+        uint32_t bits = 0;
+        uint32_t bit_count = 0;
+        std::size_t block_start = 0;
+        uint8_t block_size = 0;
+
+        void reset() {
+            children.fill(0);
+            last_code = CLEAR_CODE + 1;
+            code_size = COLOR_BITS + 1;
+        }
+
+        void write(uint16_t code) {
+            bits |= static_cast<uint32_t>(code) << bit_count;
+            bit_count += code_size;
+            while (bit_count >= 8) {
+                putByte(static_cast<uint8_t>(bits));
+                bits >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        void putByte(uint8_t byte) {
+            if (!block_size) {
+                block_start = out.size();
+                out.push_back(0);
+            }
+            out.push_back(byte);
+            if (++block_size == 255)
+                endBlock();
+        }
+
+        void endBlock() {
+            out[block_start] = block_size;
+            block_size = 0;
+        }
+    };
+}
+
+FrameCapture::~FrameCapture() {
+    close();
+}
+
+bool FrameCapture::open(const char *path, int pixel_scale) {
+    close();
+
+    gif.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    audio.open(std::string(path) + ".audio", std::ios::out | std::ios::trunc);
+    if (!gif.is_open() || !audio.is_open()) {
+        std::cerr << "Failed to open capture for writing: " << path << std::endl;
+        gif.close();
+        audio.close();
+        return false;
+    }
+
+    scale = pixel_scale > 0 ? pixel_scale : DEFAULT_SCALE;
+    writeHeader();
+    audio << "# frame (" << FPS << " per second) and sound gate\n";
+
+    frames_added = 0;
+    dropped = 0;
+
+    has_canvas = false;
+    has_pending = false;
+    shown_delay = 0;
+    last_index = 0;
+    sound = false;
+
+    // Every slot up front, so capturing never allocates on the emulation side
+    frames.start([this](const Frame& frame) { encode(frame); });
+    return true;
+}
+
+void FrameCapture::close() {
+    if (!frames.isRunning())
+        return;
+
+    frames.stop();
+
+    // The last frame lasts until the end of the capture
+    if (has_pending) {
+        const uint64_t end = centiseconds(last_index + 1);
+        writePending(end > shown_delay + MIN_DELAY ? end - shown_delay : MIN_DELAY);
+    }
+    gif.put(0x3B);
+    gif.close();
+    audio.close();
+}
+
+void FrameCapture::addFrame(const Chip8Core& core, bool wait) {
+    const uint64_t index = frames_added++;
+    uint8_t slot;
+    while (!frames.acquire(slot)) {
+        if (!wait) {
+            dropped++;
+            return;
+        }
+        std::this_thread::yield();
+    }
+
+    Frame& frame = frames[slot];
+    frame.display = core.getDisplay();
+    frame.hires = core.isHires();
+    frame.sound = core.isSoundActive();
+    frame.index = index;
+    frames.submit(slot);
+}
+
+void FrameCapture::encode(const Frame& frame) {
+    if (frame.sound != sound) {
+        audio << frame.index << (frame.sound ? " on\n" : " off\n");
+        sound = frame.sound;
+    }
+    last_index = frame.index;
+
+    render(frame, current);
+    if (!has_pending) {
+        pending = current;
+        has_pending = true;
+        return;
+    }
+    if (current == pending)
+        return;
+
+    // A frame too short to show is replaced by the one after it
+    const uint64_t delay = centiseconds(frame.index) - shown_delay;
+    if (delay >= MIN_DELAY)
+        writePending(delay);
+    pending = current;
+}
+
+void FrameCapture::render(const Frame& frame, pixels_t& out) {
+    const Chip8Core::display_t& display = frame.display;
+    for (int y = 0; y < HIRES_HEIGHT; y++) {
+        for (int x = 0; x < HIRES_WIDTH; x++) {
+            // Low resolution pixels cover two by two
+            const int px = frame.hires ? x : x / 2;
+            const int py = frame.hires ? y : y / 2;
+            const int bit = 63 - (px & 63);
+            out[y * HIRES_WIDTH + x] = static_cast<uint8_t>(((display[0][py][px >> 6] >> bit) & 1) |
+                                                            (((display[1][py][px >> 6] >> bit) & 1) << 1));
+        }
+    }
+}
+
+void FrameCapture::writeHeader() {
+    std::vector<uint8_t> out;
+    const char signature[] = "GIF89a";
+    out.insert(out.end(), signature, signature + 6);
+
+    // Logical screen with a global table of 2^COLOR_BITS colors
+    put16(out, static_cast<uint16_t>(HIRES_WIDTH * scale));
+    put16(out, static_cast<uint16_t>(HIRES_HEIGHT * scale));
+    out.push_back(0x80 | (COLOR_BITS - 1) << 4 | (COLOR_BITS - 1));
+    out.push_back(0);
+    out.push_back(0);
+    for (uint32_t color : palette) {
+        out.push_back((color >> 16) & 0xFF);
+        out.push_back((color >> 8) & 0xFF);
+        out.push_back(color & 0xFF);
+    }
+
+    // Loop forever
+    const char netscape[] = "NETSCAPE2.0";
+    out.push_back(0x21);
+    out.push_back(0xFF);
+    out.push_back(11);
+    out.insert(out.end(), netscape, netscape + 11);
+    out.push_back(3);
+    out.push_back(1);
+    put16(out, 0);
+    out.push_back(0);
+
+    gif.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+}
+
+void FrameCapture::writePending(uint64_t delay) {
+    // Bounding box of the pixels that differ from what is shown
+    int left = HIRES_WIDTH, right = -1, top = HIRES_HEIGHT, bottom = -1;
+    for (int y = 0; y < HIRES_HEIGHT; y++) {
+        const uint8_t *a = &pending[y * HIRES_WIDTH];
+        const uint8_t *b = &canvas[y * HIRES_WIDTH];
+        if (has_canvas && memcmp(a, b, HIRES_WIDTH) == 0)
+            continue;
+        int first = 0, last = HIRES_WIDTH - 1;
+        if (has_canvas) {
+            while (a[first] == b[first])
+                first++;
+            while (a[last] == b[last])
+                last--;
+        }
+        left = std::min(left, first);
+        right = std::max(right, last);
+        top = std::min(top, y);
+        bottom = y;
+    }
+    // Nothing changed (a frame too short to show was dropped): a one pixel
+    // image still carries the delay
+    if (right < 0) {
+        left = right = top = bottom = 0;
+    }
+
+    image.clear();
+    // Graphic control: keep the previous image under this one, no transparency
+    image.push_back(0x21);
+    image.push_back(0xF9);
+    image.push_back(4);
+    image.push_back(1 << 2);
+    put16(image, static_cast<uint16_t>(std::min<uint64_t>(delay, 0xFFFF)));
+    image.push_back(0);
+    image.push_back(0);
+
+    const int width = (right - left + 1) * scale;
+    const int height = (bottom - top + 1) * scale;
+    image.push_back(0x2C);
+    put16(image, static_cast<uint16_t>(left * scale));
+    put16(image, static_cast<uint16_t>(top * scale));
+    put16(image, static_cast<uint16_t>(width));
+    put16(image, static_cast<uint16_t>(height));
+    image.push_back(0);
+
+    LzwEncoder lzw(image);
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = &pending[(top + y / scale) * HIRES_WIDTH];
+        for (int x = 0; x < width; x++)
+            lzw.add(row[left + x / scale]);
+    }
+    lzw.finish();
+
+    gif.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+    canvas = pending;
+    has_canvas = true;
+    shown_delay += delay;
+}
@@ -1,14 +1,17 @@
 #include "chip8/chip8.hpp"
+#include "chip8/save_state.hpp"
 
-#include <chrono>
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <thread>
-#include <type_traits>
-#include <random>
+#include <sstream>
 
 Chip8::Chip8() : 
-    PC(0x200), delay_timer(0), sound_timer(0), display{}, RAM{}, keypad{}, waiting_for_key_release(false), stream(NULL) 
+    window(NULL), renderer(NULL), texture(NULL), needs_present(true), is_running(false), is_paused(false), turbo(false), vsync(false), threaded(false) 
 {
     background_color.r = 0;
     background_color.g = 0;
@@ -20,12 +23,25 @@ Chip8::Chip8() :
     draw_color.b = 255;
     draw_color.a = 100;
 
-    key_bindings = {
+    plane2_color.r = 255;
+    plane2_color.g = 102;
+    plane2_color.b = 0;
+    plane2_color.a = 100;
+
+    both_color.r = 102;
+    both_color.g = 34;
+    both_color.b = 0;
+    both_color.a = 100;
+
+    const std::pair<SDL_Scancode, uint8_t> bindings[] = {
         {SDL_SCANCODE_1, 0x1}, {SDL_SCANCODE_2, 0x2}, {SDL_SCANCODE_3, 0x3}, {SDL_SCANCODE_4, 0xC},
         {SDL_SCANCODE_Q, 0x4}, {SDL_SCANCODE_W, 0x5}, {SDL_SCANCODE_E, 0x6}, {SDL_SCANCODE_R, 0xD},
         {SDL_SCANCODE_A, 0x7}, {SDL_SCANCODE_S, 0x8}, {SDL_SCANCODE_D, 0x9}, {SDL_SCANCODE_F, 0xE},
         {SDL_SCANCODE_Z, 0xA}, {SDL_SCANCODE_X, 0x0}, {SDL_SCANCODE_C, 0xB}, {SDL_SCANCODE_V, 0xF}
     };
+    key_bindings.fill(NO_KEY);
+    for (const auto& binding : bindings)
+        key_bindings[binding.first] = binding.second;
 }
 
 Chip8::~Chip8() {
@@ -57,39 +73,16 @@ bool Chip8::init() {
 
     clearWindow();
 
-    const std::array<uint8_t, 80> font = {        
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };    
-    memcpy(RAM.data(), font.data(), sizeof(font));
-
-    if (rom.is_open()) {
-        std::streampos size = rom.tellg();
-        rom.seekg(0, std::ios::beg);
-        rom.read(reinterpret_cast<char*>(RAM.data() + 0x200), size);
-        rom.close();
-
-        SDL_Log("ROM loaded into memory (size: %ld bytes).", static_cast<long>(size));
-    } else {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to load ROM file into memory.");
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING, HIRES_WIDTH, HIRES_HEIGHT);
+    if (!texture) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to create display texture: %s", SDL_GetError());
         return false;
     }
+    SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+    updateTextureRows(core.getDisplay(), true, 0, HIRES_HEIGHT - 1);
+    needs_present = true;
 
-    if (!configureSound()) {
+    if (!audio.open()) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to configure audio.");
         return false;
     }
@@ -98,14 +91,35 @@ bool Chip8::init() {
 }
 
 void Chip8::clean() {
+    stopEmulationThread();
+    recorder.finish(core);
+    if (netplay.isOpen()) {
+        SDL_Log("Netplay: %u frames, %llu rollbacks (%llu frames run again), waited for the peer %llu times",
+                netplay.getFrame(), static_cast<unsigned long long>(netplay.getRollbackCount()),
+                static_cast<unsigned long long>(netplay.getResimulatedFrames()),
+                static_cast<unsigned long long>(netplay.getStallCount()));
+        netplay.close();
+    }
+    if (capture.isOpen()) {
+        capture.close();
+        SDL_Log("Captured %llu frames, %llu dropped", static_cast<unsigned long long>(capture.getFrameCount()),
+                static_cast<unsigned long long>(capture.getDroppedCount()));
+    }
+    logLatencySummary();
+    CHIP8_PROFILE_ONLY(if (!stats_path.empty()) writeStats();)
+
+    if (texture) SDL_DestroyTexture(texture);
     if (renderer) SDL_DestroyRenderer(renderer);
     if (window) SDL_DestroyWindow(window);
-    if (stream) SDL_DestroyAudioStream(stream);
+    audio.close();
+    texture = NULL;
+    renderer = NULL;
+    window = NULL;
     
     SDL_Quit();
 }
 
-std::string Chip8::get_memory_region_label(std::size_t address) const {
+const char *Chip8::get_memory_region_label(std::size_t address) const {
     if (address < 0x200) return "Reserved / Font";
     else if (address >= 0x200 && address < 0x600) return "ROM";
     else if (address >= 0x600 && address < 0xEA0) return "Free / Work RAM";
@@ -114,10 +128,11 @@ std::string Chip8::get_memory_region_label(std::size_t address) const {
     return "";
 }
 
-void Chip8::showRamContent() const {
-    for (size_t i = 0; i < RAM.size(); i += 16) {
+void Chip8::showRamContent(std::size_t from, std::size_t to) const {
+    const Chip8Core::ram_t& RAM = core.getRam();
+    for (size_t i = from & ~std::size_t(15); i < to && i < RAM.size(); i += 16) {
         // Memory region label
-        std::string region = get_memory_region_label(i);
+        const char *region = get_memory_region_label(i);
 
         // Left address
         std::cout << "0x" << std::setw(3) << std::setfill('0') << std::hex << i << ": ";
@@ -150,551 +165,916 @@ void Chip8::showRamContent() const {
     }
 }
 
-void Chip8::renderDisplay() {
-    SDL_SetRenderDrawColor(renderer, background_color.r, background_color.g, background_color.b, background_color.a);
-    SDL_RenderClear(renderer);
+void Chip8::showRegisters() const {
+    const Chip8Core::State& state = core.getState();
+    const uint16_t pc = state.PC & 0xFFF;
+    const int opcode = state.RAM[pc] << 8 | state.RAM[(pc + 1) & 0xFFF];
+
+    std::cout << std::hex << std::setfill('0')
+              << "PC " << std::setw(3) << pc << ": " << std::setw(4) << opcode
+              << "  I " << std::setw(3) << state.I
+              << "  DT " << std::setw(2) << static_cast<int>(state.delay_timer)
+              << "  ST " << std::setw(2) << static_cast<int>(state.sound_timer)
+              << std::dec << "  frame " << state.frame_count
+              << "  instruction " << state.instruction_count << '\n' << std::hex;
+    for (int x = 0; x < 16; x++)
+        std::cout << 'V' << std::uppercase << x << std::nouppercase << ' ' << std::setw(2) << static_cast<int>(state.V[x]) << (x == 7 || x == 15 ? '\n' : ' ');
+    std::cout << "stack";
+    for (uint8_t i = 0; i < state.SP; i++)
+        std::cout << ' ' << std::setw(3) << state.stack[i];
+    std::cout << std::dec << std::setfill(' ') << std::endl;
+}
 
-    SDL_SetRenderDrawColor(renderer, draw_color.r, draw_color.g, draw_color.b, draw_color.a);
-
-    for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-        for (int x = 0; x < WINDOW_WIDTH; ++x) {
-            if (display[y][x]) {
-                SDL_FRect pixel{
-                    static_cast<float>(x) * SCALE,
-                    static_cast<float>(y) * SCALE,
-                    SCALE, SCALE
-                };
-                SDL_RenderFillRect(renderer, &pixel);
-            }
-        }
+void Chip8::showStop() const {
+    const uint16_t pc = debugger.getStopPc();
+    std::cout << std::hex << std::setfill('0');
+    switch (debugger.getStop())
+    {
+    case Debugger::Stop::Breakpoint:
+        std::cout << "Breakpoint at " << std::setw(3) << pc << '\n';
+        break;
+    case Debugger::Stop::Read:
+    case Debugger::Stop::Write:
+        std::cout << "Instruction at " << std::setw(3) << pc
+                  << (debugger.getStop() == Debugger::Stop::Write ? " writes" : " reads")
+                  << " watched " << std::setw(3) << debugger.getStopAddress() << '\n';
+        break;
+    default:
+        std::cout << "Stopped at " << std::setw(3) << (core.getState().PC & 0xFFF) << '\n';
+        break;
     }
-    SDL_RenderPresent(renderer);
+    std::cout << std::dec << std::setfill(' ');
 }
 
-void Chip8::handleInput(const SDL_Scancode& key, const Uint32& event_type) {
-    if (event_type == SDL_EVENT_KEY_DOWN) {
-        if (key == SDL_SCANCODE_ESCAPE)
-            is_running = false;
-        else if (key == SDL_SCANCODE_SPACE)
-            is_paused ^= 1;
-        else if (key_bindings.find(key) != key_bindings.end())
-            keypad[key_bindings[key]] = 1;
-    } else if (event_type == SDL_EVENT_KEY_UP) {
-            if (key_bindings.find(key) != key_bindings.end())
-                keypad[key_bindings[key]] = 0;
+void Chip8::listBreakpoints() const {
+    const std::size_t size = core.getRam().size();
+    std::cout << std::hex << std::setfill('0');
+    for (std::size_t a = 0; a < size; a++) {
+        if (debugger.hasBreakpoint(static_cast<uint16_t>(a)))
+            std::cout << "break " << std::setw(3) << a << '\n';
     }
-}
 
-int Chip8::current_sine_sample = 0;
-void SDLCALL Chip8::FeedTheAudioStreamMore(void *userdata, SDL_AudioStream *astream, int additional_amount, int total_amount)
-{
-    additional_amount /= sizeof (float);
-    while (additional_amount > 0) {
-        float samples[128];
-        const int total = SDL_min(additional_amount, SDL_arraysize(samples));
-        int i;
-
-        for (i = 0; i < total; i++) {
-            const int freq = 440;
-            const float phase = current_sine_sample * freq / 8000.0f;
-            samples[i] = SDL_sinf(phase * 2 * SDL_PI_F);
-            current_sine_sample++;
+    // Runs of addresses watched the same way
+    for (std::size_t a = 0; a < size;) {
+        const uint8_t access = debugger.getWatch(static_cast<uint16_t>(a));
+        std::size_t end = a + 1;
+        while (end < size && debugger.getWatch(static_cast<uint16_t>(end)) == access)
+            end++;
+        if (access) {
+            std::cout << "watch " << std::setw(3) << a << '-' << std::setw(3) << end - 1 << ' '
+                      << (access & Debugger::READ ? "r" : "") << (access & Debugger::WRITE ? "w" : "") << '\n';
         }
+        a = end;
+    }
+    std::cout << std::dec << std::setfill(' ') << std::flush;
+}
 
-        current_sine_sample %= 8000;
-
-        SDL_PutAudioStreamData(astream, samples, total * sizeof (float));
-        additional_amount -= total;
+bool Chip8::runMonitor() {
+    if (debugger.hasStopped())
+        showStop();
+    showRegisters();
+    std::cout << "Debugger: c continue, s [n] step, b <addr> breakpoint, w <addr> [len] [r|w|rw|off] watch, "
+                 "m [addr] [len] memory, r registers, l list, d delete all, q quit" << std::endl;
+
+    std::string line;
+    while (true) {
+        std::cout << "(chip8) " << std::flush;
+        if (!std::getline(std::cin, line)) {
+            // No terminal to read from: run on without the debugger
+            debugger.clear();
+            break;
+        }
+        if (!monitorCommand(line))
+            break;
     }
+
+    debugger.resume(core);
+    core.setDebugger(debugger.empty() ? nullptr : &debugger);
+    return is_running;
 }
 
-// TODO Do something about the sound, because it sounds absolutely disgusting 
-bool Chip8::configureSound() {
-    SDL_AudioSpec spec;
-    spec.channels = 1;
-    spec.format = SDL_AUDIO_F32;
-    spec.freq = 8000;
-    
-    stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, FeedTheAudioStreamMore, NULL);
-    if (!stream) {
-        SDL_Log("Couldn't create audio stream: %s", SDL_GetError());
+bool Chip8::monitorCommand(const std::string& line) {
+    std::istringstream in(line);
+    std::string command;
+    if (!(in >> command))
+        return true;
+
+    // Addresses and lengths are hex, as everywhere in CHIP-8
+    auto number = [&](std::size_t& value) {
+        std::string token;
+        if (!(in >> token))
+            return false;
+        char *end;
+        value = std::strtoul(token.c_str(), &end, 16);
+        return *end == '\0';
+    };
+    const std::size_t size = core.getRam().size();
+    std::size_t address = 0;
+    std::size_t length = 1;
+
+    if (command == "c") {
+        return false;
+    } else if (command == "q") {
+        is_running = false;
+        debugger.clear();
         return false;
+    } else if (command == "s") {
+        std::size_t count = 1;
+        if (!number(count))
+            count = 1;
+        // Lets the instruction stopped at run, and stops again at the next hit
+        debugger.resume(core);
+        core.step(count);
+        if (debugger.hasStopped())
+            showStop();
+        showRegisters();
+    } else if (command == "b" && number(address) && address < size) {
+        const bool enabled = !debugger.hasBreakpoint(static_cast<uint16_t>(address));
+        debugger.setBreakpoint(static_cast<uint16_t>(address), enabled);
+        std::cout << "Breakpoint at " << std::hex << address << std::dec << (enabled ? " set" : " cleared") << std::endl;
+    } else if (command == "w" && number(address) && address < size) {
+        // w <addr> [len] [r|w|rw|off], the length in hex
+        std::string token;
+        std::string access_name = "rw";
+        if (in >> token) {
+            char *end;
+            const std::size_t value = std::strtoul(token.c_str(), &end, 16);
+            if (*end == '\0') {
+                length = value;
+                in >> access_name;
+            } else {
+                access_name = token;
+            }
+        }
+        const uint8_t access = access_name == "r" ? Debugger::READ : access_name == "w" ? Debugger::WRITE :
+                               access_name == "rw" ? Debugger::READ | Debugger::WRITE : 0;
+        if (!access && access_name != "off") {
+            std::cout << "Expected r, w, rw or off" << std::endl;
+            return true;
+        }
+        debugger.watch(static_cast<uint16_t>(address), length, access);
+        listBreakpoints();
+    } else if (command == "m") {
+        // By default the bytes I points at
+        if (!number(address))
+            address = core.getState().I & 0xFFF;
+        if (!number(length))
+            length = 0x40;
+        showRamContent(address, address + length);
+    } else if (command == "r") {
+        showRegisters();
+    } else if (command == "l") {
+        listBreakpoints();
+    } else if (command == "d") {
+        debugger.clear();
+        std::cout << "All breakpoints and watchpoints deleted" << std::endl;
+    } else {
+        std::cout << "Unknown command or bad address: " << line << std::endl;
     }
 
+    core.setDebugger(debugger.empty() ? nullptr : &debugger);
     return true;
 }
 
-void Chip8::playSound() {
-    SDL_ResumeAudioStreamDevice(stream);
+uint32_t Chip8::toPixel(const color& c) {
+    // SDL_PIXELFORMAT_XRGB8888
+    return (uint32_t(c.r) << 16) | (uint32_t(c.g) << 8) | uint32_t(c.b);
 }
 
-void Chip8::stopSound() {
-    SDL_PauseAudioStreamDevice(stream);
-}
+void Chip8::updateTextureRows(const Chip8Core::display_t& display, bool hires, int first, int last) {
+    const int width = hires ? HIRES_WIDTH : WINDOW_WIDTH;
+    SDL_Rect rect{0, first, width, last - first + 1};
+    void *pixels;
+    int pitch;
+    if (!SDL_LockTexture(texture, &rect, &pixels, &pitch)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to lock display texture: %s", SDL_GetError());
+        return;
+    }
 
-bool Chip8::loadRom(const char *path) {
-    std::filesystem::path rom_path(path);
+    // Indexed by plane 0 bit | plane 1 bit << 1
+    const uint32_t palette[4] = {
+        toPixel(background_color), toPixel(draw_color), toPixel(plane2_color), toPixel(both_color)
+    };
 
-    if (!std::filesystem::exists(rom_path) || !std::filesystem::is_regular_file(rom_path)) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "ROM file does not exist: %s", rom_path.string().c_str());
-        return false;
+    for (int y = first; y <= last; ++y) {
+        uint32_t *out = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + (y - first) * pitch);
+        const Chip8Core::display_row_t& row0 = display[0][y];
+        const Chip8Core::display_row_t& row1 = display[1][y];
+        for (int x = 0; x < width; ++x) {
+            int bit = 63 - (x & 63);
+            out[x] = palette[((row0[x >> 6] >> bit) & 1) | (((row1[x >> 6] >> bit) & 1) << 1)];
+        }
     }
 
-    rom = std::ifstream(rom_path, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!rom.is_open()) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to open ROM file: %s", rom_path.string().c_str());
-        return false;
+    SDL_UnlockTexture(texture);
+}
+
+void Chip8::renderDisplay(const Chip8Core::display_t& display, bool hires, uint64_t dirty_rows) {
+    // Upload each contiguous run of changed rows into the streaming texture
+    const int height = hires ? HIRES_HEIGHT : WINDOW_HEIGHT;
+    int y = 0;
+    while (y < height) {
+        if (!((dirty_rows >> y) & 1)) {
+            ++y;
+            continue;
+        }
+
+        int first = y;
+        while (y + 1 < height && ((dirty_rows >> (y + 1)) & 1))
+            ++y;
+        updateTextureRows(display, hires, first, y);
+        ++y;
     }
 
-    SDL_Log("ROM loaded: %s", rom_path.string().c_str());
+    // The used part of the texture covers the whole window, SDL scales it up
+    const SDL_FRect source{0, 0, float(hires ? HIRES_WIDTH : WINDOW_WIDTH), float(height)};
+    SDL_RenderTexture(renderer, texture, &source, NULL);
+    SDL_RenderPresent(renderer);
+    needs_present = false;
+}
 
-    return true;
+Chip8::clock::time_point Chip8::eventTime(const SDL_Event& event) {
+    // SDL stamps events in SDL_GetTicksNS() time; carry that age over to the steady clock
+    clock::time_point now = clock::now();
+    Uint64 sdl_now = SDL_GetTicksNS();
+    Uint64 age = event.common.timestamp < sdl_now ? sdl_now - event.common.timestamp : 0;
+    return now - std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(age));
 }
 
-void Chip8::run() {
-    is_running = true;
-    is_paused = false;
-    
-    size_t instructions_per_frame = INSTRUCTION_PER_SECOND / FPS; 
-    
-    while (is_running) {
-        
-        SDL_Event event;        
-        while (SDL_PollEvent(&event)) {  
-            handleInput(event.key.scancode, event.type);
-        }
+void Chip8::handleInput(const SDL_Event& event) {
+    if (event.type != SDL_EVENT_KEY_DOWN && event.type != SDL_EVENT_KEY_UP)
+        return;
 
-        if (!is_paused) {
-            for (size_t i = 0; i < instructions_per_frame; i++) {
-                // Fetch and execute instructions
-                uint16_t instruction = RAM[PC] << 8 | RAM[PC + 1];
-                PC += 2;
-                executeInstruction(instruction);
-            }
-            
-            if (draw_to_screen)
-                renderDisplay();        
+    const SDL_Scancode key = event.key.scancode;
+    const uint8_t keypad_key = key < SDL_SCANCODE_COUNT ? key_bindings[key] : NO_KEY;
+    if (keypad_key != NO_KEY) {
+        // Auto-repeat would only record presses of a key that is already down
+        if (event.key.repeat)
+            return;
+
+        KeyEvent key_event{eventTime(event), keypad_key, event.type == SDL_EVENT_KEY_DOWN};
+        if (key_event.pressed && latency_probe && !probe_waiting) {
+            probe_start = key_event.time;
+            probe_waiting = true;
         }
+        queueKey(key_event);
+        return;
+    }
 
-        if (delay_timer > 0)
-            delay_timer--;
+    if (event.type != SDL_EVENT_KEY_DOWN)
+        return;
 
-        if (sound_timer > 0) {
-            sound_timer--;
-            playSound();
-        } else {
-            stopSound();
-        }
-        
-        fps_cap_timer.sleep();  
+    if (key == SDL_SCANCODE_ESCAPE)
+        is_running = false;
+    else if (key == SDL_SCANCODE_SPACE)
+        control(Control::TogglePause);
+    else if (key == SDL_SCANCODE_TAB)
+        control(Control::ToggleTurbo);
+    else if (key == SDL_SCANCODE_EQUALS)
+        control(Control::SpeedUp);
+    else if (key == SDL_SCANCODE_MINUS)
+        control(Control::SlowDown);
+    else if (key == SDL_SCANCODE_RIGHTBRACKET)
+        control(Control::FastForward);
+    else if (key == SDL_SCANCODE_LEFTBRACKET)
+        control(Control::SlowMotion);
+    else if (key == SDL_SCANCODE_F5)
+        control(Control::QuickSave);
+    else if (key == SDL_SCANCODE_F9)
+        control(Control::QuickLoad);
+    else if (key == SDL_SCANCODE_PAGEDOWN)
+        control(Control::NextRom);
+    else if (key == SDL_SCANCODE_PAGEUP)
+        control(Control::PreviousRom);
+    else if (key == SDL_SCANCODE_GRAVE)
+        control(Control::Break);
+}
+
+void Chip8::control(Control action) {
+    // The emulation thread owns the core while it runs
+    if (emulation_thread.joinable()) {
+        if (!controls.push(action))
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Emulation thread is not keeping up, dropped a key command.");
+        return;
     }
+
+    applyControl(action);
 }
 
-void Chip8::executeInstruction(uint16_t instruction) {
-    uint8_t first_nibble = instruction >> 12;
+void Chip8::applyControl(Control action) {
+    // Both sides must keep running the same ROM at the same clock
+    if (netplay.isOpen() && (action == Control::SpeedUp || action == Control::SlowDown || action == Control::QuickLoad ||
+                             action == Control::NextRom || action == Control::PreviousRom || action == Control::Break)) {
+        SDL_Log("Not available during netplay");
+        return;
+    }
+    // The log header holds one clock for the whole replay
+    if (recorder.isOpen() && (action == Control::SpeedUp || action == Control::SlowDown)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot change the clock while recording input.");
+        return;
+    }
 
-    uint16_t nnn = instruction & 0x0FFF;
-    uint8_t n = instruction & 0x000F;
-    uint8_t kk = instruction & 0x00FF;
-    uint8_t x = (instruction & 0x0F00) >> 8;
-    uint8_t y = (instruction & 0x00F0) >> 4;
-    
-    // std::cout << "Executing instruction: " << std::hex << instruction << std::endl;
-    
-    switch (first_nibble)
+    switch (action)
     {
-    case 0x0:
-        instr_set_0(instruction);
-        break;
-    case 0x1:
-        instr_1nnn(nnn);
-        break;
-    case 0x2:
-        instr_2nnn(nnn);
+    case Control::TogglePause:
+        is_paused ^= 1;
+        recorder.recordPause(core, is_paused);
         break;
-    case 0x3:
-        instr_3xkk(x, kk);
+    case Control::ToggleTurbo:
+        setTurbo(!turbo);
         break;
-    case 0x4:
-        instr_4xkk(x, kk);
+    case Control::SpeedUp:
+        setInstructionsPerSecond(core.getInstructionsPerSecond() * 5 / 4);
         break;
-    case 0x5:
-        instr_5xy0(x, y);
+    case Control::SlowDown:
+        setInstructionsPerSecond(core.getInstructionsPerSecond() * 4 / 5);
         break;
-    case 0x6:
-        instr_6xkk(x, kk);
+    case Control::FastForward:
+        changeSpeed(1);
         break;
-    case 0x7:
-        instr_7xkk(x, kk);
+    case Control::SlowMotion:
+        changeSpeed(-1);
         break;
-    case 0x8:
-        instr_set_8(instruction, x, y);
+    case Control::QuickSave:
+        quickSave();
         break;
-    case 0x9:
-        instr_9xy0(x, y);
+    case Control::QuickLoad:
+        quickLoad();
         break;
-    case 0xA:
-        instr_Annn(nnn);
+    case Control::NextRom:
+        if (library.size())
+            switchRom((library_index + 1) % library.size());
         break;
-    case 0xB:
-        instr_Bnnn(nnn);
+    case Control::PreviousRom:
+        if (library.size())
+            switchRom((library_index + library.size() - 1) % library.size());
         break;
-    case 0xC:
-        instr_Cxkk(x, kk);
-        break;
-    case 0xD:
-        instr_Dxyn(x, y, n);
-        break;
-    case 0xE:
-        instr_set_E(instruction, x);
-        break;
-    case 0xF:
-        instr_set_F(instruction, x);
-        break;
-    default:
-        std::cout << "Invalid instruction" << std::endl;
+    case Control::Break:
+        // The emulation thread cannot wait on the terminal while the window
+        // waits on it to stop
+        if (threaded)
+            SDL_Log("The debugger needs the serial loop (run without --threaded)");
+        else
+            runMonitor();
         break;
     }
 }
 
-void Chip8::instr_set_0(uint16_t instruction) {
-    switch (instruction)
-    {
-    case 0x00E0:
-        instr_00E0();
-        break;
-    case 0x00EE:
-        instr_00EE();
-        break;
-    default:
-        break;
+void Chip8::queueKey(const KeyEvent& event) {
+    if (!emulation_thread.joinable()) {
+        if (pending_keys.size() < MAX_PENDING_KEYS)
+            pending_keys.push_back(event);
+        else
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Too many key events in one frame, dropped one.");
+        return;
     }
+
+    if (!key_events.push(event))
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Emulation thread is not keeping up, dropped a key event.");
 }
 
-void Chip8::instr_set_8(uint16_t instruction, uint8_t x, uint8_t y) {
-    uint8_t last_nibble = instruction & 0x000F;
-    switch (last_nibble)
-    {
-    case 0x0:
-        instr_8xy0(x, y);
-        break;
-    case 0x1:
-        instr_8xy1(x, y);
-        break;
-    case 0x2:
-        instr_8xy2(x, y);
-        break;
-    case 0x3:
-        instr_8xy3(x, y);
-        break;
-    case 0x4:
-        instr_8xy4(x, y);
-        break;
-    case 0x5:
-        instr_8xy5(x, y);
-        break;
-    case 0x6:
-        instr_8xy6(x, y);
-        break;
-    case 0x7:
-        instr_8xy7(x, y);
-        break;
-    case 0xE:
-        instr_8xyE(x, y);
-        break;
-    default:
-        break;
-    } 
+void Chip8::probePresented() {
+    if (!probe_waiting)
+        return;
+
+    double ms = std::chrono::duration<double, std::milli>(clock::now() - probe_start).count();
+    latency_ms.push_back(ms);
+    probe_waiting = false;
+    SDL_Log("Input latency: %.2f ms (keypress to presented frame)", ms);
 }
 
-void Chip8::instr_set_E(uint16_t instruction, uint8_t x) {
-    uint8_t last_two_nibbles = instruction & 0xFF;
-    switch (last_two_nibbles)
-    {
-    case 0x9E:
-        instr_Ex9E(x);
-        break;
-    case 0xA1:
-        instr_ExA1(x);
-        break;
-    default:
-        break;
-    }
+void Chip8::logLatencySummary() const {
+    if (latency_ms.empty())
+        return;
+
+    std::vector<double> sorted = latency_ms;
+    std::sort(sorted.begin(), sorted.end());
+    SDL_Log("Input latency over %zu presses: min %.2f ms, median %.2f ms, p95 %.2f ms, max %.2f ms",
+        sorted.size(), sorted.front(), sorted[sorted.size() / 2],
+        sorted[static_cast<std::size_t>(0.95 * (sorted.size() - 1))], sorted.back());
 }
 
-void Chip8::instr_set_F(uint16_t instruction, uint8_t x) {
-    uint8_t last_two_nibbles = instruction & 0xFF;
-    switch (last_two_nibbles)
-    {
-    case 0x07:
-        instr_Fx07(x);
-        break;
-    case 0x0A:
-        instr_Fx0A(x);
-        break;
-    case 0x15:
-        instr_Fx15(x);
-        break;
-    case 0x18:
-        instr_Fx18(x);
-        break;
-    case 0x1E:
-        instr_Fx1E(x);
-        break;
-    case 0x29:
-        instr_Fx29(x);
-        break;
-    case 0x33:
-        instr_Fx33(x);
-        break;
-    case 0x55:
-        instr_Fx55(x);
-        break;
-    case 0x65:
-        instr_Fx65(x);
-        break;
-    default:
-        break;
+bool Chip8::openLibrary(const char *path, const char *rom_name) {
+    if (!library.open(path)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to open ROM library: %s", path);
+        return false;
     }
-}
 
+    std::size_t index = rom_name ? library.find(rom_name) : 0;
+    if (index == library.size()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "No ROM named %s in %s", rom_name, path);
+        return false;
+    }
 
-void Chip8::instr_00E0() {
-    std::fill(display.begin(), display.end(), std::array<bool, WINDOW_WIDTH>{});
-    clearWindow();
+    SDL_Log("ROM library %s: %zu ROMs", path, library.size());
+    library_path = path;
+    switchRom(index);
+    return true;
 }
 
-void Chip8::instr_00EE() {
-    PC = stack.top();
-    stack.pop();
-} 
+void Chip8::switchRom(std::size_t index) {
+    // The log can only replay one ROM
+    if (recorder.isOpen()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot switch ROMs while recording input.");
+        return;
+    }
 
-void Chip8::instr_0nnn(uint16_t nnn) {
-    // Do not implement
-}
+    // Straight from the mapping into RAM; resetting the core also drops translated blocks
+    library.load(index, core);
+    if (has_forced_variant)
+        core.setVariant(forced_variant);
+    library_index = index;
 
-void Chip8::instr_1nnn(uint16_t nnn) {
-    PC = nnn;
+    const RomLibrary::Entry& entry = library.getEntries()[index];
+    save_path = library.isArchive() ? library_path + "." + entry.name + ".state" : entry.name + ".state";
+    SDL_Log("ROM %zu/%zu: %s (%s, sha1 %s)", index + 1, library.size(), entry.name.c_str(),
+        variantName(core.getVariant()), sha1Hex(entry.sha1).c_str());
 }
 
-void Chip8::instr_2nnn(uint16_t nnn) {
-    stack.push(PC);
-    PC = nnn;
+void Chip8::setVariant(Variant variant) {
+    has_forced_variant = true;
+    forced_variant = variant;
+    core.setVariant(variant);
 }
 
-void Chip8::instr_3xkk(uint8_t x, uint8_t kk) {
-    if (V[x] == kk) 
-        PC += 2;
+void Chip8::quickSave() {
+    if (save_state::save(save_path.c_str(), core.getState()))
+        SDL_Log("State saved to %s", save_path.c_str());
+    else
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to save state to %s", save_path.c_str());
 }
 
-void Chip8::instr_4xkk(uint8_t x, uint8_t kk) {
-    if (V[x] != kk) 
-        PC += 2;
-}
+void Chip8::quickLoad() {
+    // Going back in time would break the log's frame and instruction deltas
+    if (recorder.isOpen()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Cannot load a state while recording input.");
+        return;
+    }
 
-void Chip8::instr_5xy0(uint8_t x, uint8_t y) {
-    if (V[x] == V[y]) 
-        PC += 2;
-}
+    Chip8Core::State snapshot;
+    if (!save_state::load(save_path.c_str(), snapshot)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to load state from %s", save_path.c_str());
+        return;
+    }
 
-void Chip8::instr_6xkk(uint8_t x, uint8_t kk) {
-    V[x] = kk;
+    // setState marks every row dirty, so the next frame redraws the whole display
+    core.setState(snapshot);
+    SDL_Log("State loaded from %s", save_path.c_str());
 }
 
-void Chip8::instr_7xkk(uint8_t x, uint8_t kk) {
-    V[x] += kk;
+void Chip8::setTurbo(bool enabled) {
+    turbo = enabled;
+    // Restart frame pacing from now, otherwise leaving turbo would have to catch up
+    fps_cap_timer.reset();
+    // Presenting would still block on vsync in turbo; threaded runs present independently
+    if (vsync && renderer && !threaded)
+        SDL_SetRenderVSync(renderer, turbo ? 0 : 1);
+    audio.setMuted(turbo || speed_index != NORMAL_SPEED);
+    SDL_Log("Turbo %s", turbo ? "on" : "off");
 }
 
-void Chip8::instr_8xy0(uint8_t x, uint8_t y) {
-    V[x] = V[y];
-}
+bool Chip8::setSpeed(const char *name) {
+    if (strcmp(name, "max") == 0) {
+        setTurbo(true);
+        return true;
+    }
 
-void Chip8::instr_8xy1(uint8_t x, uint8_t y) {
-    V[x] |= V[y];
-}
+    for (std::size_t i = 0; i < SPEED_COUNT; i++) {
+        if (strcmp(name, SPEEDS[i].name) == 0) {
+            speed_index = i;
+            frame_credit = 0;
+            setTurbo(false);
+            return true;
+        }
+    }
 
-void Chip8::instr_8xy2(uint8_t x, uint8_t y) {
-    V[x] &= V[y];
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Unknown speed %s, expected 0.25, 0.5, 1, 2, 4 or max", name);
+    return false;
 }
 
-void Chip8::instr_8xy3(uint8_t x, uint8_t y) {
-    V[x] ^= V[y];
-}
+void Chip8::changeSpeed(int direction) {
+    // Uncapped sits one step past the fastest fixed speed
+    if (turbo) {
+        if (direction > 0)
+            return;
+        speed_index = SPEED_COUNT - 1;
+        setTurbo(false);
+    } else if (direction > 0 && speed_index + 1 == SPEED_COUNT) {
+        setTurbo(true);
+        return;
+    } else if (direction > 0) {
+        speed_index++;
+    } else if (speed_index > 0) {
+        speed_index--;
+    }
 
-void Chip8::instr_8xy4(uint8_t x, uint8_t y) {
-    uint16_t result = V[x] + V[y];
-    V[x] = result & 0x00FF;
-    V[0xF] = result > 0xFF;
+    frame_credit = 0;
+    audio.setMuted(turbo || speed_index != NORMAL_SPEED);
+    SDL_Log("Speed %sx", SPEEDS[speed_index].name);
 }
 
-void Chip8::instr_8xy5(uint8_t x, uint8_t y) {
-    uint8_t bit = V[x] >= V[y]; 
-    V[x] -= V[y];
-    V[0xF] = bit;
+void Chip8::setInstructionsPerSecond(uint32_t rate) {
+    // Never let - round the clock down to a stop
+    core.setInstructionsPerSecond(rate < FPS ? FPS : rate);
+    SDL_Log("CPU at %u %s per second", core.getInstructionsPerSecond(),
+        core.hasCycleCosts() ? "cycles" : "instructions");
 }
 
-void Chip8::instr_8xy6(uint8_t x, uint8_t y) {
-    uint8_t bit = V[x] & 0x1;
-    V[x] >>= 1;
-    V[0xF] = bit;
-}
+bool Chip8::setVipTiming(bool enabled) {
+    if (enabled && jit) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "VIP timing needs the interpreter, the JIT does not charge cycle costs.");
+        return false;
+    }
 
-void Chip8::instr_8xy7(uint8_t x, uint8_t y) {
-    uint8_t bit = V[y] >= V[x];
-    V[x] = V[y] - V[x];
-    V[0xF] = bit;
+    core.setCycleCosts(enabled ? &Chip8Core::VIP_CYCLES : nullptr);
+    core.setInstructionsPerSecond(enabled ? Chip8Core::VIP_CYCLES_PER_SECOND : INSTRUCTION_PER_SECOND);
+    return true;
 }
 
-void Chip8::instr_8xyE(uint8_t x, uint8_t y) {
-    uint8_t bit = (V[x] & 0x80) >> 7;
-    V[x] <<= 1;
-    V[0xF] = bit;
-}
+bool Chip8::setVsync(bool enabled) {
+    if (!SDL_SetRenderVSync(renderer, enabled && !turbo ? 1 : 0)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "VSync is not available, pacing with the OS timer: %s", SDL_GetError());
+        vsync = false;
+        return false;
+    }
 
-void Chip8::instr_9xy0(uint8_t x, uint8_t y) {
-    if (V[x] != V[y])
-        PC += 2;
+    vsync = enabled;
+    return true;
 }
 
-void Chip8::instr_Annn(uint16_t nnn) {
-    I = nnn;
-}
+bool Chip8::setJit(bool enabled) {
+    if (!enabled) {
+        jit.reset();
+        return true;
+    }
 
-void Chip8::instr_Bnnn(uint16_t nnn) {
-    PC = nnn + V[0];
-}
+    if (netplay.isOpen()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Netplay runs the interpreter.");
+        return false;
+    }
 
-void Chip8::instr_Cxkk(uint8_t x, uint8_t kk) {
-    std::random_device rd; // obtain a random number from hardware
-    std::mt19937 gen(rd()); // seed the generator
-    std::uniform_int_distribution<> distr(0, 255); // define the range
+    if (core.hasCycleCosts()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "The JIT does not charge cycle costs, using the interpreter.");
+        return false;
+    }
 
-    V[x] = distr(gen) & kk;
-} 
+    if (!Chip8Jit::isSupported()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "JIT is not supported on this host, using the interpreter.");
+        return false;
+    }
 
-void Chip8::instr_Dxyn(uint8_t x, uint8_t y, uint8_t n) {
-    uint8_t start_x = V[x] % 64;
-    uint8_t start_y = V[y] % 32;
-    
-    V[0xF] = 0;
+    jit = std::make_unique<Chip8Jit>(core);
+    return true;
+}
 
-    for (uint8_t i = 0; i < n; i++)
-    {   
-        if (start_y + i >= 32) break;
+bool Chip8::startRecording(const char *path) {
+    if (!recorder.open(path, core)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to start input recording: %s", path);
+        return false;
+    }
 
-        if (I + i >= RAM.size()) {
-            SDL_Log("Dxyn: RAM read out of bounds at I + %u (0x%03X)", i, I + i);
-            break;
-        }
+    SDL_Log("Recording input to %s", path);
+    return true;
+}
 
-        uint8_t sprite_byte = RAM[I + i];
+bool Chip8::startCapture(const char *path) {
+    capture.setPalette({toPixel(background_color), toPixel(draw_color), toPixel(plane2_color), toPixel(both_color)});
+    if (!capture.open(path)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to start capture: %s", path);
+        return false;
+    }
 
-        for (uint8_t j = 0; j < 8; j++)
-        {
-            if (start_x + j >= 64) break;
+    SDL_Log("Capturing the display to %s", path);
+    return true;
+}
 
-            uint8_t bit = (sprite_byte >> (7 - j)) & 1;
+bool Chip8::startNetplay(uint16_t local_port, const char *host, uint16_t port, std::chrono::milliseconds timeout) {
+    if (!netplay.open(local_port, host, port)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to open netplay port %u", static_cast<unsigned>(local_port));
+        return false;
+    }
 
-            if (bit) {
-                if (display[start_y + i][start_x + j]) {
-                    V[0xF] = 1;
-                    display[start_y + i][start_x + j] = 0;
-                } else {
-                    display[start_y + i][start_x + j] = 1;
-                }
-            }
-        }      
+    SDL_Log("Waiting for the netplay peer at %s:%u", host, static_cast<unsigned>(port));
+    if (!netplay.connect(core, timeout)) {
+        netplay.close();
+        return false;
     }
+    if (jit) {
+        SDL_Log("Netplay runs the interpreter");
+        jit.reset();
+    }
+
+    SDL_Log("Netplay connected, Cxkk seed %llu", static_cast<unsigned long long>(core.getSeed()));
+    return true;
+}
 
-    draw_to_screen = true;
-}    
+bool Chip8::setStatsFile(const char *path) {
+#ifdef CHIP8_PROFILE
+    stats_path = path;
+    last_stats_write = stats_clock::now();
+    SDL_Log("Writing stats to %s every %lld s", path, static_cast<long long>(STATS_INTERVAL.count()));
+    return true;
+#else
+    (void)path;
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Stats need a build configured with -DCHIP8_PROFILE=ON");
+    return false;
+#endif
+}
 
-void Chip8::instr_Ex9E(uint8_t x) {
-    if (keypad[V[x] & 0xF]) {
-        PC += 2;
+#ifdef CHIP8_PROFILE
+void Chip8::recordFrame(stats_clock::time_point start, stats_clock::time_point emulated, stats_clock::time_point rendered) {
+    stats_clock::time_point end = stats_clock::now();
+    emulate_time.record(emulated - start);
+    render_time.record(rendered - emulated);
+    sleep_time.record(end - rendered);
+    frame_time.record(end - start);
+
+    if (!stats_path.empty() && end - last_stats_write >= STATS_INTERVAL) {
+        writeStats();
+        last_stats_write = end;
     }
 }
 
-void Chip8::instr_ExA1(uint8_t x) {
-    if (!keypad[V[x] & 0xF]) {
-        PC += 2;
+void Chip8::writeStats() const {
+    std::ofstream out(stats_path, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to write stats to %s", stats_path.c_str());
+        return;
+    }
+
+    out << "frames: " << core.getFrameCount() << ", instructions: " << core.getInstructionCount()
+        << ", idle instructions skipped: " << core.getIdleInstructionCount()
+        << ", dropped ticks: " << fps_cap_timer.getDroppedTicks() << "\n\n";
+    emulate_time.write(out, "emulate (input and CPU)");
+    render_time.write(out, "render (texture, present, audio)");
+    sleep_time.write(out, "sleep");
+    frame_time.write(out, "frame");
+    out << '\n';
+    core.writeProfile(out);
+}
+#endif
+
+void Chip8::emulateTicks(std::size_t ticks) {
+    const uint64_t last = fps_cap_timer.getTicks();
+    const Speed& speed = SPEEDS[speed_index];
+
+    for (std::size_t i = 0; i < ticks; i++) {
+        // Slow motion runs a frame every few ticks, fast forward several per
+        // tick; either way the frames split the host time since the last one
+        frame_credit += speed.frames;
+        const std::size_t frames = frame_credit / speed.ticks;
+        frame_credit %= speed.ticks;
+        if (!frames)
+            continue;
+
+        const clock::time_point begin = last_frame_end;
+        const clock::time_point end = fps_cap_timer.tickTime(last - ticks + i + 1);
+        for (std::size_t frame = 0; frame < frames; frame++) {
+            clock::time_point frame_end = begin + (end - begin) * static_cast<int64_t>(frame + 1) / static_cast<int64_t>(frames);
+            emulateFrame(last_frame_end, frame_end);
+            last_frame_end = frame_end;
+        }
     }
 }
 
-void Chip8::instr_Fx07(uint8_t x) {
-    V[x] = delay_timer;
+void Chip8::emulateUncapped() {
+    const clock::time_point present = clock::now() + std::chrono::nanoseconds(1000000000 / FPS);
+    // Each frame covers the host time since the previous one
+    clock::time_point now;
+    do {
+        now = clock::now();
+        emulateFrame(last_frame_end, now);
+        last_frame_end = now;
+    } while (now < present && !is_paused);
 }
 
-void Chip8::instr_Fx0A(uint8_t x) {
-    if (!waiting_for_key_release) {
-        for (uint8_t i = 0; i < 16; i++) {
-            if (keypad[i & 0xF]) {
-                V[x] = i;
-                waiting_for_key_release = true;
-                PC -= 2;
-                return;
-            }
-        }
-        PC -= 2;
-    } else {
-        bool all_released = true;
-        for (uint8_t i = 0; i < 16; i++) {
-            if (keypad[i & 0xF]) {
-                all_released = false;
-                break;
-            }
-        }
+void Chip8::emulateFrame(clock::time_point begin, clock::time_point end) {
+    if (netplay.isOpen()) {
+        emulateNetplayFrame(end);
+        return;
+    }
+
+    core.beginFrame();
+    const int32_t budget = core.getState().cycle_budget;
 
-        if (all_released) {
-            waiting_for_key_release = false;
-        } else {
-            PC -= 2;
+    std::size_t applied = 0;
+    for (; applied < pending_keys.size() && pending_keys[applied].time < end; applied++) {
+        const KeyEvent& event = pending_keys[applied];
+        if (!is_paused && budget > 0 && event.time > begin) {
+            double fraction = std::chrono::duration<double>(event.time - begin) / std::chrono::duration<double>(end - begin);
+            runFrameBudget(budget - static_cast<int32_t>(fraction * budget));
         }
+
+        core.setKey(event.key, event.pressed);
+        recorder.recordKey(core, event.key, event.pressed);
     }
-}
+    pending_keys.erase(pending_keys.begin(), pending_keys.begin() + applied);
 
-void Chip8::instr_Fx15(uint8_t x) {
-    delay_timer = V[x];
+    if (!is_paused)
+        runFrameBudget(0);
+    core.endFrame();
+    if (capture.isOpen())
+        capture.addFrame(core);
 }
 
-void Chip8::instr_Fx18(uint8_t x) {
-    sound_timer = V[x];
+void Chip8::emulateNetplayFrame(clock::time_point end) {
+    std::size_t applied = 0;
+    for (; applied < pending_keys.size() && pending_keys[applied].time < end; applied++) {
+        const KeyEvent& event = pending_keys[applied];
+        const uint16_t bit = static_cast<uint16_t>(1u << (event.key & 0xF));
+        netplay_keys = event.pressed ? netplay_keys | bit : netplay_keys & ~bit;
+    }
+    pending_keys.erase(pending_keys.begin(), pending_keys.begin() + applied);
+
+    // A wait for the peer leaves the frame out rather than capturing it twice
+    if (is_paused)
+        netplay.poll(core);
+    else if (netplay.runFrame(core, netplay_keys) && capture.isOpen())
+        capture.addFrame(core);
 }
 
-void Chip8::instr_Fx1E(uint8_t x) {
-    I += V[x];
+void Chip8::runFrameBudget(int32_t leave) {
+    // A breakpoint or watchpoint hit leaves the rest of the budget to run
+    // once the monitor continues. The JIT interprets under a debugger anyway
+    // and would lose what it took, so runBudget charges the budget instead.
+    do {
+        if (jit && !core.isDebugging())
+            jit->step(core.takeInstructionBudget(leave));
+        else
+            core.runBudget(SIZE_MAX, leave);
+    } while (debugger.hasStopped() && runMonitor());
 }
 
-void Chip8::instr_Fx29(uint8_t x) {
-    I = V[x] * 5;
+void Chip8::run() {
+    is_running = true;
+    is_paused = false;
+    // Keys waiting for their frame never reallocate while running
+    pending_keys.reserve(MAX_PENDING_KEYS);
+    speed_sample_time = clock::now();
+    speed_sample_frames = core.getFrameCount();
+    speed_sample_instructions = core.getInstructionCount();
+
+    if (break_at_start && threaded) {
+        SDL_Log("The debugger needs the serial loop, running unthreaded");
+        threaded = false;
+    }
+    if (break_at_start && !runMonitor())
+        return;
+
+    if (threaded)
+        runThreaded();
+    else
+        runSerial();
 }
 
-void Chip8::instr_Fx33(uint8_t x) {
-    if (I + 2 >= RAM.size()) {
-        SDL_Log("Fx33: Memory write would exceed RAM bounds! (I = 0x%03X)", I);
+void Chip8::updateSpeedDisplay(uint64_t frames, uint64_t instructions) {
+    const clock::time_point now = clock::now();
+    const double seconds = std::chrono::duration<double>(now - speed_sample_time).count();
+    if (seconds < SPEED_SAMPLE_SECONDS)
         return;
+
+    // The counts start over on a ROM switch or a loaded state; skip that sample
+    if (frames >= speed_sample_frames && instructions >= speed_sample_instructions) {
+        const double fps = (frames - speed_sample_frames) / seconds;
+        const double ips = (instructions - speed_sample_instructions) / seconds;
+        char title[128];
+        SDL_snprintf(title, sizeof(title), "Re:Chip-8 - %.0f%% speed (%.0f frames/s, %.0f instructions/s)",
+            100.0 * fps / FPS, fps, ips);
+        SDL_SetWindowTitle(window, title);
     }
 
-    RAM[I] = V[x] / 100;
-    RAM[I + 1] = (V[x] / 10) % 10;
-    RAM[I + 2] = V[x] % 10;
+    speed_sample_time = now;
+    speed_sample_frames = frames;
+    speed_sample_instructions = instructions;
 }
 
-void Chip8::instr_Fx55(uint8_t x) {
-    for (uint8_t i = 0; i <= x; i++) {
-        if (I + i >= RAM.size()) {
-            return;
+void Chip8::runSerial() {
+    fps_cap_timer.reset();
+    last_frame_end = clock::now();
+    
+    while (is_running) {
+        CHIP8_PROFILE_ONLY(stats_clock::time_point frame_start = stats_clock::now();)
+
+        SDL_Event event;        
+        while (SDL_PollEvent(&event)) {  
+            if (event.type == SDL_EVENT_WINDOW_EXPOSED)
+                needs_present = true;
+            handleInput(event);
         }
-        RAM[I + i] = V[i];
+
+        // Every 60 Hz tick that has come due, however long the last pass took,
+        // so fast forward presents only every few guest frames
+        if (turbo)
+            emulateUncapped();
+        else
+            emulateTicks(fps_cap_timer.advance());
+        CHIP8_PROFILE_ONLY(stats_clock::time_point emulated = stats_clock::now();)
+
+        // With vsync the present is what blocks until the next refresh, so it happens every pass
+        uint64_t dirty_rows = core.consumeDirtyRows();
+        if (dirty_rows || needs_present || (vsync && !turbo))
+            renderDisplay(core.getDisplay(), core.isHires(), dirty_rows);
+        if (dirty_rows)
+            probePresented();
+
+        audio.update(core);
+        updateSpeedDisplay(core.getFrameCount(), core.getInstructionCount());
+        CHIP8_PROFILE_ONLY(stats_clock::time_point rendered = stats_clock::now();)
+        
+        if (!turbo && !vsync)
+            fps_cap_timer.waitForNextTick();
+
+        CHIP8_PROFILE_ONLY(recordFrame(frame_start, emulated, rendered);)
     }
 }
 
-void Chip8::instr_Fx65(uint8_t x) {
-    for (uint8_t i = 0; i <= x; i++) {
-        if (I + i >= RAM.size()) {
-            return;
+void Chip8::emulationLoop() {
+    fps_cap_timer.reset();
+    last_frame_end = clock::now();
+
+    while (emulation_running.load(std::memory_order_acquire)) {
+        Control action;
+        while (controls.pop(action))
+            applyControl(action);
+        // The rest stay in the ring until the pending ones have been applied
+        KeyEvent key_event;
+        while (pending_keys.size() < MAX_PENDING_KEYS && key_events.pop(key_event))
+            pending_keys.push_back(key_event);
+
+        // Same pacing as the serial loop, but nothing here waits on the display
+        std::size_t ticks = 1;
+        if (turbo)
+            emulateUncapped();
+        else
+            emulateTicks(ticks = fps_cap_timer.advance());
+
+        if (ticks) {
+            Frame& frame = published_frames.back();
+            frame.display = core.getDisplay();
+            frame.hires = core.isHires();
+            frame.frame_count = core.getFrameCount();
+            frame.instruction_count = core.getInstructionCount();
+            published_frames.publish();
+            audio.update(core);
+        }
+
+        if (!turbo)
+            fps_cap_timer.waitForNextTick();
+    }
+}
+
+void Chip8::runThreaded() {
+    shown_frame.display = core.getDisplay();
+    shown_frame.hires = core.isHires();
+    shown_frame.frame_count = core.getFrameCount();
+    shown_frame.instruction_count = core.getInstructionCount();
+
+    emulation_running.store(true, std::memory_order_release);
+    emulation_thread = std::thread(&Chip8::emulationLoop, this);
+
+    // Presentation runs at 60 Hz (or the display's refresh with vsync) no
+    // matter how fast the emulation thread produces frames
+    Timer<FPS> present_timer;
+    while (is_running) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_EVENT_WINDOW_EXPOSED)
+                needs_present = true;
+            handleInput(event);
+        }
+
+        uint64_t dirty_rows = 0;
+        if (published_frames.acquire()) {
+            const Frame& frame = published_frames.front();
+            // A resolution switch redraws everything
+            if (frame.hires != shown_frame.hires)
+                dirty_rows = ~uint64_t(0);
+            for (int y = 0; y < HIRES_HEIGHT; y++) {
+                if (frame.display[0][y] != shown_frame.display[0][y] || frame.display[1][y] != shown_frame.display[1][y])
+                    dirty_rows |= uint64_t(1) << y;
+            }
+            shown_frame = frame;
         }
 
-        V[i] = RAM[I + i];
+        if (dirty_rows || needs_present || vsync)
+            renderDisplay(shown_frame.display, shown_frame.hires, dirty_rows);
+        if (dirty_rows)
+            probePresented();
+        updateSpeedDisplay(shown_frame.frame_count, shown_frame.instruction_count);
+
+        if (!vsync) {
+            present_timer.advance();
+            present_timer.waitForNextTick();
+        }
     }
+
+    stopEmulationThread();
+}
+
+void Chip8::stopEmulationThread() {
+    if (!emulation_thread.joinable())
+        return;
+
+    emulation_running.store(false, std::memory_order_release);
+    emulation_thread.join();
 }
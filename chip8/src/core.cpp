@@ -0,0 +1,1022 @@
+#include "chip8/core.hpp"
+
+#include "chip8/debugger.hpp"
+#include "chip8/trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <ostream>
+#include <random>
+
+namespace {
+    static_assert(HIRES_HEIGHT == 64, "dirty_rows has one bit per row");
+    constexpr uint64_t ALL_ROWS = ~uint64_t(0);
+
+    const std::array<uint8_t, 80> font = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    };
+
+    // 8x10 digits for Fx30; SUPER-CHIP only has 0-9, XO-CHIP also A-F
+    const std::array<uint8_t, 160> big_font = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+}
+
+// Machine cycles per instruction including the interpreter's fetch and decode,
+// rounded from published VIP timings. 00E0, Dxyn, Fx33 and Fx55/Fx65 vary with
+// operands and the display; these are typical values. The VIP has no XO-CHIP
+// audio, so F002 and Fx3A are priced like Fx65 and Fx18, and the SUPER-CHIP and
+// XO-CHIP additions like the nearest VIP instruction (scrolls and mode changes
+// like 00E0, register ranges like Fx55).
+const Chip8Core::CycleCosts Chip8Core::VIP_CYCLES = {
+    // 00E0 00EE 0nnn 1nnn 2nnn 3xkk 4xkk 5xy0 6xkk 7xkk
+       3078,  50,  50,  52,  66,  52,  52,  58,  46,  50,
+    // 8xy0 8xy1 8xy2 8xy3 8xy4 8xy5 8xy6 8xy7 8xyE 9xy0
+         84,  84,  84,  84,  84,  84,  84,  84,  84,  58,
+    // Annn Bnnn Cxkk Dxyn Ex9E ExA1 Fx07 Fx0A Fx15 Fx18
+         52,  62,  76, 2700,  58,  58,  50,  60,  50,  50,
+    // Fx1E Fx29 Fx33 Fx55 Fx65 F002 Fx3A 00Cn 00Dn 00FB
+         56,  60, 364, 174, 174, 174,  50, 3078, 3078, 3078,
+    // 00FC 00FD 00FE 00FF 5xy2 5xy3 F000 Fn01 Fx30 Fx75
+       3078,  50, 3078, 3078, 174, 174, 104,  50,  60, 174,
+    // Fx85 other
+        174,  50,
+};
+
+Chip8Core::Chip8Core()
+    : direct_execute(false), direct_pc(0), instructions_per_second(INSTRUCTION_PER_SECOND), cycle_costs(nullptr),
+      idle_skipping(true), tracer(nullptr), debugger(nullptr), active_variant(Variant::Chip8), undecoded(&op_decode<variant::Chip8>) {
+    // Unseeded instances still get a different sequence each run
+    std::random_device rd;
+    rng_seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+    reset();
+}
+
+void Chip8Core::seed(uint64_t value) {
+    rng_seed = value;
+    state.rng_state = seedState(value);
+}
+
+uint64_t Chip8Core::seedState(uint64_t value) {
+    // xorshift must not start from zero; splitmix the seed into a non-zero state
+    uint64_t z = value + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return z ? z : 0x9E3779B97F4A7C15ull;
+}
+
+uint8_t Chip8Core::nextRandom(uint64_t& rng_state) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return static_cast<uint8_t>((rng_state * 0x2545F4914F6CDD1Dull) >> 56);
+}
+
+uint64_t Chip8Core::hashDisplay(const display_t& display) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (const display_plane_t& plane : display) {
+        for (const display_row_t& row : plane) {
+            for (uint64_t word : row) {
+                for (int i = 0; i < 8; i++) {
+                    hash ^= static_cast<uint8_t>(word >> (8 * i));
+                    hash *= 0x100000001B3ull;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+void Chip8Core::reset() {
+    // Executions so far belong to the code about to be cleared
+    CHIP8_PROFILE_ONLY(profile_counters.fold(state.RAM, 0, state.RAM.size());)
+
+    // Zero registers, stack, keypad, display and counters
+    state = State{};
+    idle_instructions = 0;
+    call_stack_faults = 0;
+
+    memcpy(state.RAM.data(), font.data(), sizeof(font));
+    memcpy(state.RAM.data() + BIG_FONT_ADDRESS, big_font.data(), sizeof(big_font));
+    state.PC = ROM_START;
+    state.pitch = DEFAULT_PITCH;
+    state.planes = 1;
+    dirty_rows = ALL_ROWS;
+
+    seed(rng_seed);
+
+    // The whole of RAM changed, so anything translated from it is stale
+    invalidateDecodeCache();
+    code_write_lo = 0;
+    code_write_hi = static_cast<uint16_t>(state.RAM.size());
+}
+
+void Chip8Core::setState(const State& snapshot) {
+    // Only code that actually differs needs to be decoded or translated again
+    if (state.RAM != snapshot.RAM) {
+        for (std::size_t a = 0; a < state.RAM.size(); a += sizeof(uint64_t)) {
+            if (memcmp(state.RAM.data() + a, snapshot.RAM.data() + a, sizeof(uint64_t)) != 0)
+                invalidateDecodeCache(static_cast<uint16_t>(a), sizeof(uint64_t));
+        }
+    }
+
+    state = snapshot;
+    dirty_rows = ALL_ROWS;
+}
+
+bool Chip8Core::loadRom(const uint8_t *data, std::size_t size) {
+    if (size > MAX_ROM_SIZE) {
+        std::cerr << "ROM too large: " << size << " bytes (max " << MAX_ROM_SIZE << ")" << std::endl;
+        return false;
+    }
+
+    // reset() already left every decode cache entry undecoded
+    reset();
+    memcpy(state.RAM.data() + ROM_START, data, size);
+    return true;
+}
+
+bool Chip8Core::loadRom(const char *path) {
+    std::filesystem::path rom_path(path);
+
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(rom_path, ec)) {
+        std::cerr << "ROM file does not exist: " << rom_path.string() << std::endl;
+        return false;
+    }
+
+    std::ifstream rom(rom_path, std::ios::in | std::ios::binary);
+    if (!rom.is_open()) {
+        std::cerr << "Failed to open ROM file: " << rom_path.string() << std::endl;
+        return false;
+    }
+
+    // Read one byte past the limit so oversized ROMs are rejected instead of truncated
+    std::array<uint8_t, MAX_ROM_SIZE + 1> buffer;
+    rom.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+    return loadRom(buffer.data(), static_cast<std::size_t>(rom.gcount()));
+}
+
+void Chip8Core::step(std::size_t n) {
+    // Checked once per call, keeping the plain loop free of tracing and debugging
+    if (tracer || debugger) {
+        stepHooked(n);
+        return;
+    }
+
+    for (std::size_t i = 0; i < n; i++) {
+        // Fetch the predecoded instruction and dispatch straight to its handler
+        const uint16_t pc = state.PC & 0xFFF;
+        CHIP8_PROFILE_ONLY(profile_counters.pc_heat[pc]++;)
+        const DecodedOp& op = decode_cache[pc];
+        state.PC += 2;
+        op.handler(*this, op);
+    }
+    state.instruction_count += n;
+}
+
+std::size_t Chip8Core::stepHooked(std::size_t n) {
+    std::size_t i = 0;
+    for (; i < n; i++) {
+        const uint16_t pc = state.PC & 0xFFF;
+        if (debugger && debugger->checks(pc) && debugger->stop(*this, pc))
+            break;
+        CHIP8_PROFILE_ONLY(profile_counters.pc_heat[pc]++;)
+        const DecodedOp& op = decode_cache[pc];
+        state.PC += 2;
+        if (tracer)
+            executeTraced(pc, op);
+        else
+            op.handler(*this, op);
+    }
+    state.instruction_count += i;
+    return i;
+}
+
+void Chip8Core::executeTraced(uint16_t pc, const DecodedOp& op) {
+    // Read before running: Fx55 may overwrite the instruction itself
+    const uint16_t opcode = state.RAM[pc] << 8 | state.RAM[(pc + 1) & 0xFFF];
+    const std::array<uint8_t, 16> v = state.V;
+    const uint16_t i_register = state.I;
+    op.handler(*this, op);
+    tracer->record(pc, opcode, v, i_register, state.V, state.I);
+}
+
+void Chip8Core::runFrames(std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        beginFrame();
+        runBudget();
+        endFrame();
+    }
+}
+
+uint32_t Chip8Core::frameBudget(uint32_t rate, uint32_t& remainder) {
+    // e.g. 700 per second gives 11, 12, 12, 11, 12, 12, ... rather than always 11
+    uint64_t total = static_cast<uint64_t>(remainder) + rate;
+    remainder = static_cast<uint32_t>(total % FPS);
+    return static_cast<uint32_t>(total / FPS);
+}
+
+void Chip8Core::beginFrame() {
+    state.cycle_budget += static_cast<int32_t>(frameBudget(instructions_per_second, state.rate_remainder));
+}
+
+std::size_t Chip8Core::runBudget(std::size_t max_instructions, int32_t leave) {
+    if (state.cycle_budget <= leave)
+        return 0;
+
+    // A debugger may stop partway, which only the per-instruction loop handles
+    if (!cycle_costs && !debugger) {
+        std::size_t n = std::min<std::size_t>(static_cast<std::size_t>(state.cycle_budget - leave), max_instructions);
+        // Checked again every so often, since a ROM can start waiting mid-budget
+        for (std::size_t done = 0; done < n;) {
+            done += skipIdle(n - done);
+            std::size_t chunk = std::min(n - done, IDLE_CHECK_INTERVAL);
+            step(chunk);
+            done += chunk;
+        }
+        state.cycle_budget -= static_cast<int32_t>(n);
+        return n;
+    }
+
+    return tracer || debugger ? runCycles<true>(max_instructions, leave) : runCycles<false>(max_instructions, leave);
+}
+
+template<bool HOOKED>
+std::size_t Chip8Core::runCycles(std::size_t max_instructions, int32_t leave) {
+    // Same loop as step(), charging each instruction its cost; the last one may overrun
+    std::size_t n = 0;
+    std::size_t idle = 0;
+    std::size_t next_idle_check = 0;
+    while (state.cycle_budget > leave && n < max_instructions) {
+        if (!HOOKED && n == next_idle_check && idle_skipping) {
+            std::array<uint16_t, MAX_IDLE_LOOP> addresses;
+            uint32_t cost;
+            bool settled;
+            const std::size_t length = idleLoop(cost, addresses, settled);
+            if (length && cost && settled) {
+                // Whole iterations that still leave budget and instructions
+                // for the next one to start, as they would have running them
+                std::size_t iterations = std::min<std::size_t>(
+                    static_cast<std::size_t>(state.cycle_budget - leave - 1) / cost,
+                    (max_instructions - n - 1) / length);
+                accountIdle(iterations, length, addresses);
+                state.cycle_budget -= static_cast<int32_t>(iterations * cost);
+                n += iterations * length;
+                idle += iterations * length;
+            }
+            // An unsettled loop repeats itself once one iteration has run
+            next_idle_check = n + (length && !settled ? length : IDLE_CHECK_INTERVAL);
+        }
+
+        const uint16_t pc = state.PC & 0xFFF;
+        if (HOOKED && debugger && debugger->checks(pc) && debugger->stop(*this, pc))
+            break;
+        CHIP8_PROFILE_ONLY(profile_counters.pc_heat[pc]++;)
+        const DecodedOp& op = decode_cache[pc];
+        state.PC += 2;
+        if (HOOKED && tracer)
+            executeTraced(pc, op);
+        else
+            op.handler(*this, op);
+        // Read after the call: op_decode has filled in the real entry by now
+        state.cycle_budget -= op.cycles;
+        n++;
+    }
+    // Idle iterations were counted as they were accounted
+    state.instruction_count += n - idle;
+    return n;
+}
+
+std::size_t Chip8Core::takeInstructionBudget(int32_t leave) {
+    std::size_t n = state.cycle_budget > leave ? static_cast<std::size_t>(state.cycle_budget - leave) : 0;
+    state.cycle_budget -= static_cast<int32_t>(n);
+    return n;
+}
+
+std::size_t Chip8Core::skipIdle(std::size_t n) {
+    // One instruction per iteration's worth of budget, as from takeInstructionBudget()
+    if (!idle_skipping || tracer || debugger || n < 2)
+        return 0;
+
+    std::array<uint16_t, MAX_IDLE_LOOP> addresses;
+    uint32_t cost;
+    bool settled;
+    std::size_t length = idleLoop(cost, addresses, settled);
+    if (!length)
+        return 0;
+
+    // Typically the first iteration of a frame reads the timer just ticked;
+    // run it, and the ones after it all repeat it
+    std::size_t ran = 0;
+    if (!settled) {
+        if (n <= length)
+            return 0;
+        step(length);
+        ran = length;
+        length = idleLoop(cost, addresses, settled);
+        if (!length || !settled)
+            return ran;
+    }
+
+    // The last, possibly partial, iteration is left to the caller so PC ends
+    // where running every instruction would have left it
+    const std::size_t iterations = (n - ran - 1) / length;
+    accountIdle(iterations, length, addresses);
+    return ran + iterations * length;
+}
+
+std::size_t Chip8Core::idleLoop(uint32_t& cost, std::array<uint16_t, MAX_IDLE_LOOP>& addresses, bool& settled) const {
+    // Run one iteration on copies of the registers; only instructions that
+    // neither write memory nor draw are followed. If PC comes back with V and
+    // I as they were, every further iteration does exactly the same.
+    settled = false;
+    std::array<uint8_t, 16> v = state.V;
+    uint16_t i_register = state.I;
+    uint16_t pc = state.PC;
+    const bool superchip_ops = active_variant != Variant::Chip8;
+    const bool xochip_ops = active_variant == Variant::XoChip;
+
+    bool any_key = false;
+    for (bool pressed : state.keypad)
+        any_key |= pressed;
+
+    auto skipIf = [&](bool condition) {
+        if (!condition)
+            return;
+        const uint16_t next = pc & 0xFFF;
+        pc += xochip_ops && state.RAM[next] == 0xF0 && state.RAM[(next + 1) & 0xFFF] == 0x00 ? 4 : 2;
+    };
+
+    cost = 0;
+    for (std::size_t length = 1; length <= MAX_IDLE_LOOP; length++) {
+        const uint16_t address = pc & 0xFFF;
+        const uint16_t instruction = state.RAM[address] << 8 | state.RAM[(address + 1) & 0xFFF];
+        const uint8_t x = (instruction & 0x0F00) >> 8;
+        const uint8_t y = (instruction & 0x00F0) >> 4;
+        const uint8_t kk = instruction & 0x00FF;
+        addresses[length - 1] = address;
+        cost += cycle_costs ? (*cycle_costs)[profile::opcodeClass(instruction)] : 1;
+        pc += 2;
+
+        switch (instruction >> 12)
+        {
+        case 0x0:
+            // 00FD stays on itself
+            if (!superchip_ops || instruction != 0x00FD)
+                return 0;
+            pc -= 2;
+            break;
+        case 0x1: pc = instruction & 0x0FFF; break;
+        case 0x3: skipIf(v[x] == kk); break;
+        case 0x4: skipIf(v[x] != kk); break;
+        case 0x5:
+            if (xochip_ops && (instruction & 0x000F) != 0)
+                return 0;
+            skipIf(v[x] == v[y]);
+            break;
+        case 0x6: v[x] = kk; break;
+        case 0x9: skipIf(v[x] != v[y]); break;
+        case 0xA: i_register = instruction & 0x0FFF; break;
+        case 0xE:
+            if (kk == 0x9E) skipIf(state.keypad[v[x] & 0xF]);
+            else if (kk == 0xA1) skipIf(!state.keypad[v[x] & 0xF]);
+            else return 0;
+            break;
+        case 0xF:
+            if (kk == 0x07) {
+                v[x] = state.delay_timer;
+            } else if (kk == 0x0A && any_key == state.waiting_for_key_release) {
+                // Fx0A before any key is down, or while one is still held
+                pc -= 2;
+            } else {
+                return 0;
+            }
+            break;
+        default:
+            return 0;
+        }
+
+        if (pc == state.PC) {
+            settled = v == state.V && i_register == state.I;
+            return length;
+        }
+    }
+    return 0;
+}
+
+void Chip8Core::accountIdle(std::size_t iterations, std::size_t length, const std::array<uint16_t, MAX_IDLE_LOOP>& addresses) {
+    state.instruction_count += iterations * length;
+    idle_instructions += iterations * length;
+    (void)addresses;
+    CHIP8_PROFILE_ONLY(for (std::size_t k = 0; k < length; k++) profile_counters.pc_heat[addresses[k]] += iterations;)
+}
+
+void Chip8Core::endFrame() {
+    if (state.cycle_budget > 0)
+        state.cycle_budget = 0;
+    tickTimers();
+    if (tracer)
+        tracer->frame();
+}
+
+void Chip8Core::setVariant(Variant variant) {
+    if (variant == active_variant)
+        return;
+
+    active_variant = variant;
+    switch (variant)
+    {
+    case Variant::SuperChip: undecoded = &op_decode<variant::SuperChip>; break;
+    case Variant::XoChip: undecoded = &op_decode<variant::XoChip>; break;
+    case Variant::Vip: undecoded = &op_decode<variant::Vip>; break;
+    default: undecoded = &op_decode<variant::Chip8>; break;
+    }
+    // Handlers and translated blocks of the previous variant are stale
+    invalidateDecodeCache();
+    code_write_lo = 0;
+    code_write_hi = static_cast<uint16_t>(state.RAM.size());
+}
+
+void Chip8Core::setCycleCosts(const CycleCosts *costs) {
+    cycle_costs = costs;
+    // Costs are stored in the decoded entries
+    invalidateDecodeCache();
+}
+
+void Chip8Core::tickTimers() {
+    if (state.delay_timer > 0)
+        state.delay_timer--;
+
+    if (state.sound_timer > 0)
+        state.sound_timer--;
+
+    state.frame_count++;
+}
+
+void Chip8Core::writeProfile(std::ostream& out) const {
+#ifdef CHIP8_PROFILE
+    profile::writeGuestReport(out, profile_counters, state.RAM);
+#else
+    out << "Built without CHIP8_PROFILE: no opcode counters or PC heatmap\n";
+#endif
+}
+
+uint64_t Chip8Core::consumeDirtyRows() {
+    uint64_t rows = dirty_rows;
+    dirty_rows = 0;
+    return rows;
+}
+
+void Chip8Core::executeInstruction(uint16_t instruction) {
+    executeInstruction(instruction, state.PC);
+}
+
+void Chip8Core::executeInstruction(uint16_t instruction, uint16_t address) {
+    // Decoded on every call; step() goes through decode_cache instead
+    const DecodedOp op = decode(instruction, active_variant);
+    direct_execute = true;
+    direct_pc = address & 0xFFF;
+    if (tracer) {
+        const std::array<uint8_t, 16> v = state.V;
+        const uint16_t i_register = state.I;
+        op.handler(*this, op);
+        tracer->record(direct_pc, instruction, v, i_register, state.V, state.I);
+    } else {
+        op.handler(*this, op);
+    }
+    direct_execute = false;
+}
+
+void Chip8Core::callStackFault(const char *message) {
+    // A runaway ROM faults on every instruction from then on, so only the
+    // first is logged
+    if (call_stack_faults++ == 0) {
+        const uint16_t pc = direct_execute ? direct_pc : (state.PC - 2) & 0xFFF;
+        std::fprintf(stderr, "%s at 0x%03X (further call stack faults are counted, not logged)\n", message, pc);
+    }
+}
+
+template<class V>
+void Chip8Core::skipNext() {
+    if constexpr (V::XOCHIP_OPS) {
+        // F000 nnnn is four bytes long and skipped as a whole
+        const uint16_t pc = state.PC & 0xFFF;
+        state.PC += state.RAM[pc] == 0xF0 && state.RAM[(pc + 1) & 0xFFF] == 0x00 ? 4 : 2;
+    } else {
+        state.PC += 2;
+    }
+}
+
+template<bool WRAP, int WIDTH, int HEIGHT, int BYTES>
+bool Chip8Core::drawPlane(display_plane_t& plane, uint8_t vx, uint8_t vy, uint16_t address, uint8_t rows) {
+    constexpr int WORDS = WIDTH / 64;
+    const int start_x = vx % WIDTH;
+    const int start_y = vy % HEIGHT;
+    const int word = start_x / 64;
+    const int shift = start_x % 64;
+    bool collision = false;
+
+    for (int i = 0; i < rows; i++) {
+        int y = start_y + i;
+        if (WRAP)
+            y %= HEIGHT;
+        else if (y >= HEIGHT)
+            break;
+
+        const std::size_t source = address + i * BYTES;
+        if (source + BYTES > state.RAM.size()) {
+            std::fprintf(stderr, "Dxyn: RAM read out of bounds at I + %u (0x%03zX)\n", static_cast<unsigned>(source - state.I), source);
+            break;
+        }
+
+        // Align the sprite with the left edge, then shift it to start_x. Pixels
+        // past the end of the word continue in the next one; past the right
+        // edge of the screen they fall off (clipping) or come back on the left.
+        uint64_t bits = static_cast<uint64_t>(state.RAM[source]) << 56;
+        if (BYTES == 2)
+            bits |= static_cast<uint64_t>(state.RAM[source + 1]) << 48;
+
+        display_row_t sprite_row{};
+        sprite_row[word] = bits >> shift;
+        const uint64_t spill = shift ? bits << (64 - shift) : 0;
+        if (word + 1 < WORDS)
+            sprite_row[word + 1] = spill;
+        else if (WRAP)
+            sprite_row[0] |= spill;
+
+        display_row_t& row = plane[y];
+        uint64_t drawn = 0;
+        for (int w = 0; w < WORDS; w++) {
+            collision |= (row[w] & sprite_row[w]) != 0;
+            row[w] ^= sprite_row[w];
+            drawn |= sprite_row[w];
+        }
+
+        if (drawn)
+            dirty_rows |= uint64_t(1) << y;
+    }
+
+    return collision;
+}
+
+template<class V, int BYTES>
+void Chip8Core::drawSprite(uint8_t x, uint8_t y, uint8_t rows) {
+    constexpr bool WRAP = V::QUIRKS.wrap_sprites;
+    const uint8_t vx = state.V[x];
+    const uint8_t vy = state.V[y];
+    bool collision = false;
+
+    if constexpr (!V::SUPERCHIP_OPS) {
+        collision = drawPlane<WRAP, WINDOW_WIDTH, WINDOW_HEIGHT, BYTES>(state.display[0], vx, vy, state.I, rows);
+    } else {
+        // The resolution is guest state, the one thing left to test per sprite.
+        // With both XO-CHIP planes selected the second sprite follows the first.
+        uint16_t address = state.I;
+        const uint8_t planes = V::XOCHIP_OPS ? state.planes : 1;
+        for (int p = 0; p < 2; p++) {
+            if (!((planes >> p) & 1))
+                continue;
+
+            if (state.hires)
+                collision |= drawPlane<WRAP, HIRES_WIDTH, HIRES_HEIGHT, BYTES>(state.display[p], vx, vy, address, rows);
+            else
+                collision |= drawPlane<WRAP, WINDOW_WIDTH, WINDOW_HEIGHT, BYTES>(state.display[p], vx, vy, address, rows);
+            address += rows * BYTES;
+        }
+    }
+
+    state.V[0xF] = collision;
+}
+
+void Chip8Core::scrollPlanes(int down, int right) {
+    const int height = state.hires ? HIRES_HEIGHT : WINDOW_HEIGHT;
+
+    for (int p = 0; p < 2; p++) {
+        if (!((state.planes >> p) & 1))
+            continue;
+
+        display_plane_t& plane = state.display[p];
+        if (down > 0) {
+            for (int y = height - 1; y >= 0; y--)
+                plane[y] = y >= down ? plane[y - down] : display_row_t{};
+        } else if (down < 0) {
+            for (int y = 0; y < height; y++)
+                plane[y] = y - down < height ? plane[y - down] : display_row_t{};
+        }
+
+        for (int y = 0; y < height && right; y++) {
+            display_row_t& row = plane[y];
+            if (!state.hires)
+                row[0] = right > 0 ? row[0] >> right : row[0] << -right;
+            else if (right > 0)
+                row = {row[0] >> right, (row[1] >> right) | (row[0] << (64 - right))};
+            else
+                row = {(row[0] << -right) | (row[1] >> (64 + right)), row[1] << -right};
+        }
+    }
+
+    dirty_rows = ALL_ROWS;
+}
+
+template<class V>
+void Chip8Core::instr_00E0() {
+    if constexpr (V::XOCHIP_OPS) {
+        for (int p = 0; p < 2; p++) {
+            if ((state.planes >> p) & 1)
+                state.display[p] = display_plane_t{};
+        }
+    } else if constexpr (V::SUPERCHIP_OPS) {
+        state.display[0] = display_plane_t{};
+    } else {
+        // Nothing outside the 64x32 corner of the first plane is ever drawn
+        for (int y = 0; y < WINDOW_HEIGHT; y++)
+            state.display[0][y][0] = 0;
+    }
+    dirty_rows = ALL_ROWS;
+}
+
+void Chip8Core::instr_00EE() {
+    if (state.SP == 0) {
+        callStackFault("00EE: Return with an empty call stack");
+        return;
+    }
+
+    state.PC = state.stack[--state.SP];
+}
+
+void Chip8Core::instr_0nnn(uint16_t nnn) {
+    // Do not implement
+    (void)nnn;
+}
+
+void Chip8Core::instr_1nnn(uint16_t nnn) {
+    state.PC = nnn;
+}
+
+void Chip8Core::instr_2nnn(uint16_t nnn) {
+    if (state.SP == STACK_SIZE) {
+        callStackFault("2nnn: Call stack overflow");
+        return;
+    }
+
+    state.stack[state.SP++] = state.PC;
+    state.PC = nnn;
+}
+
+template<class V>
+void Chip8Core::instr_3xkk(uint8_t x, uint8_t kk) {
+    if (state.V[x] == kk)
+        skipNext<V>();
+}
+
+template<class V>
+void Chip8Core::instr_4xkk(uint8_t x, uint8_t kk) {
+    if (state.V[x] != kk)
+        skipNext<V>();
+}
+
+template<class V>
+void Chip8Core::instr_5xy0(uint8_t x, uint8_t y) {
+    if (state.V[x] == state.V[y])
+        skipNext<V>();
+}
+
+void Chip8Core::instr_6xkk(uint8_t x, uint8_t kk) {
+    state.V[x] = kk;
+}
+
+void Chip8Core::instr_7xkk(uint8_t x, uint8_t kk) {
+    state.V[x] += kk;
+}
+
+void Chip8Core::instr_8xy0(uint8_t x, uint8_t y) {
+    state.V[x] = state.V[y];
+}
+
+template<class V>
+void Chip8Core::instr_8xy1(uint8_t x, uint8_t y) {
+    state.V[x] |= state.V[y];
+    if constexpr (V::QUIRKS.logic_resets_vf)
+        state.V[0xF] = 0;
+}
+
+template<class V>
+void Chip8Core::instr_8xy2(uint8_t x, uint8_t y) {
+    state.V[x] &= state.V[y];
+    if constexpr (V::QUIRKS.logic_resets_vf)
+        state.V[0xF] = 0;
+}
+
+template<class V>
+void Chip8Core::instr_8xy3(uint8_t x, uint8_t y) {
+    state.V[x] ^= state.V[y];
+    if constexpr (V::QUIRKS.logic_resets_vf)
+        state.V[0xF] = 0;
+}
+
+void Chip8Core::instr_8xy4(uint8_t x, uint8_t y) {
+    uint16_t result = state.V[x] + state.V[y];
+    state.V[x] = result & 0x00FF;
+    state.V[0xF] = result > 0xFF;
+}
+
+void Chip8Core::instr_8xy5(uint8_t x, uint8_t y) {
+    uint8_t bit = state.V[x] >= state.V[y]; 
+    state.V[x] -= state.V[y];
+    state.V[0xF] = bit;
+}
+
+template<class V>
+void Chip8Core::instr_8xy6(uint8_t x, uint8_t y) {
+    const uint8_t source = V::QUIRKS.shift_reads_vy ? state.V[y] : state.V[x];
+    state.V[x] = source >> 1;
+    state.V[0xF] = source & 0x1;
+}
+
+void Chip8Core::instr_8xy7(uint8_t x, uint8_t y) {
+    uint8_t bit = state.V[y] >= state.V[x];
+    state.V[x] = state.V[y] - state.V[x];
+    state.V[0xF] = bit;
+}
+
+template<class V>
+void Chip8Core::instr_8xyE(uint8_t x, uint8_t y) {
+    const uint8_t source = V::QUIRKS.shift_reads_vy ? state.V[y] : state.V[x];
+    state.V[x] = source << 1;
+    state.V[0xF] = (source & 0x80) >> 7;
+}
+
+template<class V>
+void Chip8Core::instr_9xy0(uint8_t x, uint8_t y) {
+    if (state.V[x] != state.V[y])
+        skipNext<V>();
+}
+
+void Chip8Core::instr_Annn(uint16_t nnn) {
+    state.I = nnn;
+}
+
+template<class V>
+void Chip8Core::instr_Bnnn(uint16_t nnn) {
+    // SUPER-CHIP reads the top nibble as a register too: Bxnn jumps to xnn + Vx
+    state.PC = nnn + state.V[V::QUIRKS.jump_adds_vx ? nnn >> 8 : 0];
+}
+
+void Chip8Core::instr_Cxkk(uint8_t x, uint8_t kk) {
+    state.V[x] = nextRandom() & kk;
+} 
+
+template<class V>
+void Chip8Core::instr_Dxyn(uint8_t x, uint8_t y, uint8_t n) {
+    drawSprite<V, 1>(x, y, n);
+}
+
+template<class V>
+void Chip8Core::instr_Dxy0(uint8_t x, uint8_t y) {
+    drawSprite<V, 2>(x, y, 16);
+}
+
+template<class V>
+void Chip8Core::instr_Ex9E(uint8_t x) {
+    if (state.keypad[state.V[x] & 0xF]) {
+        skipNext<V>();
+    }
+}
+
+template<class V>
+void Chip8Core::instr_ExA1(uint8_t x) {
+    if (!state.keypad[state.V[x] & 0xF]) {
+        skipNext<V>();
+    }
+}
+
+void Chip8Core::instr_Fx07(uint8_t x) {
+    state.V[x] = state.delay_timer;
+}
+
+void Chip8Core::instr_Fx0A(uint8_t x) {
+    if (!state.waiting_for_key_release) {
+        for (uint8_t i = 0; i < 16; i++) {
+            if (state.keypad[i & 0xF]) {
+                state.V[x] = i;
+                state.waiting_for_key_release = true;
+                state.PC -= 2;
+                return;
+            }
+        }
+        state.PC -= 2;
+    } else {
+        bool all_released = true;
+        for (uint8_t i = 0; i < 16; i++) {
+            if (state.keypad[i & 0xF]) {
+                all_released = false;
+                break;
+            }
+        }
+
+        if (all_released) {
+            state.waiting_for_key_release = false;
+        } else {
+            state.PC -= 2;
+        }
+    }
+}
+
+void Chip8Core::instr_Fx15(uint8_t x) {
+    state.delay_timer = state.V[x];
+}
+
+void Chip8Core::instr_Fx18(uint8_t x) {
+    state.sound_timer = state.V[x];
+}
+
+void Chip8Core::instr_Fx1E(uint8_t x) {
+    state.I += state.V[x];
+}
+
+void Chip8Core::instr_Fx29(uint8_t x) {
+    state.I = state.V[x] * 5;
+}
+
+void Chip8Core::instr_Fx33(uint8_t x) {
+    if (static_cast<std::size_t>(state.I) + 2 >= state.RAM.size()) {
+        std::fprintf(stderr, "Fx33: Memory write would exceed RAM bounds! (I = 0x%03X)\n", state.I);
+        return;
+    }
+
+    invalidateDecodeCache(state.I, 3);
+    state.RAM[state.I] = state.V[x] / 100;
+    state.RAM[state.I + 1] = (state.V[x] / 10) % 10;
+    state.RAM[state.I + 2] = state.V[x] % 10;
+}
+
+template<class V>
+void Chip8Core::instr_Fx55(uint8_t x) {
+    invalidateDecodeCache(state.I, x + 1);
+    for (uint8_t i = 0; i <= x && state.I + i < state.RAM.size(); i++)
+        state.RAM[state.I + i] = state.V[i];
+
+    if constexpr (V::QUIRKS.load_store_moves_i)
+        state.I += x + 1;
+}
+
+template<class V>
+void Chip8Core::instr_Fx65(uint8_t x) {
+    for (uint8_t i = 0; i <= x && state.I + i < state.RAM.size(); i++)
+        state.V[i] = state.RAM[state.I + i];
+
+    if constexpr (V::QUIRKS.load_store_moves_i)
+        state.I += x + 1;
+}
+
+void Chip8Core::instr_F002() {
+    for (std::size_t i = 0; i < state.audio_pattern.size(); i++)
+        state.audio_pattern[i] = state.RAM[(state.I + i) & 0xFFF];
+    state.audio_pattern_loaded = true;
+}
+
+void Chip8Core::instr_Fx3A(uint8_t x) {
+    state.pitch = state.V[x];
+}
+
+void Chip8Core::instr_00Cn(uint8_t n) {
+    scrollPlanes(n, 0);
+}
+
+void Chip8Core::instr_00FB() {
+    scrollPlanes(0, 4);
+}
+
+void Chip8Core::instr_00FC() {
+    scrollPlanes(0, -4);
+}
+
+void Chip8Core::instr_00FD() {
+    // Exit: stay on this instruction
+    state.PC -= 2;
+}
+
+void Chip8Core::instr_00FE() {
+    state.hires = false;
+    state.display = display_t{};
+    dirty_rows = ALL_ROWS;
+}
+
+void Chip8Core::instr_00FF() {
+    state.hires = true;
+    state.display = display_t{};
+    dirty_rows = ALL_ROWS;
+}
+
+void Chip8Core::instr_Fx30(uint8_t x) {
+    state.I = BIG_FONT_ADDRESS + (state.V[x] & 0xF) * 10;
+}
+
+void Chip8Core::instr_Fx75(uint8_t x) {
+    for (uint8_t i = 0; i <= x; i++)
+        state.rpl_flags[i] = state.V[i];
+}
+
+void Chip8Core::instr_Fx85(uint8_t x) {
+    for (uint8_t i = 0; i <= x; i++)
+        state.V[i] = state.rpl_flags[i];
+}
+
+void Chip8Core::instr_00Dn(uint8_t n) {
+    scrollPlanes(-n, 0);
+}
+
+void Chip8Core::instr_5xy2(uint8_t x, uint8_t y) {
+    // Vx to Vy in either order, I unchanged
+    const int count = (x <= y ? y - x : x - y) + 1;
+    const int direction = x <= y ? 1 : -1;
+    const int room = static_cast<int>(state.RAM.size()) - state.I;
+    invalidateDecodeCache(state.I, count);
+    for (int i = 0; i < count && i < room; i++)
+        state.RAM[state.I + i] = state.V[x + i * direction];
+}
+
+void Chip8Core::instr_5xy3(uint8_t x, uint8_t y) {
+    const int count = (x <= y ? y - x : x - y) + 1;
+    const int direction = x <= y ? 1 : -1;
+    const int room = static_cast<int>(state.RAM.size()) - state.I;
+    for (int i = 0; i < count && i < room; i++)
+        state.V[x + i * direction] = state.RAM[state.I + i];
+}
+
+void Chip8Core::instr_F000() {
+    // The address is the word after the instruction. XO-CHIP has 64 KiB of
+    // RAM and this core 4 KiB, so only its low 12 bits are kept.
+    const uint16_t pc = state.PC & 0xFFF;
+    state.I = (state.RAM[pc] << 8 | state.RAM[(pc + 1) & 0xFFF]) & 0xFFF;
+    state.PC += 2;
+}
+
+void Chip8Core::instr_Fn01(uint8_t n) {
+    state.planes = n & 0x3;
+}
+
+// decode.cpp installs the handlers of every variant
+#define CHIP8_VARIANT_HANDLERS(V) \
+    template void Chip8Core::instr_00E0<V>(); \
+    template void Chip8Core::instr_3xkk<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_4xkk<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_5xy0<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_8xy1<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_8xy2<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_8xy3<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_8xy6<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_8xyE<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_9xy0<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_Bnnn<V>(uint16_t); \
+    template void Chip8Core::instr_Dxyn<V>(uint8_t, uint8_t, uint8_t); \
+    template void Chip8Core::instr_Dxy0<V>(uint8_t, uint8_t); \
+    template void Chip8Core::instr_Ex9E<V>(uint8_t); \
+    template void Chip8Core::instr_ExA1<V>(uint8_t); \
+    template void Chip8Core::instr_Fx55<V>(uint8_t); \
+    template void Chip8Core::instr_Fx65<V>(uint8_t);
+
+CHIP8_VARIANT_HANDLERS(variant::Chip8)
+CHIP8_VARIANT_HANDLERS(variant::SuperChip)
+CHIP8_VARIANT_HANDLERS(variant::XoChip)
+CHIP8_VARIANT_HANDLERS(variant::Vip)
+
+#undef CHIP8_VARIANT_HANDLERS
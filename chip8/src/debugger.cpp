@@ -0,0 +1,152 @@
+#include "chip8/debugger.hpp"
+
+#include "chip8/core.hpp"
+
+void Debugger::setBreakpoint(uint16_t address, bool enabled) {
+    assign(breakpoints, address, enabled);
+    update();
+}
+
+void Debugger::watch(uint16_t address, std::size_t length, uint8_t access) {
+    for (std::size_t k = 0; k < length && address + k < reads.size() * 64; k++) {
+        assign(reads, static_cast<uint16_t>(address + k), access & READ);
+        assign(writes, static_cast<uint16_t>(address + k), access & WRITE);
+    }
+    update();
+}
+
+uint8_t Debugger::getWatch(uint16_t address) const {
+    return (test(reads, address) ? READ : 0) | (test(writes, address) ? WRITE : 0);
+}
+
+void Debugger::clear() {
+    breakpoints = {};
+    reads = {};
+    writes = {};
+    update();
+}
+
+void Debugger::resume(const Chip8Core& core) {
+    // If nothing checks the address, there is nothing to let through
+    resume_pc = core.getState().PC & 0xFFF;
+    resuming = checks(resume_pc);
+    stop_reason = Stop::None;
+}
+
+bool Debugger::stop(const Chip8Core& core, uint16_t pc) {
+    if (resuming) {
+        resuming = false;
+        if (pc == resume_pc)
+            return false;
+    }
+
+    if (test(breakpoints, pc)) {
+        stop_reason = Stop::Breakpoint;
+        stop_pc = pc;
+        stop_address = pc;
+        return true;
+    }
+    if (!any_watch)
+        return false;
+
+    uint16_t address;
+    std::size_t length;
+    bool write, wraps;
+    if (!dataAccess(core, pc, address, length, write, wraps))
+        return false;
+
+    const bitmap_t& watched = write ? writes : reads;
+    for (std::size_t k = 0; k < length; k++) {
+        std::size_t a = address + k;
+        if (a >= core.getRam().size()) {
+            if (!wraps)
+                break;
+            a &= 0xFFF;
+        }
+        if (test(watched, static_cast<uint16_t>(a))) {
+            stop_reason = write ? Stop::Write : Stop::Read;
+            stop_pc = pc;
+            stop_address = static_cast<uint16_t>(a);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Debugger::dataAccess(const Chip8Core& core, uint16_t pc, uint16_t& address, std::size_t& length, bool& write, bool& wraps) {
+    const Chip8Core::State& state = core.getState();
+    const uint16_t instruction = state.RAM[pc & 0xFFF] << 8 | state.RAM[(pc + 1) & 0xFFF];
+    const uint8_t x = (instruction & 0x0F00) >> 8;
+    const uint8_t y = (instruction & 0x00F0) >> 4;
+    const uint8_t n = instruction & 0x000F;
+    const uint8_t kk = instruction & 0x00FF;
+    const bool superchip_ops = core.getVariant() != Variant::Chip8;
+    const bool xochip_ops = core.getVariant() == Variant::XoChip;
+
+    address = state.I;
+    write = false;
+    wraps = false;
+
+    switch (instruction >> 12)
+    {
+    case 0x5:
+        // XO-CHIP 5xy2 saves and 5xy3 loads Vx to Vy
+        if (!xochip_ops || (n != 0x2 && n != 0x3))
+            return false;
+        length = (x <= y ? y - x : x - y) + 1;
+        write = n == 0x2;
+        return true;
+    case 0xD: {
+        // Dxy0 is a 16x16 sprite; with both XO-CHIP planes selected the
+        // second plane's sprite follows the first
+        length = superchip_ops && n == 0 ? 32 : n;
+        if (xochip_ops && state.planes == 3)
+            length *= 2;
+        else if (xochip_ops && state.planes == 0)
+            length = 0;
+        return length > 0;
+    }
+    case 0xF:
+        switch (kk)
+        {
+        case 0x02:
+            if (!xochip_ops || x != 0)
+                return false;
+            length = state.audio_pattern.size();
+            wraps = true;
+            return true;
+        case 0x33: length = 3; write = true; return true;
+        case 0x55: length = x + 1; write = true; return true;
+        case 0x65: length = x + 1; return true;
+        default: return false;
+        }
+    default:
+        return false;
+    }
+}
+
+void Debugger::assign(bitmap_t& bits, uint16_t address, bool value) {
+    address &= 0xFFF;
+    const uint64_t bit = uint64_t(1) << (address & 63);
+    if (value)
+        bits[address >> 6] |= bit;
+    else
+        bits[address >> 6] &= ~bit;
+}
+
+bool Debugger::any(const bitmap_t& bits) {
+    for (uint64_t word : bits) {
+        if (word)
+            return true;
+    }
+    return false;
+}
+
+void Debugger::update() {
+    any_breakpoint = any(breakpoints);
+    any_watch = any(reads) || any(writes);
+    if (any_watch)
+        check_bits.fill(~uint64_t(0));
+    else
+        check_bits = breakpoints;
+}
@@ -0,0 +1,219 @@
+#include "chip8/core.hpp"
+
+#include <algorithm>
+
+// Predecode layer: each instruction word is turned into a DecodedOp once and
+// cached per address, so the hot loop is a single indirect call per instruction.
+// decodeFor<V> is instantiated per variant and only ever installs handlers
+// built for that variant, so its quirks and resolution limits are constants
+// inside them and the loop itself never checks which variant is running.
+
+template<void (Chip8Core::*fn)()>
+void Chip8Core::op_none(Chip8Core& c, const DecodedOp&) {
+    (c.*fn)();
+}
+
+template<void (Chip8Core::*fn)(uint8_t)>
+void Chip8Core::op_n(Chip8Core& c, const DecodedOp& op) {
+    (c.*fn)(op.n);
+}
+
+template<void (Chip8Core::*fn)(uint16_t)>
+void Chip8Core::op_nnn(Chip8Core& c, const DecodedOp& op) {
+    (c.*fn)(op.nnn);
+}
+
+template<void (Chip8Core::*fn)(uint8_t)>
+void Chip8Core::op_x(Chip8Core& c, const DecodedOp& op) {
+    (c.*fn)(op.x);
+}
+
+template<void (Chip8Core::*fn)(uint8_t, uint8_t)>
+void Chip8Core::op_xkk(Chip8Core& c, const DecodedOp& op) {
+    (c.*fn)(op.x, op.kk);
+}
+
+template<void (Chip8Core::*fn)(uint8_t, uint8_t)>
+void Chip8Core::op_xy(Chip8Core& c, const DecodedOp& op) {
+    (c.*fn)(op.x, op.y);
+}
+
+template<void (Chip8Core::*fn)(uint8_t, uint8_t, uint8_t)>
+void Chip8Core::op_xyn(Chip8Core& c, const DecodedOp& op) {
+    (c.*fn)(op.x, op.y, op.n);
+}
+
+void Chip8Core::op_nop(Chip8Core&, const DecodedOp&) {
+}
+
+template<class V>
+void Chip8Core::op_decode(Chip8Core& c, const DecodedOp&) {
+    // PC has already been advanced past this instruction
+    uint16_t address = (c.state.PC - 2) & 0xFFF;
+    uint16_t instruction = c.state.RAM[address] << 8 | c.state.RAM[(address + 1) & 0xFFF];
+
+    DecodedOp& entry = c.decode_cache[address];
+    entry = decodeFor<V>(instruction);
+    if (c.cycle_costs)
+        entry.cycles = (*c.cycle_costs)[profile::opcodeClass(instruction)];
+    entry.handler(c, entry);
+}
+
+Chip8Core::DecodedOp Chip8Core::decode(uint16_t instruction, Variant variant) {
+    switch (variant)
+    {
+    case Variant::SuperChip: return decodeFor<variant::SuperChip>(instruction);
+    case Variant::XoChip: return decodeFor<variant::XoChip>(instruction);
+    case Variant::Vip: return decodeFor<variant::Vip>(instruction);
+    default: return decodeFor<variant::Chip8>(instruction);
+    }
+}
+
+template<class V>
+Chip8Core::DecodedOp Chip8Core::decodeFor(uint16_t instruction) {
+    DecodedOp op;
+    op.nnn = instruction & 0x0FFF;
+    op.n = instruction & 0x000F;
+    op.kk = instruction & 0x00FF;
+    op.x = (instruction & 0x0F00) >> 8;
+    op.y = (instruction & 0x00F0) >> 4;
+    op.cycles = 1;
+    op.handler = &op_nop;
+
+    switch (instruction >> 12)
+    {
+    case 0x0:
+        if (instruction == 0x00E0) op.handler = &op_none<&Chip8Core::instr_00E0<V>>;
+        else if (instruction == 0x00EE) op.handler = &op_none<&Chip8Core::instr_00EE>;
+        if constexpr (V::SUPERCHIP_OPS) {
+            if ((instruction & 0xFFF0) == 0x00C0) op.handler = &op_n<&Chip8Core::instr_00Cn>;
+            else if (instruction == 0x00FB) op.handler = &op_none<&Chip8Core::instr_00FB>;
+            else if (instruction == 0x00FC) op.handler = &op_none<&Chip8Core::instr_00FC>;
+            else if (instruction == 0x00FD) op.handler = &op_none<&Chip8Core::instr_00FD>;
+            else if (instruction == 0x00FE) op.handler = &op_none<&Chip8Core::instr_00FE>;
+            else if (instruction == 0x00FF) op.handler = &op_none<&Chip8Core::instr_00FF>;
+        }
+        if constexpr (V::XOCHIP_OPS) {
+            if ((instruction & 0xFFF0) == 0x00D0) op.handler = &op_n<&Chip8Core::instr_00Dn>;
+        }
+        break;
+    case 0x1: op.handler = &op_nnn<&Chip8Core::instr_1nnn>; break;
+    case 0x2: op.handler = &op_nnn<&Chip8Core::instr_2nnn>; break;
+    case 0x3: op.handler = &op_xkk<&Chip8Core::instr_3xkk<V>>; break;
+    case 0x4: op.handler = &op_xkk<&Chip8Core::instr_4xkk<V>>; break;
+    case 0x5:
+        if constexpr (V::XOCHIP_OPS) {
+            if (op.n == 0x0) op.handler = &op_xy<&Chip8Core::instr_5xy0<V>>;
+            else if (op.n == 0x2) op.handler = &op_xy<&Chip8Core::instr_5xy2>;
+            else if (op.n == 0x3) op.handler = &op_xy<&Chip8Core::instr_5xy3>;
+        } else {
+            op.handler = &op_xy<&Chip8Core::instr_5xy0<V>>;
+        }
+        break;
+    case 0x6: op.handler = &op_xkk<&Chip8Core::instr_6xkk>; break;
+    case 0x7: op.handler = &op_xkk<&Chip8Core::instr_7xkk>; break;
+    case 0x8:
+        switch (op.n)
+        {
+        case 0x0: op.handler = &op_xy<&Chip8Core::instr_8xy0>; break;
+        case 0x1: op.handler = &op_xy<&Chip8Core::instr_8xy1<V>>; break;
+        case 0x2: op.handler = &op_xy<&Chip8Core::instr_8xy2<V>>; break;
+        case 0x3: op.handler = &op_xy<&Chip8Core::instr_8xy3<V>>; break;
+        case 0x4: op.handler = &op_xy<&Chip8Core::instr_8xy4>; break;
+        case 0x5: op.handler = &op_xy<&Chip8Core::instr_8xy5>; break;
+        case 0x6: op.handler = &op_xy<&Chip8Core::instr_8xy6<V>>; break;
+        case 0x7: op.handler = &op_xy<&Chip8Core::instr_8xy7>; break;
+        case 0xE: op.handler = &op_xy<&Chip8Core::instr_8xyE<V>>; break;
+        default: break;
+        }
+        break;
+    case 0x9: op.handler = &op_xy<&Chip8Core::instr_9xy0<V>>; break;
+    case 0xA: op.handler = &op_nnn<&Chip8Core::instr_Annn>; break;
+    case 0xB: op.handler = &op_nnn<&Chip8Core::instr_Bnnn<V>>; break;
+    case 0xC: op.handler = &op_xkk<&Chip8Core::instr_Cxkk>; break;
+    case 0xD:
+        if (V::SUPERCHIP_OPS && op.n == 0) op.handler = &op_xy<&Chip8Core::instr_Dxy0<V>>;
+        else op.handler = &op_xyn<&Chip8Core::instr_Dxyn<V>>;
+        break;
+    case 0xE:
+        switch (op.kk)
+        {
+        case 0x9E: op.handler = &op_x<&Chip8Core::instr_Ex9E<V>>; break;
+        case 0xA1: op.handler = &op_x<&Chip8Core::instr_ExA1<V>>; break;
+        default: break;
+        }
+        break;
+    case 0xF:
+        switch (op.kk)
+        {
+        case 0x07: op.handler = &op_x<&Chip8Core::instr_Fx07>; break;
+        case 0x0A: op.handler = &op_x<&Chip8Core::instr_Fx0A>; break;
+        case 0x15: op.handler = &op_x<&Chip8Core::instr_Fx15>; break;
+        case 0x18: op.handler = &op_x<&Chip8Core::instr_Fx18>; break;
+        case 0x1E: op.handler = &op_x<&Chip8Core::instr_Fx1E>; break;
+        case 0x29: op.handler = &op_x<&Chip8Core::instr_Fx29>; break;
+        case 0x33: op.handler = &op_x<&Chip8Core::instr_Fx33>; break;
+        case 0x55: op.handler = &op_x<&Chip8Core::instr_Fx55<V>>; break;
+        case 0x65: op.handler = &op_x<&Chip8Core::instr_Fx65<V>>; break;
+        default: break;
+        }
+        if constexpr (V::SUPERCHIP_OPS) {
+            switch (op.kk)
+            {
+            case 0x30: op.handler = &op_x<&Chip8Core::instr_Fx30>; break;
+            case 0x75: op.handler = &op_x<&Chip8Core::instr_Fx75>; break;
+            case 0x85: op.handler = &op_x<&Chip8Core::instr_Fx85>; break;
+            default: break;
+            }
+        }
+        if constexpr (V::XOCHIP_OPS) {
+            if (instruction == 0xF000) op.handler = &op_none<&Chip8Core::instr_F000>;
+            else if (instruction == 0xF002) op.handler = &op_none<&Chip8Core::instr_F002>;
+            else if (op.kk == 0x01) op.handler = &op_x<&Chip8Core::instr_Fn01>;
+            else if (op.kk == 0x3A) op.handler = &op_x<&Chip8Core::instr_Fx3A>;
+        }
+        break;
+    }
+
+    return op;
+}
+
+template void Chip8Core::op_decode<variant::Chip8>(Chip8Core&, const DecodedOp&);
+template void Chip8Core::op_decode<variant::SuperChip>(Chip8Core&, const DecodedOp&);
+template void Chip8Core::op_decode<variant::XoChip>(Chip8Core&, const DecodedOp&);
+template void Chip8Core::op_decode<variant::Vip>(Chip8Core&, const DecodedOp&);
+
+void Chip8Core::invalidateDecodeCache() {
+    DecodedOp entry{};
+    entry.handler = undecoded;
+    entry.cycles = 1;
+    decode_cache.fill(entry);
+}
+
+void Chip8Core::invalidateDecodeCache(uint16_t address, std::size_t length) {
+    // An instruction starting one byte before the write also overlaps it
+    std::size_t first = address > 0 ? address - 1 : 0;
+    std::size_t last = std::min<std::size_t>(address + length, decode_cache.size());
+    // Called before the write, so executions so far go to the old instructions
+    CHIP8_PROFILE_ONLY(profile_counters.fold(state.RAM, first, last);)
+    for (std::size_t a = first; a < last; a++)
+        decode_cache[a].handler = undecoded;
+
+    if (code_write_lo >= code_write_hi) {
+        code_write_lo = static_cast<uint16_t>(first);
+        code_write_hi = static_cast<uint16_t>(last);
+    } else {
+        code_write_lo = std::min<uint16_t>(code_write_lo, static_cast<uint16_t>(first));
+        code_write_hi = std::max<uint16_t>(code_write_hi, static_cast<uint16_t>(last));
+    }
+}
+
+bool Chip8Core::consumeCodeWrite(uint16_t& lo, uint16_t& hi) {
+    if (code_write_lo >= code_write_hi)
+        return false;
+
+    lo = code_write_lo;
+    hi = code_write_hi;
+    code_write_lo = code_write_hi = 0;
+    return true;
+}
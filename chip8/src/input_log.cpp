@@ -0,0 +1,196 @@
+#include "chip8/input_log.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+namespace {
+    template<typename T>
+    void writeLE(std::ofstream& out, T value) {
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+
+    template<typename T>
+    bool readLE(const std::vector<uint8_t>& data, std::size_t& pos, T& value) {
+        if (pos + sizeof(T) > data.size())
+            return false;
+        value = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            value |= static_cast<T>(data[pos++]) << (8 * i);
+        return true;
+    }
+
+    bool readVarint(const std::vector<uint8_t>& data, std::size_t& pos, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= data.size())
+                return false;
+            uint8_t byte = data[pos++];
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+}
+
+InputRecorder::~InputRecorder() {
+    if (out.is_open())
+        out.close();
+}
+
+bool InputRecorder::open(const char *path, const Chip8Core& core) {
+    out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open input log for writing: " << path << std::endl;
+        return false;
+    }
+
+    out.write(input_log::MAGIC, sizeof(input_log::MAGIC));
+    writeLE<uint16_t>(out, input_log::VERSION);
+    writeLE<uint64_t>(out, core.getSeed());
+    writeLE<uint32_t>(out, core.getInstructionsPerSecond());
+    writeLE<uint8_t>(out, core.hasCycleCosts() ? input_log::COSTS_VIP : input_log::COSTS_NONE);
+    writeLE<uint8_t>(out, static_cast<uint8_t>(core.getVariant()));
+
+    // Positions are absolute from power-on, so recording should start right after loadRom
+    last_frame = 0;
+    last_instruction = 0;
+    return true;
+}
+
+void InputRecorder::recordKey(const Chip8Core& core, uint8_t key, bool pressed) {
+    write(core, (pressed ? input_log::KEY_DOWN : input_log::KEY_UP) | (key & 0xF));
+}
+
+void InputRecorder::recordPause(const Chip8Core& core, bool paused) {
+    write(core, paused ? input_log::PAUSE_ON : input_log::PAUSE_OFF);
+}
+
+void InputRecorder::finish(const Chip8Core& core) {
+    if (!out.is_open())
+        return;
+
+    write(core, input_log::END);
+    out.close();
+}
+
+void InputRecorder::write(const Chip8Core& core, uint8_t code) {
+    if (!out.is_open())
+        return;
+
+    writeVarint(core.getFrameCount() - last_frame);
+    writeVarint(core.getInstructionCount() - last_instruction);
+    out.put(static_cast<char>(code));
+
+    last_frame = core.getFrameCount();
+    last_instruction = core.getInstructionCount();
+}
+
+void InputRecorder::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        out.put(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+}
+
+bool InputReplayer::open(const char *path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open input log: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::size_t pos = sizeof(input_log::MAGIC);
+    uint16_t version = 0;
+    uint8_t variant_id = 0;
+    if (data.size() < pos || memcmp(data.data(), input_log::MAGIC, pos) != 0
+        || !readLE(data, pos, version) || version != input_log::VERSION
+        || !readLE(data, pos, seed) || !readLE(data, pos, instructions_per_second) || !readLE(data, pos, costs)
+        || !readLE(data, pos, variant_id)
+        || costs > input_log::COSTS_VIP || variant_id > static_cast<uint8_t>(Variant::Vip)) {
+        std::cerr << "Not a supported input log: " << path << std::endl;
+        return false;
+    }
+
+    variant = static_cast<Variant>(variant_id);
+
+    events.clear();
+    uint64_t frame = 0;
+    uint64_t instruction = 0;
+    while (pos < data.size()) {
+        uint64_t frame_delta, instruction_delta;
+        if (!readVarint(data, pos, frame_delta) || !readVarint(data, pos, instruction_delta) || pos >= data.size())
+            break;
+
+        frame += frame_delta;
+        instruction += instruction_delta;
+        uint8_t code = data[pos++];
+
+        if (code == input_log::END) {
+            end_frame = frame;
+            return true;
+        }
+        events.push_back({frame, instruction, code});
+    }
+
+    std::cerr << "Input log is truncated, replaying up to the last event: " << path << std::endl;
+    end_frame = events.empty() ? 0 : events.back().frame + 1;
+    return true;
+}
+
+void InputReplayer::start(Chip8Core& core) {
+    core.seed(seed);
+    core.setInstructionsPerSecond(instructions_per_second);
+    core.setCycleCosts(costs == input_log::COSTS_VIP ? &Chip8Core::VIP_CYCLES : nullptr);
+    core.setVariant(variant);
+
+    next_event = 0;
+    paused = false;
+    desynced = false;
+}
+
+void InputReplayer::apply(Chip8Core& core, const input_log::Event& event) {
+    if (event.instruction != core.getInstructionCount())
+        desynced = true;
+
+    switch (event.code & 0xF0)
+    {
+    case input_log::KEY_UP:
+        core.setKey(event.code & 0xF, false);
+        break;
+    case input_log::KEY_DOWN:
+        core.setKey(event.code & 0xF, true);
+        break;
+    default:
+        paused = event.code == input_log::PAUSE_ON;
+        break;
+    }
+}
+
+bool InputReplayer::runFrame(Chip8Core& core) {
+    const uint64_t frame = core.getFrameCount();
+    if (frame >= end_frame)
+        return false;
+
+    core.beginFrame();
+    while (next_event < events.size() && events[next_event].frame == frame) {
+        const input_log::Event& event = events[next_event];
+
+        // Run up to the instruction the event arrived at within this frame
+        if (!paused && event.instruction > core.getInstructionCount())
+            core.runBudget(static_cast<std::size_t>(event.instruction - core.getInstructionCount()));
+
+        apply(core, event);
+        next_event++;
+    }
+
+    if (!paused)
+        core.runBudget();
+    core.endFrame();
+    return true;
+}
@@ -0,0 +1,544 @@
+#include "chip8/jit.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define CHIP8_JIT_X64 1
+#include <sys/mman.h>
+#endif
+
+namespace {
+#ifdef CHIP8_JIT_X64
+    // Host register numbers
+    enum Reg : uint8_t {
+        RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+        R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+    };
+
+    // RDI holds the Chip8Core pointer, EBP holds I, RAX/RCX are scratch.
+    // The rest are handed out to guest V registers in order of first use.
+    const std::array<uint8_t, 11> register_pool = { RSI, RDX, R8, R9, R10, R11, RBX, R12, R13, R14, R15 };
+
+    bool isCalleeSaved(uint8_t reg) {
+        return reg == RBX || reg == RBP || reg >= R12;
+    }
+
+    class Emitter {
+    public:
+        // Cleared, but its capacity is kept from the previous block
+        std::vector<uint8_t>& buf;
+
+        explicit Emitter(std::vector<uint8_t>& buf_) : buf(buf_) { buf.clear(); }
+
+        void byte(uint8_t b) { buf.push_back(b); }
+
+        void u32(uint32_t v) {
+            for (int i = 0; i < 4; i++)
+                byte(static_cast<uint8_t>(v >> (8 * i)));
+        }
+
+        // REX prefix for byte registers; always emitted so SIL/DIL are addressable
+        void rex8(uint8_t reg, uint8_t rm) {
+            byte(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+        }
+
+        // op r/m8, r8 (mov 0x88, add 0x00, or 0x08, and 0x20, sub 0x28, xor 0x30, cmp 0x38)
+        void alu8(uint8_t opcode, uint8_t dst, uint8_t src) {
+            rex8(src, dst);
+            byte(opcode);
+            byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+        }
+
+        void movImm8(uint8_t dst, uint8_t imm) {
+            rex8(0, dst);
+            byte(0xB0 + (dst & 7));
+            byte(imm);
+        }
+
+        // 0x80 group: /0 add, /7 cmp
+        void aluImm8(uint8_t ext, uint8_t dst, uint8_t imm) {
+            rex8(0, dst);
+            byte(0x80);
+            byte(0xC0 | (ext << 3) | (dst & 7));
+            byte(imm);
+        }
+
+        // 0xD0 group: /4 shl, /5 shr by one
+        void shift1(uint8_t ext, uint8_t dst) {
+            rex8(0, dst);
+            byte(0xD0);
+            byte(0xC0 | (ext << 3) | (dst & 7));
+        }
+
+        // setcc r8 (0x92 setc, 0x93 setae)
+        void setcc(uint8_t cc, uint8_t dst) {
+            rex8(0, dst);
+            byte(0x0F);
+            byte(cc);
+            byte(0xC0 | (dst & 7));
+        }
+
+        void movzx32From8(uint8_t dst, uint8_t src) {
+            rex8(dst, src);
+            byte(0x0F);
+            byte(0xB6);
+            byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+        }
+
+        // mov r8, [rdi + disp32] / mov [rdi + disp32], r8
+        void load8(uint8_t dst, int32_t disp) {
+            rex8(dst, 0);
+            byte(0x8A);
+            byte(0x80 | ((dst & 7) << 3) | RDI);
+            u32(static_cast<uint32_t>(disp));
+        }
+
+        void store8(uint8_t src, int32_t disp) {
+            rex8(src, 0);
+            byte(0x88);
+            byte(0x80 | ((src & 7) << 3) | RDI);
+            u32(static_cast<uint32_t>(disp));
+        }
+
+        // movzx r32, word [rdi + disp32] / mov [rdi + disp32], r16 (registers below R8 only)
+        void load16(uint8_t dst, int32_t disp) {
+            byte(0x0F);
+            byte(0xB7);
+            byte(0x80 | (dst << 3) | RDI);
+            u32(static_cast<uint32_t>(disp));
+        }
+
+        void store16(uint8_t src, int32_t disp) {
+            byte(0x66);
+            byte(0x89);
+            byte(0x80 | (src << 3) | RDI);
+            u32(static_cast<uint32_t>(disp));
+        }
+
+        // mov r32, imm32 (registers below R8 only)
+        void movImm32(uint8_t dst, uint32_t imm) {
+            byte(0xB8 + dst);
+            u32(imm);
+        }
+
+        void push(uint8_t reg) {
+            if (reg >= R8) byte(0x41);
+            byte(0x50 + (reg & 7));
+        }
+
+        void pop(uint8_t reg) {
+            if (reg >= R8) byte(0x41);
+            byte(0x58 + (reg & 7));
+        }
+    };
+
+    enum class OpKind { Untranslatable, Straight, Terminator };
+
+    struct GuestUse {
+        // Bit per V register read or written, plus I
+        uint16_t regs = 0;
+        bool uses_I = false;
+    };
+
+    // Quirks are read at translation time, so blocks are as specialized as the
+    // interpreter's handlers. XO-CHIP skips may cover four bytes (F000 nnnn)
+    // and 5xyN means three different things there, so those stay interpreted.
+    OpKind classify(uint16_t instruction, const Quirks& quirks, bool xochip, GuestUse& use) {
+        uint8_t x = (instruction & 0x0F00) >> 8;
+        uint8_t y = (instruction & 0x00F0) >> 4;
+        uint8_t n = instruction & 0x000F;
+        uint8_t kk = instruction & 0x00FF;
+
+        switch (instruction >> 12)
+        {
+        case 0x1:
+            return OpKind::Terminator;
+        case 0x3:
+        case 0x4:
+            if (xochip)
+                return OpKind::Untranslatable;
+            use.regs |= 1 << x;
+            return OpKind::Terminator;
+        case 0x5:
+        case 0x9:
+            if (xochip)
+                return OpKind::Untranslatable;
+            use.regs |= (1 << x) | (1 << y);
+            return OpKind::Terminator;
+        case 0x6:
+        case 0x7:
+            use.regs |= 1 << x;
+            return OpKind::Straight;
+        case 0x8:
+            if (n > 0x7 && n != 0xE)
+                return OpKind::Untranslatable;
+            use.regs |= (1 << x) | (1 << y);
+            if (n >= 0x4 || (n >= 0x1 && quirks.logic_resets_vf))
+                use.regs |= 1 << 0xF;
+            return OpKind::Straight;
+        case 0xA:
+            use.uses_I = true;
+            return OpKind::Straight;
+        case 0xB:
+            use.regs |= 1 << (quirks.jump_adds_vx ? x : 0);
+            return OpKind::Terminator;
+        case 0xF:
+            switch (kk)
+            {
+            case 0x07:
+            case 0x15:
+            case 0x18:
+                use.regs |= 1 << x;
+                return OpKind::Straight;
+            case 0x1E:
+            case 0x29:
+                use.regs |= 1 << x;
+                use.uses_I = true;
+                return OpKind::Straight;
+            default:
+                return OpKind::Untranslatable;
+            }
+        default:
+            return OpKind::Untranslatable;
+        }
+    }
+#endif
+}
+
+Chip8Jit::Chip8Jit(Chip8Core& core_) : core(core_), code(nullptr), code_used(0) {
+    block_index.fill(NOT_TRANSLATED);
+    blocks.reserve(MAX_BLOCKS);
+    block_instructions.reserve(MAX_BLOCK_LENGTH);
+    emit_buffer.reserve(EMIT_BUFFER_SIZE);
+
+#ifdef CHIP8_JIT_X64
+    void *mem = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED)
+        code = static_cast<uint8_t*>(mem);
+#endif
+
+    // Whatever is in RAM now has not been translated yet
+    uint16_t lo, hi;
+    core.consumeCodeWrite(lo, hi);
+}
+
+Chip8Jit::~Chip8Jit() {
+#ifdef CHIP8_JIT_X64
+    if (code)
+        munmap(code, CODE_BUFFER_SIZE);
+#endif
+}
+
+bool Chip8Jit::isSupported() {
+#ifdef CHIP8_JIT_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Chip8Jit::flush() {
+    block_index.fill(NOT_TRANSLATED);
+    blocks.clear();
+    code_used = 0;
+}
+
+void Chip8Jit::invalidate(uint16_t lo, uint16_t hi) {
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        const Block& block = blocks[i];
+        if (block_index[block.start] == static_cast<int32_t>(i) && block.start < hi && block.end > lo)
+            block_index[block.start] = NOT_TRANSLATED;
+    }
+
+    // Addresses that could not be translated before might decode differently now
+    for (std::size_t a = lo; a < hi && a < block_index.size(); a++) {
+        if (block_index[a] == UNTRANSLATABLE)
+            block_index[a] = NOT_TRANSLATED;
+    }
+}
+
+void Chip8Jit::step(std::size_t n) {
+    // Pick up RAM changes made outside of step(), e.g. a restored snapshot
+    uint16_t lo, hi;
+    if (core.consumeCodeWrite(lo, hi))
+        invalidate(lo, hi);
+
+    // A trace records every instruction and a debugger checks each one,
+    // which translated blocks do not
+    if (core.isTracing() || core.isDebugging()) {
+        core.step(n);
+        return;
+    }
+
+    // A ROM waiting on a timer or key costs nothing for the rest of the budget
+    n -= core.skipIdle(n);
+
+    while (n > 0) {
+        uint16_t pc = core.state.PC;
+
+        // Blocks assume the unwrapped address, so PCs past 0xFFF are interpreted
+        if (code && pc < block_index.size()) {
+            int32_t index = block_index[pc];
+            if (index == NOT_TRANSLATED)
+                index = translate(pc);
+
+            if (index >= 0) {
+                const Block& block = blocks[index];
+                if (block.length <= n) {
+                    block.fn(&core);
+                    core.state.instruction_count += block.length;
+                    CHIP8_PROFILE_ONLY(for (uint16_t k = 0; k < block.length; k++) core.profile_counters.pc_heat[block.start + 2 * k]++;)
+                    n -= block.length;
+                    continue;
+                }
+            }
+        }
+
+        core.step(1);
+        n--;
+
+        if (core.consumeCodeWrite(lo, hi))
+            invalidate(lo, hi);
+    }
+}
+
+void Chip8Jit::runFrames(std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        core.beginFrame();
+        step(core.takeInstructionBudget());
+        core.endFrame();
+    }
+}
+
+int32_t Chip8Jit::translate(uint16_t start) {
+#ifdef CHIP8_JIT_X64
+    // Scan forward to find the block and the guest registers it touches
+    std::vector<uint16_t>& instructions = block_instructions;
+    instructions.clear();
+    GuestUse use;
+    uint16_t pc = start;
+    const Quirks quirks = variantQuirks(core.getVariant());
+    const bool xochip = core.getVariant() == Variant::XoChip;
+
+    while (instructions.size() < MAX_BLOCK_LENGTH && pc + 1 < static_cast<uint16_t>(core.state.RAM.size())) {
+        uint16_t instruction = core.state.RAM[pc] << 8 | core.state.RAM[pc + 1];
+
+        GuestUse next = use;
+        OpKind kind = classify(instruction, quirks, xochip, next);
+        if (kind == OpKind::Untranslatable)
+            break;
+
+        int mapped = 0;
+        for (int r = 0; r < 16; r++)
+            mapped += (next.regs >> r) & 1;
+        if (mapped > static_cast<int>(register_pool.size()))
+            break;
+
+        use = next;
+        instructions.push_back(instruction);
+        pc += 2;
+
+        if (kind == OpKind::Terminator)
+            break;
+    }
+
+    if (instructions.empty()) {
+        block_index[start] = UNTRANSLATABLE;
+        return UNTRANSLATABLE;
+    }
+
+    const auto base = reinterpret_cast<const char*>(&core);
+    const int32_t off_V = static_cast<int32_t>(reinterpret_cast<const char*>(core.state.V.data()) - base);
+    const int32_t off_I = static_cast<int32_t>(reinterpret_cast<const char*>(&core.state.I) - base);
+    const int32_t off_PC = static_cast<int32_t>(reinterpret_cast<const char*>(&core.state.PC) - base);
+    const int32_t off_delay = static_cast<int32_t>(reinterpret_cast<const char*>(&core.state.delay_timer) - base);
+    const int32_t off_sound = static_cast<int32_t>(reinterpret_cast<const char*>(&core.state.sound_timer) - base);
+
+    // Guest V register -> host register
+    std::array<uint8_t, 16> host{};
+    std::array<uint8_t, 12> saved;
+    std::size_t saved_count = 0;
+    std::size_t next_free = 0;
+    for (int r = 0; r < 16; r++) {
+        if (use.regs & (1 << r)) {
+            host[r] = register_pool[next_free++];
+            if (isCalleeSaved(host[r]))
+                saved[saved_count++] = host[r];
+        }
+    }
+    if (use.uses_I)
+        saved[saved_count++] = RBP;
+
+    Emitter e(emit_buffer);
+
+    // Prologue: save callee-saved registers and load guest state
+    for (std::size_t s = 0; s < saved_count; s++)
+        e.push(saved[s]);
+    for (int r = 0; r < 16; r++) {
+        if (use.regs & (1 << r))
+            e.load8(host[r], off_V + r);
+    }
+    if (use.uses_I)
+        e.load16(RBP, off_I);
+
+    // Body. Each path leaves the next guest PC in EAX.
+    bool terminated = false;
+    pc = start;
+    for (uint16_t instruction : instructions) {
+        uint16_t nnn = instruction & 0x0FFF;
+        uint8_t x = (instruction & 0x0F00) >> 8;
+        uint8_t y = (instruction & 0x00F0) >> 4;
+        uint8_t n = instruction & 0x000F;
+        uint8_t kk = instruction & 0x00FF;
+        uint16_t next_pc = pc + 2;
+
+        switch (instruction >> 12)
+        {
+        case 0x1:
+            e.movImm32(RAX, nnn);
+            terminated = true;
+            break;
+        case 0x3:
+        case 0x4:
+            e.movImm32(RAX, static_cast<uint16_t>(next_pc));
+            e.movImm32(RCX, static_cast<uint16_t>(next_pc + 2));
+            e.aluImm8(7, host[x], kk);
+            // cmove / cmovne eax, ecx
+            e.byte(0x0F);
+            e.byte((instruction >> 12) == 0x3 ? 0x44 : 0x45);
+            e.byte(0xC1);
+            terminated = true;
+            break;
+        case 0x5:
+        case 0x9:
+            e.movImm32(RAX, static_cast<uint16_t>(next_pc));
+            e.movImm32(RCX, static_cast<uint16_t>(next_pc + 2));
+            e.alu8(0x38, host[x], host[y]);
+            e.byte(0x0F);
+            e.byte((instruction >> 12) == 0x5 ? 0x44 : 0x45);
+            e.byte(0xC1);
+            terminated = true;
+            break;
+        case 0x6:
+            e.movImm8(host[x], kk);
+            break;
+        case 0x7:
+            e.aluImm8(0, host[x], kk);
+            break;
+        case 0x8:
+            switch (n)
+            {
+            case 0x0: e.alu8(0x88, host[x], host[y]); break;
+            case 0x1:
+            case 0x2:
+            case 0x3:
+                e.alu8(n == 0x1 ? 0x08 : n == 0x2 ? 0x20 : 0x30, host[x], host[y]);
+                if (quirks.logic_resets_vf)
+                    e.movImm8(host[0xF], 0);
+                break;
+            case 0x4:
+                e.alu8(0x00, host[x], host[y]);
+                e.setcc(0x92, host[0xF]);
+                break;
+            case 0x5:
+                e.alu8(0x28, host[x], host[y]);
+                e.setcc(0x93, host[0xF]);
+                break;
+            case 0x6:
+                if (quirks.shift_reads_vy)
+                    e.alu8(0x88, host[x], host[y]);
+                e.shift1(5, host[x]);
+                e.setcc(0x92, host[0xF]);
+                break;
+            case 0x7:
+                e.alu8(0x88, RAX, host[y]);
+                e.alu8(0x28, RAX, host[x]);
+                e.alu8(0x88, host[x], RAX);
+                e.setcc(0x93, host[0xF]);
+                break;
+            case 0xE:
+                if (quirks.shift_reads_vy)
+                    e.alu8(0x88, host[x], host[y]);
+                e.shift1(4, host[x]);
+                e.setcc(0x92, host[0xF]);
+                break;
+            }
+            break;
+        case 0xA:
+            e.movImm32(RBP, nnn);
+            break;
+        case 0xB:
+            e.movzx32From8(RAX, host[quirks.jump_adds_vx ? x : 0]);
+            // add eax, imm32
+            e.byte(0x05);
+            e.u32(nnn);
+            terminated = true;
+            break;
+        case 0xF:
+            switch (kk)
+            {
+            case 0x07: e.load8(host[x], off_delay); break;
+            case 0x15: e.store8(host[x], off_delay); break;
+            case 0x18: e.store8(host[x], off_sound); break;
+            case 0x1E:
+                e.movzx32From8(RAX, host[x]);
+                // add ebp, eax
+                e.byte(0x01);
+                e.byte(0xC5);
+                break;
+            case 0x29:
+                e.movzx32From8(RAX, host[x]);
+                // lea eax, [rax + rax * 4]; mov ebp, eax
+                e.byte(0x8D);
+                e.byte(0x04);
+                e.byte(0x80);
+                e.byte(0x89);
+                e.byte(0xC5);
+                break;
+            }
+            break;
+        }
+
+        pc = next_pc;
+    }
+
+    if (!terminated)
+        e.movImm32(RAX, pc);
+
+    // Epilogue: write guest state back and restore host registers
+    for (int r = 0; r < 16; r++) {
+        if (use.regs & (1 << r))
+            e.store8(host[r], off_V + r);
+    }
+    if (use.uses_I)
+        e.store16(RBP, off_I);
+    e.store16(RAX, off_PC);
+    for (std::size_t s = saved_count; s-- > 0;)
+        e.pop(saved[s]);
+    e.byte(0xC3);
+
+    // Both are preallocated, so a full one starts over rather than growing
+    if (code_used + e.buf.size() > CODE_BUFFER_SIZE || blocks.size() == MAX_BLOCKS)
+        flush();
+
+    uint8_t *dest = code + code_used;
+    mprotect(code, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE);
+    memcpy(dest, e.buf.data(), e.buf.size());
+    mprotect(code, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+    code_used += e.buf.size();
+
+    Block block;
+    block.fn = reinterpret_cast<block_fn_t>(dest);
+    block.start = start;
+    block.end = pc;
+    block.length = static_cast<uint16_t>(instructions.size());
+
+    blocks.push_back(block);
+    block_index[start] = static_cast<int32_t>(blocks.size() - 1);
+    return block_index[start];
+#else
+    block_index[start] = UNTRANSLATABLE;
+    return UNTRANSLATABLE;
+#endif
+}
@@ -0,0 +1,554 @@
+#include "chip8/lanes.hpp"
+
+#include <algorithm>
+#include <random>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    // Alignment of the lane arrays; a multiple of every Bytes::WIDTH below
+    constexpr std::size_t LANE_BLOCK = 32;
+
+    // One register byte of WIDTH consecutive lanes. Masks are 0xFF/0x00 per lane.
+#if defined(__AVX2__)
+    struct Bytes {
+        static constexpr std::size_t WIDTH = 32;
+        __m256i v;
+
+        static Bytes load(const uint8_t *p) { return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))}; }
+        static Bytes splat(uint8_t b) { return {_mm256_set1_epi8(static_cast<char>(b))}; }
+        void store(uint8_t *p) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    };
+
+    inline Bytes operator+(Bytes a, Bytes b) { return {_mm256_add_epi8(a.v, b.v)}; }
+    inline Bytes operator-(Bytes a, Bytes b) { return {_mm256_sub_epi8(a.v, b.v)}; }
+    inline Bytes operator&(Bytes a, Bytes b) { return {_mm256_and_si256(a.v, b.v)}; }
+    inline Bytes operator|(Bytes a, Bytes b) { return {_mm256_or_si256(a.v, b.v)}; }
+    inline Bytes operator^(Bytes a, Bytes b) { return {_mm256_xor_si256(a.v, b.v)}; }
+    inline Bytes equal(Bytes a, Bytes b) { return {_mm256_cmpeq_epi8(a.v, b.v)}; }
+    inline Bytes maxUnsigned(Bytes a, Bytes b) { return {_mm256_max_epu8(a.v, b.v)}; }
+    inline Bytes select(Bytes mask, Bytes a, Bytes b) { return {_mm256_blendv_epi8(b.v, a.v, mask.v)}; }
+    inline Bytes shiftRight1(Bytes a) { return {_mm256_and_si256(_mm256_srli_epi16(a.v, 1), _mm256_set1_epi8(0x7F))}; }
+#elif defined(__SSE2__)
+    struct Bytes {
+        static constexpr std::size_t WIDTH = 16;
+        __m128i v;
+
+        static Bytes load(const uint8_t *p) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))}; }
+        static Bytes splat(uint8_t b) { return {_mm_set1_epi8(static_cast<char>(b))}; }
+        void store(uint8_t *p) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    };
+
+    inline Bytes operator+(Bytes a, Bytes b) { return {_mm_add_epi8(a.v, b.v)}; }
+    inline Bytes operator-(Bytes a, Bytes b) { return {_mm_sub_epi8(a.v, b.v)}; }
+    inline Bytes operator&(Bytes a, Bytes b) { return {_mm_and_si128(a.v, b.v)}; }
+    inline Bytes operator|(Bytes a, Bytes b) { return {_mm_or_si128(a.v, b.v)}; }
+    inline Bytes operator^(Bytes a, Bytes b) { return {_mm_xor_si128(a.v, b.v)}; }
+    inline Bytes equal(Bytes a, Bytes b) { return {_mm_cmpeq_epi8(a.v, b.v)}; }
+    inline Bytes maxUnsigned(Bytes a, Bytes b) { return {_mm_max_epu8(a.v, b.v)}; }
+    inline Bytes select(Bytes mask, Bytes a, Bytes b) { return {_mm_or_si128(_mm_and_si128(mask.v, a.v), _mm_andnot_si128(mask.v, b.v))}; }
+    inline Bytes shiftRight1(Bytes a) { return {_mm_and_si128(_mm_srli_epi16(a.v, 1), _mm_set1_epi8(0x7F))}; }
+#else
+    struct Bytes {
+        static constexpr std::size_t WIDTH = 1;
+        uint8_t v;
+
+        static Bytes load(const uint8_t *p) { return {*p}; }
+        static Bytes splat(uint8_t b) { return {b}; }
+        void store(uint8_t *p) const { *p = v; }
+    };
+
+    inline Bytes operator+(Bytes a, Bytes b) { return {static_cast<uint8_t>(a.v + b.v)}; }
+    inline Bytes operator-(Bytes a, Bytes b) { return {static_cast<uint8_t>(a.v - b.v)}; }
+    inline Bytes operator&(Bytes a, Bytes b) { return {static_cast<uint8_t>(a.v & b.v)}; }
+    inline Bytes operator|(Bytes a, Bytes b) { return {static_cast<uint8_t>(a.v | b.v)}; }
+    inline Bytes operator^(Bytes a, Bytes b) { return {static_cast<uint8_t>(a.v ^ b.v)}; }
+    inline Bytes equal(Bytes a, Bytes b) { return {static_cast<uint8_t>(a.v == b.v ? 0xFF : 0x00)}; }
+    inline Bytes maxUnsigned(Bytes a, Bytes b) { return {a.v > b.v ? a.v : b.v}; }
+    inline Bytes select(Bytes mask, Bytes a, Bytes b) { return {static_cast<uint8_t>((mask.v & a.v) | (~mask.v & b.v))}; }
+    inline Bytes shiftRight1(Bytes a) { return {static_cast<uint8_t>(a.v >> 1)}; }
+#endif
+
+    static_assert(LANE_BLOCK % Bytes::WIDTH == 0, "lane arrays must hold whole vectors");
+
+    // a >= b, unsigned
+    inline Bytes greaterEqual(Bytes a, Bytes b) { return equal(maxUnsigned(a, b), a); }
+}
+
+Chip8Lanes::Chip8Lanes(std::size_t count)
+    : lane_count(count),
+      padded_count((count + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK),
+      instructions_per_second(INSTRUCTION_PER_SECOND) {
+    V.resize(16 * padded_count);
+    I.resize(padded_count);
+    PC.resize(padded_count);
+    delay_timer.resize(padded_count);
+    sound_timer.resize(padded_count);
+    keypad.resize(padded_count);
+    all_lanes.resize(padded_count);
+    std::fill(all_lanes.begin(), all_lanes.begin() + lane_count, 0xFF);
+    pending.resize(padded_count);
+    active.resize(padded_count);
+    condition.resize(padded_count);
+    memory.resize(lane_count);
+
+    // Unseeded lanes still get a different sequence each run, like Chip8Core
+    std::random_device rd;
+    rng_seed.resize(lane_count);
+    for (uint64_t& value : rng_seed)
+        value = (static_cast<uint64_t>(rd()) << 32) | rd();
+
+    ram_image = Chip8Core().getRam();
+    restart();
+}
+
+bool Chip8Lanes::loadRom(const uint8_t *data, std::size_t size) {
+    // Let a scalar core validate the ROM and lay out the font and program
+    Chip8Core loader;
+    if (!loader.loadRom(data, size))
+        return false;
+
+    ram_image = loader.getRam();
+    restart();
+    return true;
+}
+
+bool Chip8Lanes::loadRom(const char *rom_path) {
+    Chip8Core loader;
+    if (!loader.loadRom(rom_path))
+        return false;
+
+    ram_image = loader.getRam();
+    restart();
+    return true;
+}
+
+void Chip8Lanes::restart() {
+    std::fill(V.begin(), V.end(), 0);
+    std::fill(I.begin(), I.end(), 0);
+    std::fill(PC.begin(), PC.end(), Chip8Core::ROM_START);
+    std::fill(delay_timer.begin(), delay_timer.end(), 0);
+    std::fill(sound_timer.begin(), sound_timer.end(), 0);
+    std::fill(keypad.begin(), keypad.end(), 0);
+
+    for (std::size_t lane = 0; lane < lane_count; lane++) {
+        LaneMemory& m = memory[lane];
+        m.RAM = ram_image;
+        m.display.fill(0);
+        m.stack.fill(0);
+        m.SP = 0;
+        m.waiting_for_key_release = false;
+        m.audio_pattern.fill(0);
+        m.pitch = Chip8Core::DEFAULT_PITCH;
+        m.audio_pattern_loaded = false;
+        m.rng_state = Chip8Core::seedState(rng_seed[lane]);
+    }
+
+    written.fill(0);
+    converged = true;
+    instruction_count = 0;
+    frame_count = 0;
+    rate_remainder = 0;
+    group_count = 0;
+}
+
+void Chip8Lanes::seed(std::size_t lane, uint64_t value) {
+    rng_seed[lane] = value;
+    memory[lane].rng_state = Chip8Core::seedState(value);
+}
+
+void Chip8Lanes::setKey(std::size_t lane, uint8_t key, bool pressed) {
+    uint16_t bit = static_cast<uint16_t>(1u << (key & 0xF));
+    keypad[lane] = pressed ? keypad[lane] | bit : keypad[lane] & ~bit;
+}
+
+Chip8Core::State Chip8Lanes::getLaneState(std::size_t lane) const {
+    const LaneMemory& m = memory[lane];
+
+    Chip8Core::State state{};
+    state.RAM = m.RAM;
+    for (uint8_t r = 0; r < 16; r++) {
+        state.V[r] = V[r * padded_count + lane];
+        state.keypad[r] = (keypad[lane] >> r) & 1;
+    }
+    state.I = I[lane];
+    state.delay_timer = delay_timer[lane];
+    state.sound_timer = sound_timer[lane];
+    state.PC = PC[lane];
+    state.stack = m.stack;
+    state.SP = m.SP;
+    state.waiting_for_key_release = m.waiting_for_key_release;
+    state.audio_pattern = m.audio_pattern;
+    state.pitch = m.pitch;
+    state.audio_pattern_loaded = m.audio_pattern_loaded;
+    for (int y = 0; y < WINDOW_HEIGHT; y++)
+        state.display[0][y][0] = m.display[y];
+    state.planes = 1;
+    state.rng_state = m.rng_state;
+    state.instruction_count = instruction_count;
+    state.frame_count = frame_count;
+    state.rate_remainder = rate_remainder;
+    return state;
+}
+
+uint64_t Chip8Lanes::hashDisplay(std::size_t lane) const {
+    return Chip8Core::hashDisplay(getLaneState(lane).display);
+}
+
+uint16_t Chip8Lanes::fetch(std::size_t lane, uint16_t pc) const {
+    uint16_t hi = pc & 0xFFF;
+    uint16_t lo = (pc + 1) & 0xFFF;
+    // Untouched code is the same in every lane, and the shared copy stays in cache
+    const Chip8Core::ram_t& ram = written[hi] | written[lo] ? memory[lane].RAM : ram_image;
+    return ram[hi] << 8 | ram[lo];
+}
+
+bool Chip8Lanes::allLanesAt(uint16_t target) const {
+    const uint16_t *pc = PC.data();
+    bool all = true;
+    for (std::size_t l = 0; l < lane_count; l++)
+        all &= pc[l] == target;
+    return all;
+}
+
+bool Chip8Lanes::mayDiverge(uint16_t instruction) {
+    // Skips, computed jumps, returns (stacks may differ) and key waits
+    switch (instruction >> 12)
+    {
+    case 0x0: return instruction == 0x00EE;
+    case 0x3: case 0x4: case 0x5: case 0x9: case 0xB: case 0xE: return true;
+    case 0xF: return (instruction & 0xFF) == 0x0A;
+    default: return false;
+    }
+}
+
+void Chip8Lanes::step(std::size_t n) {
+    // Raw pointers and a local count: byte stores would otherwise force the
+    // compiler to reload the vectors' fields on every iteration
+    const std::size_t lanes = padded_count;
+    uint16_t *pc = PC.data();
+    uint8_t *pend = pending.data();
+    uint8_t *act = active.data();
+
+    for (std::size_t i = 0; i < n; i++) {
+        const uint16_t lead_pc = pc[0];
+        const bool shared_code = !(written[lead_pc & 0xFFF] | written[(lead_pc + 1) & 0xFFF]);
+
+        if (converged && shared_code) {
+            // One group of every lane: no masks to build
+            const uint16_t instruction = fetch(0, lead_pc);
+            for (std::size_t l = 0; l < lanes; l++)
+                pc[l] += 2;
+
+            execute(instruction, all_lanes.data());
+            group_count++;
+            if (mayDiverge(instruction))
+                converged = allLanesAt(pc[0]);
+            continue;
+        }
+
+        std::fill(pend, pend + lane_count, 0xFF);
+        std::size_t remaining = lane_count;
+        std::size_t first = 0;
+
+        // Each pass runs one instruction for every lane at the leader's PC
+        while (remaining > 0) {
+            while (!pend[first])
+                first++;
+
+            const uint16_t leader_pc = pc[first];
+            const uint16_t instruction = fetch(first, leader_pc);
+
+            for (std::size_t l = 0; l < lanes; l++)
+                act[l] = pc[l] == leader_pc ? pend[l] : 0;
+
+            // Lanes that stored over this instruction run what they stored instead
+            if (written[leader_pc & 0xFFF] | written[(leader_pc + 1) & 0xFFF]) {
+                for (std::size_t l = first; l < lane_count; l++) {
+                    if (act[l] && fetch(l, leader_pc) != instruction)
+                        act[l] = 0;
+                }
+            }
+
+            uint32_t count = 0;
+            for (std::size_t l = 0; l < lanes; l++) {
+                pend[l] &= ~act[l];
+                pc[l] += act[l] & 2;
+                count += act[l] & 1;
+            }
+
+            execute(instruction, act);
+            remaining -= count;
+            group_count++;
+        }
+
+        converged = allLanesAt(pc[0]);
+    }
+    instruction_count += n;
+}
+
+void Chip8Lanes::runFrames(std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        step(Chip8Core::frameBudget(instructions_per_second, rate_remainder));
+        tickTimers();
+    }
+}
+
+void Chip8Lanes::tickTimers() {
+    uint8_t *delay = delay_timer.data();
+    uint8_t *sound = sound_timer.data();
+    for (std::size_t l = 0; l < padded_count; l++) {
+        delay[l] -= delay[l] > 0;
+        sound[l] -= sound[l] > 0;
+    }
+    frame_count++;
+}
+
+void Chip8Lanes::execute(uint16_t instruction, const uint8_t *mask) {
+    const uint16_t nnn = instruction & 0x0FFF;
+    const uint8_t n = instruction & 0x000F;
+    const uint8_t kk = instruction & 0x00FF;
+    const uint8_t x = (instruction & 0x0F00) >> 8;
+    const uint8_t y = (instruction & 0x00F0) >> 4;
+
+    const std::size_t W = Bytes::WIDTH;
+    const std::size_t lanes = padded_count;
+    uint8_t *cond = condition.data();
+    uint16_t *pc = PC.data();
+    uint16_t *i_reg = I.data();
+    const uint16_t *keys = keypad.data();
+    uint8_t *v0 = reg(0);
+    uint8_t *vx = reg(x);
+    uint8_t *vy = reg(y);
+    uint8_t *vf = reg(0xF);
+
+    // dst = value(c) in active lanes
+    auto assign = [&](uint8_t *dst, auto value) {
+        for (std::size_t c = 0; c < lanes; c += W)
+            select(Bytes::load(mask + c), value(c), Bytes::load(dst + c)).store(dst + c);
+    };
+
+    // Vx = result, then VF = flag (so a flag written to VF wins, as in Chip8Core)
+    auto assignWithFlag = [&](auto op) {
+        for (std::size_t c = 0; c < lanes; c += W) {
+            Bytes m = Bytes::load(mask + c);
+            Bytes a = Bytes::load(vx + c);
+            Bytes b = Bytes::load(vy + c);
+            Bytes result, flag;
+            op(a, b, result, flag);
+            select(m, result, a).store(vx + c);
+            select(m, flag & Bytes::splat(1), Bytes::load(vf + c)).store(vf + c);
+        }
+    };
+
+    // Skip the next instruction in active lanes where test(c) holds
+    auto skipIf = [&](auto test) {
+        for (std::size_t c = 0; c < lanes; c += W)
+            (test(c) & Bytes::load(mask + c)).store(cond + c);
+        for (std::size_t l = 0; l < lanes; l++)
+            pc[l] += cond[l] & 2;
+    };
+
+    switch (instruction >> 12)
+    {
+    case 0x1:
+        for (std::size_t l = 0; l < lanes; l++)
+            pc[l] = mask[l] ? nnn : pc[l];
+        return;
+    case 0x3:
+        skipIf([&](std::size_t c) { return equal(Bytes::load(vx + c), Bytes::splat(kk)); });
+        return;
+    case 0x4:
+        skipIf([&](std::size_t c) { return equal(Bytes::load(vx + c), Bytes::splat(kk)) ^ Bytes::splat(0xFF); });
+        return;
+    case 0x5:
+        skipIf([&](std::size_t c) { return equal(Bytes::load(vx + c), Bytes::load(vy + c)); });
+        return;
+    case 0x6:
+        assign(vx, [&](std::size_t) { return Bytes::splat(kk); });
+        return;
+    case 0x7:
+        assign(vx, [&](std::size_t c) { return Bytes::load(vx + c) + Bytes::splat(kk); });
+        return;
+    case 0x8:
+        switch (n)
+        {
+        case 0x0: assign(vx, [&](std::size_t c) { return Bytes::load(vy + c); }); break;
+        case 0x1: assign(vx, [&](std::size_t c) { return Bytes::load(vx + c) | Bytes::load(vy + c); }); break;
+        case 0x2: assign(vx, [&](std::size_t c) { return Bytes::load(vx + c) & Bytes::load(vy + c); }); break;
+        case 0x3: assign(vx, [&](std::size_t c) { return Bytes::load(vx + c) ^ Bytes::load(vy + c); }); break;
+        case 0x4:
+            assignWithFlag([](Bytes a, Bytes b, Bytes& result, Bytes& flag) {
+                result = a + b;
+                // Carry out iff the sum wrapped below a
+                flag = equal(maxUnsigned(result, a), result) ^ Bytes::splat(0xFF);
+            });
+            break;
+        case 0x5:
+            assignWithFlag([](Bytes a, Bytes b, Bytes& result, Bytes& flag) {
+                result = a - b;
+                flag = greaterEqual(a, b);
+            });
+            break;
+        case 0x6:
+            assignWithFlag([](Bytes a, Bytes, Bytes& result, Bytes& flag) {
+                result = shiftRight1(a);
+                flag = a;
+            });
+            break;
+        case 0x7:
+            assignWithFlag([](Bytes a, Bytes b, Bytes& result, Bytes& flag) {
+                result = b - a;
+                flag = greaterEqual(b, a);
+            });
+            break;
+        case 0xE:
+            assignWithFlag([](Bytes a, Bytes, Bytes& result, Bytes& flag) {
+                result = a + a;
+                flag = equal(a & Bytes::splat(0x80), Bytes::splat(0x80));
+            });
+            break;
+        default:
+            break;
+        }
+        return;
+    case 0x9:
+        skipIf([&](std::size_t c) { return equal(Bytes::load(vx + c), Bytes::load(vy + c)) ^ Bytes::splat(0xFF); });
+        return;
+    case 0xA:
+        for (std::size_t l = 0; l < lanes; l++)
+            i_reg[l] = mask[l] ? nnn : i_reg[l];
+        return;
+    case 0xB:
+        for (std::size_t l = 0; l < lanes; l++)
+            pc[l] = mask[l] ? static_cast<uint16_t>(nnn + v0[l]) : pc[l];
+        return;
+    case 0xE:
+        if (kk == 0x9E || kk == 0xA1) {
+            uint16_t wanted = kk == 0x9E;
+            for (std::size_t l = 0; l < lanes; l++)
+                pc[l] += (mask[l] && ((keys[l] >> (vx[l] & 0xF)) & 1) == wanted) ? 2 : 0;
+        }
+        return;
+    case 0xF:
+        switch (kk)
+        {
+        case 0x07: assign(vx, [&](std::size_t c) { return Bytes::load(delay_timer.data() + c); }); return;
+        case 0x15: assign(delay_timer.data(), [&](std::size_t c) { return Bytes::load(vx + c); }); return;
+        case 0x18: assign(sound_timer.data(), [&](std::size_t c) { return Bytes::load(vx + c); }); return;
+        case 0x1E:
+            for (std::size_t l = 0; l < lanes; l++)
+                i_reg[l] = mask[l] ? static_cast<uint16_t>(i_reg[l] + vx[l]) : i_reg[l];
+            return;
+        case 0x29:
+            for (std::size_t l = 0; l < lanes; l++)
+                i_reg[l] = mask[l] ? static_cast<uint16_t>(vx[l] * 5) : i_reg[l];
+            return;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+
+    for (std::size_t l = 0; l < lane_count; l++) {
+        if (mask[l])
+            executeLane(l, instruction);
+    }
+}
+
+void Chip8Lanes::executeLane(std::size_t lane, uint16_t instruction) {
+    const uint8_t x = (instruction & 0x0F00) >> 8;
+    const uint8_t y = (instruction & 0x00F0) >> 4;
+    LaneMemory& m = memory[lane];
+    uint8_t *v0 = V.data() + lane;
+    auto v = [&](uint8_t r) -> uint8_t& { return v0[r * padded_count]; };
+    uint16_t& i = I[lane];
+    uint16_t& pc = PC[lane];
+
+    // Mirrors the Chip8Core handlers, minus their diagnostics
+    switch (instruction >> 12)
+    {
+    case 0x0:
+        if (instruction == 0x00E0) {
+            m.display.fill(0);
+        } else if (instruction == 0x00EE && m.SP > 0) {
+            pc = m.stack[--m.SP];
+        }
+        break;
+    case 0x2:
+        if (m.SP < Chip8Core::STACK_SIZE) {
+            m.stack[m.SP++] = pc;
+            pc = instruction & 0x0FFF;
+        }
+        break;
+    case 0xC:
+        v(x) = Chip8Core::nextRandom(m.rng_state) & (instruction & 0xFF);
+        break;
+    case 0xD: {
+        uint8_t start_x = v(x) % 64;
+        uint8_t start_y = v(y) % 32;
+        uint8_t height = instruction & 0xF;
+        v(0xF) = 0;
+        for (uint8_t row = 0; row < height; row++) {
+            if (start_y + row >= 32 || i + row >= m.RAM.size())
+                break;
+
+            uint64_t sprite_row = static_cast<uint64_t>(m.RAM[i + row]) << (WINDOW_WIDTH - 8) >> start_x;
+            uint64_t& line = m.display[start_y + row];
+            if (line & sprite_row)
+                v(0xF) = 1;
+            line ^= sprite_row;
+        }
+        break;
+    }
+    case 0xF:
+        switch (instruction & 0xFF)
+        {
+        case 0x0A:
+            if (!m.waiting_for_key_release) {
+                if (keypad[lane]) {
+                    uint8_t key = 0;
+                    while (!((keypad[lane] >> key) & 1))
+                        key++;
+                    v(x) = key;
+                    m.waiting_for_key_release = true;
+                }
+                pc -= 2;
+            } else if (keypad[lane]) {
+                pc -= 2;
+            } else {
+                m.waiting_for_key_release = false;
+            }
+            break;
+        case 0x33:
+            if (static_cast<std::size_t>(i) + 2 >= m.RAM.size())
+                break;
+            m.RAM[i] = v(x) / 100;
+            m.RAM[i + 1] = (v(x) / 10) % 10;
+            m.RAM[i + 2] = v(x) % 10;
+            written[i] = written[i + 1] = written[i + 2] = 1;
+            break;
+        case 0x55:
+            for (uint8_t r = 0; r <= x && i + r < m.RAM.size(); r++) {
+                m.RAM[i + r] = v(r);
+                written[i + r] = 1;
+            }
+            break;
+        case 0x65:
+            for (uint8_t r = 0; r <= x && i + r < m.RAM.size(); r++)
+                v(r) = m.RAM[i + r];
+            break;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+}
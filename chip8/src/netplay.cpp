@@ -0,0 +1,357 @@
+#include "chip8/netplay.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_NETPLAY_SOCKETS
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // Between HELLO packets while connecting
+    constexpr std::chrono::milliseconds HELLO_INTERVAL{50};
+    constexpr std::chrono::milliseconds CONNECT_POLL{5};
+
+    uint8_t *put16(uint8_t *p, uint16_t value) {
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+        return p + 2;
+    }
+
+    uint8_t *put32(uint8_t *p, uint32_t value) {
+        return put16(put16(p, value & 0xFFFF), value >> 16);
+    }
+
+    uint8_t *put64(uint8_t *p, uint64_t value) {
+        return put32(put32(p, value & 0xFFFFFFFF), value >> 32);
+    }
+
+    uint16_t get16(const uint8_t *p) {
+        return static_cast<uint16_t>(p[0] | p[1] << 8);
+    }
+
+    uint32_t get32(const uint8_t *p) {
+        return get16(p) | static_cast<uint32_t>(get16(p + 2)) << 16;
+    }
+
+    uint64_t get64(const uint8_t *p) {
+        return get32(p) | static_cast<uint64_t>(get32(p + 4)) << 32;
+    }
+
+    // Magic, version and type
+    constexpr std::size_t HEADER_SIZE = 6;
+    constexpr std::size_t HELLO_SIZE = HEADER_SIZE + 8 + 8 + 4 + 1 + 1 + 1;
+    constexpr std::size_t INPUT_HEADER_SIZE = HEADER_SIZE + 4 + 4 + 1;
+
+    uint8_t *putHeader(uint8_t *p, uint8_t type) {
+        memcpy(p, netplay::MAGIC, sizeof(netplay::MAGIC));
+        p[4] = netplay::VERSION;
+        p[5] = type;
+        return p + HEADER_SIZE;
+    }
+}
+
+Netplay::~Netplay() {
+    close();
+}
+
+bool Netplay::isSupported() {
+#ifdef CHIP8_NETPLAY_SOCKETS
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Netplay::open(uint16_t local_port, const char *host, uint16_t port) {
+    close();
+
+#ifdef CHIP8_NETPLAY_SOCKETS
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &found) != 0 || !found) {
+        std::cerr << "Unknown netplay host: " << host << std::endl;
+        return false;
+    }
+    sockaddr_in peer;
+    memcpy(&peer, found->ai_addr, sizeof(peer));
+    freeaddrinfo(found);
+    peer.sin_port = htons(port);
+    static_assert(sizeof(peer) <= sizeof(peer_address), "peer_address too small for sockaddr_in");
+    memcpy(peer_address.data(), &peer, sizeof(peer));
+
+    socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0) {
+        std::cerr << "Failed to create netplay socket" << std::endl;
+        return false;
+    }
+
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(local_port);
+    if (bind(socket_fd, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0 ||
+        fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) | O_NONBLOCK) != 0) {
+        std::cerr << "Failed to bind netplay port " << local_port << std::endl;
+        close();
+        return false;
+    }
+#else
+    (void)local_port;
+    (void)host;
+    (void)port;
+    std::cerr << "Netplay is not supported on this host" << std::endl;
+    return false;
+#endif
+
+    connected = false;
+    has_peer = false;
+    peer_ready = false;
+    mismatch = false;
+    frame = 0;
+    remote_frames = 0;
+    local_acked = 0;
+    rollback_from = NO_ROLLBACK;
+    local_input.fill(0);
+    remote_input.fill(0);
+    used_remote.fill(0);
+    rollbacks = 0;
+    resimulated = 0;
+    stalls = 0;
+    return true;
+}
+
+void Netplay::close() {
+#ifdef CHIP8_NETPLAY_SOCKETS
+    if (socket_fd >= 0)
+        ::close(socket_fd);
+#endif
+    socket_fd = -1;
+    connected = false;
+}
+
+bool Netplay::connect(Chip8Core& core, std::chrono::milliseconds timeout) {
+    if (!isOpen())
+        return false;
+
+    seed = core.getSeed();
+    rom_hash = hashRom(core);
+    rate = core.getInstructionsPerSecond();
+    variant = static_cast<uint8_t>(core.getVariant());
+    costs = core.hasCycleCosts() ? 1 : 0;
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto next_hello = std::chrono::steady_clock::now();
+    while (!(has_peer && peer_ready)) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            std::cerr << "No answer from the netplay peer" << std::endl;
+            return false;
+        }
+        if (now >= next_hello) {
+            sendHello(has_peer);
+            next_hello = now + HELLO_INTERVAL;
+        }
+
+        receive();
+        if (mismatch)
+            return false;
+        std::this_thread::sleep_for(CONNECT_POLL);
+    }
+
+    // The peer may still be waiting for a ready HELLO; it gets another for
+    // every one it sends, and stops waiting once INPUT arrives
+    sendHello(true);
+    connected = true;
+    seed = std::min(seed, peer_seed);
+    core.seed(seed);
+    return true;
+}
+
+bool Netplay::runFrame(Chip8Core& core, uint16_t local_keys) {
+    receive();
+    rollBack(core);
+
+    if (frame >= remote_frames + netplay::MAX_ROLLBACK) {
+        stalls++;
+        sendInput();
+        return false;
+    }
+
+    local_input[frame % netplay::HISTORY] = local_keys;
+    simulate(core, frame);
+    frame++;
+    sendInput();
+    return true;
+}
+
+void Netplay::poll(Chip8Core& core) {
+    receive();
+    rollBack(core);
+    sendInput();
+}
+
+void Netplay::rollBack(Chip8Core& core) {
+    if (rollback_from == NO_ROLLBACK)
+        return;
+
+    core.setState(snapshots[rollback_from % netplay::HISTORY]);
+    for (uint32_t f = rollback_from; f < frame; f++)
+        simulate(core, f);
+
+    rollbacks++;
+    resimulated += frame - rollback_from;
+    rollback_from = NO_ROLLBACK;
+}
+
+uint16_t Netplay::remoteKeys(uint32_t f) const {
+    if (f < remote_frames)
+        return remote_input[f % netplay::HISTORY];
+    // Predicted: the peer still holds whatever it held last
+    return remote_frames ? remote_input[(remote_frames - 1) % netplay::HISTORY] : 0;
+}
+
+void Netplay::simulate(Chip8Core& core, uint32_t f) {
+    snapshots[f % netplay::HISTORY] = core.getState();
+
+    const uint16_t remote = remoteKeys(f);
+    used_remote[f % netplay::HISTORY] = remote;
+    const uint16_t keys = local_input[f % netplay::HISTORY] | remote;
+    for (uint8_t key = 0; key < 16; key++)
+        core.setKey(key, (keys >> key) & 1);
+
+    core.beginFrame();
+    core.runBudget();
+    core.endFrame();
+}
+
+void Netplay::receive() {
+#ifdef CHIP8_NETPLAY_SOCKETS
+    uint8_t packet[netplay::MAX_PACKET_SIZE];
+    for (;;) {
+        const ssize_t size = recv(socket_fd, packet, sizeof(packet), 0);
+        if (size < 0)
+            return;
+        if (static_cast<std::size_t>(size) < HEADER_SIZE || memcmp(packet, netplay::MAGIC, sizeof(netplay::MAGIC)) != 0 ||
+            packet[4] != netplay::VERSION)
+            continue;
+
+        last_receive = std::chrono::steady_clock::now();
+        if (packet[5] == netplay::HELLO && static_cast<std::size_t>(size) >= HELLO_SIZE)
+            handleHello(packet);
+        else if (packet[5] == netplay::INPUT)
+            handleInput(packet, static_cast<std::size_t>(size));
+    }
+#endif
+}
+
+void Netplay::handleHello(const uint8_t *data) {
+    const uint8_t *p = data + HEADER_SIZE;
+    if (connected) {
+        // Still connecting on the other side
+        if (!p[22])
+            sendHello(true);
+        return;
+    }
+
+    const uint64_t hash = get64(p + 8);
+    if (hash != rom_hash || get32(p + 16) != rate || p[20] != variant || p[21] != costs) {
+        std::cerr << "The netplay peer runs a different " <<
+            (hash != rom_hash ? "ROM" : p[20] != variant ? "variant" : "clock or cycle costs") << std::endl;
+        mismatch = true;
+        return;
+    }
+
+    peer_seed = get64(p);
+    has_peer = true;
+    peer_ready = peer_ready || p[22];
+}
+
+void Netplay::handleInput(const uint8_t *data, std::size_t size) {
+    if (size < INPUT_HEADER_SIZE)
+        return;
+    // The peer has finished connecting, so it has this side's HELLO
+    if (!connected) {
+        peer_ready = has_peer;
+        return;
+    }
+
+    const uint8_t *p = data + HEADER_SIZE;
+    local_acked = std::max(local_acked, std::min(get32(p), frame));
+    const uint32_t first = get32(p + 4);
+    const uint8_t count = p[8];
+    if (size < INPUT_HEADER_SIZE + 2 * std::size_t(count))
+        return;
+
+    p += 9;
+    for (uint32_t f = first; f < first + count; f++, p += 2) {
+        if (f < remote_frames)
+            continue;
+        // A gap (never sent that way) or too far ahead for the history
+        if (f > remote_frames || f >= frame + 2 * netplay::MAX_ROLLBACK)
+            break;
+
+        const uint16_t keys = get16(p);
+        remote_input[f % netplay::HISTORY] = keys;
+        if (f < frame && used_remote[f % netplay::HISTORY] != keys)
+            rollback_from = std::min(rollback_from, f);
+        remote_frames++;
+    }
+}
+
+void Netplay::sendHello(bool ready) {
+    uint8_t packet[HELLO_SIZE];
+    uint8_t *p = putHeader(packet, netplay::HELLO);
+    p = put64(p, seed);
+    p = put64(p, rom_hash);
+    p = put32(p, rate);
+    *p++ = variant;
+    *p++ = costs;
+    *p++ = ready ? 1 : 0;
+    send(packet, sizeof(packet));
+}
+
+void Netplay::sendInput() {
+    // Everything the peer has not acknowledged, which the history still holds
+    const uint32_t first = std::max(local_acked, frame > netplay::HISTORY ? frame - netplay::HISTORY : 0);
+    const uint32_t count = frame - first;
+
+    uint8_t packet[netplay::MAX_PACKET_SIZE];
+    uint8_t *p = putHeader(packet, netplay::INPUT);
+    p = put32(p, remote_frames);
+    p = put32(p, first);
+    *p++ = static_cast<uint8_t>(count);
+    for (uint32_t f = first; f < frame; f++)
+        p = put16(p, local_input[f % netplay::HISTORY]);
+    send(packet, static_cast<std::size_t>(p - packet));
+}
+
+void Netplay::send(const uint8_t *data, std::size_t size) {
+#ifdef CHIP8_NETPLAY_SOCKETS
+    // A full socket buffer or an unreachable peer loses this packet; the next
+    // one repeats what it carried
+    sendto(socket_fd, data, size, 0, reinterpret_cast<const sockaddr*>(peer_address.data()), sizeof(sockaddr_in));
+#else
+    (void)data;
+    (void)size;
+#endif
+}
+
+uint64_t Netplay::hashRom(const Chip8Core& core) {
+    // FNV-1a over RAM as loaded: the font and the ROM
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint8_t byte : core.getRam()) {
+        hash ^= byte;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
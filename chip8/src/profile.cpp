@@ -0,0 +1,186 @@
+#include "chip8/profile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+namespace {
+    const char *const OPCODE_NAMES[profile::OPCODE_CLASSES] = {
+        "00E0", "00EE", "0nnn", "1nnn", "2nnn", "3xkk", "4xkk", "5xy0", "6xkk", "7xkk",
+        "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "8xyE", "9xy0",
+        "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E", "ExA1", "Fx07", "Fx0A", "Fx15", "Fx18",
+        "Fx1E", "Fx29", "Fx33", "Fx55", "Fx65", "F002", "Fx3A", "00Cn", "00Dn", "00FB",
+        "00FC", "00FD", "00FE", "00FF", "5xy2", "5xy3", "F000", "Fn01", "Fx30", "Fx75",
+        "Fx85", "other",
+    };
+
+    constexpr std::size_t OTHER = profile::OPCODE_CLASSES - 1;
+
+    uint16_t instructionAt(const std::array<uint8_t, 4096>& ram, std::size_t address) {
+        return ram[address] << 8 | ram[(address + 1) & 0xFFF];
+    }
+}
+
+namespace profile {
+    std::size_t opcodeClass(uint16_t instruction) {
+        const uint8_t n = instruction & 0xF;
+        const uint8_t kk = instruction & 0xFF;
+
+        // Same grouping as Chip8Core::decode for XO-CHIP, which has every
+        // instruction, so "other" is exactly the no-ops of all variants
+        switch (instruction >> 12)
+        {
+        case 0x0:
+            switch (instruction)
+            {
+            case 0x00E0: return 0;
+            case 0x00EE: return 1;
+            case 0x00FB: return 39;
+            case 0x00FC: return 40;
+            case 0x00FD: return 41;
+            case 0x00FE: return 42;
+            case 0x00FF: return 43;
+            default:
+                if ((instruction & 0xFFF0) == 0x00C0)
+                    return 37;
+                return (instruction & 0xFFF0) == 0x00D0 ? 38 : 2;
+            }
+        case 0x5:
+            return n == 0x2 ? 44 : n == 0x3 ? 45 : 7;
+        case 0x8:
+            if (n <= 0x7)
+                return 10 + n;
+            return n == 0xE ? 18 : OTHER;
+        case 0xE:
+            return kk == 0x9E ? 24 : kk == 0xA1 ? 25 : OTHER;
+        case 0xF:
+            switch (kk)
+            {
+            case 0x07: return 26;
+            case 0x0A: return 27;
+            case 0x15: return 28;
+            case 0x18: return 29;
+            case 0x1E: return 30;
+            case 0x29: return 31;
+            case 0x33: return 32;
+            case 0x55: return 33;
+            case 0x65: return 34;
+            case 0x02: return (instruction & 0x0F00) == 0 ? 35 : OTHER;
+            case 0x3A: return 36;
+            case 0x00: return instruction == 0xF000 ? 46 : OTHER;
+            case 0x01: return 47;
+            case 0x30: return 48;
+            case 0x75: return 49;
+            case 0x85: return 50;
+            default: return OTHER;
+            }
+        case 0x9:
+            return 19;
+        default:
+            // 1nnn..7xkk map to 3..9, Annn..Dxyn to 20..23
+            return instruction >> 12 <= 0x7 ? 2 + (instruction >> 12) : 10 + (instruction >> 12);
+        }
+    }
+
+    const char *opcodeName(std::size_t opcode_class) {
+        return opcode_class < OPCODE_CLASSES ? OPCODE_NAMES[opcode_class] : "?";
+    }
+
+    void Histogram::record(std::chrono::steady_clock::duration elapsed) {
+        double us = std::chrono::duration<double, std::micro>(elapsed).count();
+
+        std::size_t bucket = 0;
+        if (us >= 1.0)
+            bucket = std::min<std::size_t>(BUCKETS - 1, static_cast<std::size_t>(std::log2(us)) + 1);
+
+        buckets[bucket]++;
+        count++;
+        total_us += us;
+        max_us = std::max(max_us, us);
+        if (us > budget_us)
+            over_budget++;
+    }
+
+    void Histogram::write(std::ostream& out, const char *name) const {
+        out << name << ": " << count << " samples, mean " << (count ? total_us / count : 0.0)
+            << " us, max " << max_us << " us, " << over_budget << " over " << budget_us << " us\n";
+
+        for (std::size_t b = 0; b < BUCKETS; b++) {
+            if (!buckets[b])
+                continue;
+
+            double lo = b == 0 ? 0.0 : std::ldexp(1.0, static_cast<int>(b) - 1);
+            out << "  " << std::setw(9) << lo << " us+ " << std::setw(10) << buckets[b] << "  "
+                << std::string(static_cast<std::size_t>(40.0 * buckets[b] / count), '#') << '\n';
+        }
+    }
+
+    void GuestCounters::fold(const std::array<uint8_t, 4096>& ram, std::size_t first, std::size_t last) {
+        for (std::size_t a = first; a < last; a++) {
+            if (pc_heat[a] != folded[a]) {
+                opcode_counts[opcodeClass(instructionAt(ram, a))] += pc_heat[a] - folded[a];
+                folded[a] = pc_heat[a];
+            }
+        }
+    }
+
+    void writeGuestReport(std::ostream& out, const GuestCounters& counters, const std::array<uint8_t, 4096>& ram) {
+        // Attribute what has not been folded yet to the code currently in RAM
+        GuestCounters current = counters;
+        current.fold(ram, 0, ram.size());
+
+        uint64_t total = 0;
+        for (uint64_t c : current.opcode_counts)
+            total += c;
+
+        out << "opcodes: " << total << " instructions\n";
+        std::vector<std::size_t> order(OPCODE_CLASSES);
+        for (std::size_t i = 0; i < OPCODE_CLASSES; i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            return current.opcode_counts[a] > current.opcode_counts[b];
+        });
+        for (std::size_t i : order) {
+            if (!current.opcode_counts[i])
+                break;
+            out << "  " << std::setw(5) << OPCODE_NAMES[i] << std::setw(14) << current.opcode_counts[i]
+                << std::setw(8) << std::fixed << std::setprecision(2)
+                << 100.0 * current.opcode_counts[i] / total << "%\n" << std::defaultfloat;
+        }
+
+        // Hottest 16 addresses with the instruction there now
+        std::vector<std::size_t> hot;
+        for (std::size_t a = 0; a < current.pc_heat.size(); a++) {
+            if (current.pc_heat[a])
+                hot.push_back(a);
+        }
+        std::size_t shown = std::min<std::size_t>(16, hot.size());
+        std::partial_sort(hot.begin(), hot.begin() + shown, hot.end(), [&](std::size_t a, std::size_t b) {
+            return current.pc_heat[a] > current.pc_heat[b];
+        });
+        out << "hot addresses:\n" << std::hex << std::uppercase << std::setfill('0');
+        for (std::size_t i = 0; i < shown; i++) {
+            std::size_t a = hot[i];
+            out << "  " << std::setw(3) << a << "  " << std::setw(4) << instructionAt(ram, a)
+                << std::dec << std::setfill(' ') << std::setw(14) << current.pc_heat[a]
+                << std::hex << std::setfill('0') << '\n';
+        }
+        out << std::dec << std::nouppercase << std::setfill(' ');
+
+        // 64 addresses per line; each cell shades the log of its hottest address
+        static const char SHADES[] = " .:-=+*#%@";
+        uint64_t hottest = shown ? current.pc_heat[hot[0]] : 0;
+        double scale = hottest > 1 ? (sizeof(SHADES) - 2) / std::log2(static_cast<double>(hottest)) : 0.0;
+        out << "heatmap (64 bytes per row):\n";
+        for (std::size_t row = 0; row < 64; row++) {
+            out << "  " << std::hex << std::setw(3) << std::setfill('0') << row * 64 << std::dec << std::setfill(' ') << ' ';
+            for (std::size_t a = row * 64; a < row * 64 + 64; a++) {
+                uint64_t heat = current.pc_heat[a];
+                std::size_t shade = heat ? 1 + static_cast<std::size_t>(std::log2(static_cast<double>(heat)) * scale) : 0;
+                out << SHADES[std::min<std::size_t>(shade, sizeof(SHADES) - 2)];
+            }
+            out << '\n';
+        }
+    }
+}
@@ -0,0 +1,309 @@
+#include "chip8/rom_library.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_ROMLIB_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    uint32_t rotl(uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    void sha1Block(std::array<uint32_t, 5>& h, const uint8_t *block) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+            w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16 | uint32_t(block[4 * i + 2]) << 8 | block[4 * i + 3];
+        for (int i = 16; i < 80; i++)
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = t;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    // Little-endian field of the archive; false past the end
+    template<typename T>
+    bool readField(const uint8_t *data, std::size_t size, std::size_t& pos, T& value) {
+        if (size - pos < sizeof(T))
+            return false;
+        uint64_t raw = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            raw |= static_cast<uint64_t>(data[pos + i]) << (8 * i);
+        value = static_cast<T>(raw);
+        pos += sizeof(T);
+        return true;
+    }
+
+    template<typename T>
+    void writeField(std::ofstream& out, T value) {
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            out.put(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+    }
+}
+
+sha1_t sha1(const uint8_t *data, std::size_t size) {
+    std::array<uint32_t, 5> h = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    std::size_t whole = size - size % 64;
+    for (std::size_t i = 0; i < whole; i += 64)
+        sha1Block(h, data + i);
+
+    // Tail, the 0x80 terminator and the bit length, in one or two blocks
+    uint8_t tail[128] = {};
+    std::size_t rest = size - whole;
+    memcpy(tail, data + whole, rest);
+    tail[rest] = 0x80;
+    std::size_t tail_size = rest < 56 ? 64 : 128;
+    uint64_t bits = static_cast<uint64_t>(size) * 8;
+    for (int i = 0; i < 8; i++)
+        tail[tail_size - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+    for (std::size_t i = 0; i < tail_size; i += 64)
+        sha1Block(h, tail + i);
+
+    sha1_t digest;
+    for (int i = 0; i < 20; i++)
+        digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - 8 * (i % 4)));
+    return digest;
+}
+
+std::string sha1Hex(const sha1_t& digest) {
+    static const char DIGITS[] = "0123456789abcdef";
+    std::string hex;
+    for (uint8_t byte : digest) {
+        hex += DIGITS[byte >> 4];
+        hex += DIGITS[byte & 0xF];
+    }
+    return hex;
+}
+
+RomLibrary::~RomLibrary() {
+    close();
+}
+
+void RomLibrary::close() {
+#ifdef CHIP8_ROMLIB_MMAP
+    for (const Mapping& mapping : mappings)
+        munmap(mapping.address, mapping.length);
+#endif
+    mappings.clear();
+    buffers.clear();
+    entries.clear();
+    archive = false;
+}
+
+bool RomLibrary::open(const char *path) {
+    close();
+
+    std::error_code ec;
+    if (std::filesystem::is_directory(path, ec)) {
+        std::vector<std::string> files;
+        for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+            if (entry.is_regular_file(ec))
+                files.push_back(entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+
+        for (const std::string& file : files) {
+            const uint8_t *data;
+            std::size_t size;
+            if (mapFile(file, data, size))
+                addRom(file, data, size);
+        }
+    } else {
+        const uint8_t *data;
+        std::size_t size;
+        if (!mapFile(path, data, size))
+            return false;
+
+        archive = size >= sizeof(rom_archive::MAGIC) && memcmp(data, rom_archive::MAGIC, sizeof(rom_archive::MAGIC)) == 0;
+        if (archive) {
+            if (!indexArchive(path, data, size))
+                return false;
+        } else {
+            addRom(path, data, size);
+        }
+    }
+
+    if (entries.empty()) {
+        std::cerr << "No loadable ROMs in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool RomLibrary::mapFile(const std::string& path, const uint8_t *& data, std::size_t& size) {
+#ifdef CHIP8_ROMLIB_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open ROM file: " << path << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        std::cerr << "Skipping empty ROM file: " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size = static_cast<std::size_t>(info.st_size);
+    void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced, the descriptor is not needed
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        std::cerr << "Failed to map ROM file: " << path << std::endl;
+        return false;
+    }
+
+    mappings.push_back({address, size});
+    data = static_cast<const uint8_t*>(address);
+    return true;
+#else
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open ROM file: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (buffer.empty()) {
+        std::cerr << "Skipping empty ROM file: " << path << std::endl;
+        return false;
+    }
+
+    buffers.push_back(std::move(buffer));
+    data = buffers.back().data();
+    size = buffers.back().size();
+    return true;
+#endif
+}
+
+void RomLibrary::addRom(const std::string& name, const uint8_t *data, std::size_t size) {
+    if (size == 0 || size > Chip8Core::MAX_ROM_SIZE) {
+        std::cerr << "Skipping " << name << ": " << size << " bytes (max " << Chip8Core::MAX_ROM_SIZE << ")" << std::endl;
+        return;
+    }
+
+    Variant variant = variantForRom(name.c_str());
+    entries.push_back({name, sha1(data, size), data, static_cast<uint32_t>(size), variant, variantQuirks(variant)});
+}
+
+bool RomLibrary::indexArchive(const std::string& path, const uint8_t *data, std::size_t size) {
+    std::size_t pos = sizeof(rom_archive::MAGIC);
+    uint16_t version = 0;
+    uint32_t count = 0;
+    if (!readField(data, size, pos, version) || version < 1 || version > rom_archive::VERSION
+        || !readField(data, size, pos, count)) {
+        std::cerr << "Unsupported ROM archive: " << path << std::endl;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t name_length = 0;
+        uint32_t rom_size = 0;
+        if (!readField(data, size, pos, name_length) || size - pos < name_length) {
+            std::cerr << "Truncated ROM archive: " << path << std::endl;
+            return false;
+        }
+        std::string name(reinterpret_cast<const char*>(data + pos), name_length);
+        pos += name_length;
+
+        if (!readField(data, size, pos, rom_size) || size - pos < rom_size) {
+            std::cerr << "Truncated ROM archive: " << path << std::endl;
+            return false;
+        }
+        addRom(name, data + pos, rom_size);
+        pos += rom_size;
+    }
+    return true;
+}
+
+std::size_t RomLibrary::find(const std::string& name) const {
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].name == name || std::filesystem::path(entries[i].name).filename() == name
+            || sha1Hex(entries[i].sha1) == name)
+            return i;
+    }
+    return entries.size();
+}
+
+std::size_t RomLibrary::find(const sha1_t& digest) const {
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].sha1 == digest)
+            return i;
+    }
+    return entries.size();
+}
+
+void RomLibrary::load(std::size_t index, Chip8Core& core) const {
+    const Entry& entry = entries[index];
+    // Validated when indexed, so this cannot fail. The variant goes first so
+    // the decode cache is only cleared again when it changes.
+    core.setVariant(entry.variant);
+    core.loadRom(entry.data, entry.size);
+}
+
+bool RomLibrary::writeArchive(const char *path, const std::vector<std::string>& rom_paths) {
+    RomLibrary roms;
+    for (const std::string& rom_path : rom_paths) {
+        const uint8_t *data;
+        std::size_t size;
+        if (roms.mapFile(rom_path, data, size))
+            roms.addRom(std::filesystem::path(rom_path).filename().string(), data, size);
+    }
+
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Failed to write ROM archive: " << path << std::endl;
+        return false;
+    }
+
+    out.write(rom_archive::MAGIC, sizeof(rom_archive::MAGIC));
+    writeField(out, rom_archive::VERSION);
+    writeField(out, static_cast<uint32_t>(roms.entries.size()));
+    for (const Entry& entry : roms.entries) {
+        std::string name = entry.name.substr(0, UINT16_MAX);
+        writeField(out, static_cast<uint16_t>(name.size()));
+        out.write(name.data(), static_cast<std::streamsize>(name.size()));
+        writeField(out, entry.size);
+        out.write(reinterpret_cast<const char*>(entry.data), entry.size);
+    }
+    return static_cast<bool>(out);
+}
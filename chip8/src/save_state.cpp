@@ -0,0 +1,171 @@
+#include "chip8/save_state.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+namespace {
+    class Writer {
+    public:
+        std::vector<uint8_t> data;
+
+        template<typename T>
+        void put(T value) {
+            for (std::size_t i = 0; i < sizeof(T); i++)
+                data.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+        }
+
+        template<typename T, std::size_t N>
+        void put(const std::array<T, N>& values) {
+            for (const T& value : values)
+                put(value);
+        }
+    };
+
+    class Reader {
+    public:
+        explicit Reader(const std::vector<uint8_t>& data_) : data(data_) {}
+
+        bool ok() const { return pos <= data.size(); }
+
+        template<typename T>
+        void get(T& value) {
+            uint64_t raw = 0;
+            for (std::size_t i = 0; i < sizeof(T); i++) {
+                if (pos < data.size())
+                    raw |= static_cast<uint64_t>(data[pos]) << (8 * i);
+                pos++;
+            }
+            value = static_cast<T>(raw);
+        }
+
+        template<typename T, std::size_t N>
+        void get(std::array<T, N>& values) {
+            for (T& value : values)
+                get(value);
+        }
+
+    private:
+        const std::vector<uint8_t>& data;
+        std::size_t pos = 0;
+    };
+}
+
+bool save_state::save(const char *path, const Chip8Core::State& state) {
+    Writer w;
+    for (char c : MAGIC)
+        w.put(static_cast<uint8_t>(c));
+    w.put(VERSION);
+
+    w.put(state.RAM);
+    w.put(state.V);
+    w.put(state.I);
+    w.put(state.delay_timer);
+    w.put(state.sound_timer);
+    w.put(state.PC);
+    w.put(state.stack);
+    w.put(state.SP);
+    w.put(state.keypad);
+    w.put(state.waiting_for_key_release);
+    w.put(state.audio_pattern);
+    w.put(state.pitch);
+    w.put(state.audio_pattern_loaded);
+    w.put(state.display);
+    w.put(state.hires);
+    w.put(state.planes);
+    w.put(state.rpl_flags);
+    w.put(state.rng_state);
+    w.put(state.instruction_count);
+    w.put(state.frame_count);
+    w.put(state.rate_remainder);
+    w.put(state.cycle_budget);
+
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open save state for writing: " << path << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(w.data.data()), w.data.size());
+    return out.good();
+}
+
+bool save_state::load(const char *path, Chip8Core::State& state) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open save state: " << path << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    Reader r(data);
+    std::array<uint8_t, sizeof(MAGIC)> magic;
+    uint16_t version = 0;
+    r.get(magic);
+    r.get(version);
+    if (!r.ok() || memcmp(magic.data(), MAGIC, sizeof(MAGIC)) != 0 || version < 1 || version > VERSION) {
+        std::cerr << "Not a supported save state: " << path << std::endl;
+        return false;
+    }
+
+    // Decode into a copy so a truncated file leaves the caller's state untouched
+    Chip8Core::State loaded{};
+    r.get(loaded.RAM);
+    r.get(loaded.V);
+    r.get(loaded.I);
+    r.get(loaded.delay_timer);
+    r.get(loaded.sound_timer);
+    r.get(loaded.PC);
+    r.get(loaded.stack);
+    r.get(loaded.SP);
+    r.get(loaded.keypad);
+    r.get(loaded.waiting_for_key_release);
+    // Versions before 3 have no XO-CHIP audio state
+    loaded.pitch = Chip8Core::DEFAULT_PITCH;
+    if (version >= 3) {
+        r.get(loaded.audio_pattern);
+        r.get(loaded.pitch);
+        r.get(loaded.audio_pattern_loaded);
+    }
+    // Versions before 4 have one 64x32 plane, a word per row
+    loaded.planes = 1;
+    if (version >= 4) {
+        r.get(loaded.display);
+        r.get(loaded.hires);
+        r.get(loaded.planes);
+        r.get(loaded.rpl_flags);
+    } else {
+        for (int y = 0; y < WINDOW_HEIGHT; y++)
+            r.get(loaded.display[0][y][0]);
+    }
+    r.get(loaded.rng_state);
+    r.get(loaded.instruction_count);
+    r.get(loaded.frame_count);
+    // Version 1 predates the scheduler carry, which then starts from zero
+    if (version >= 2) {
+        r.get(loaded.rate_remainder);
+        r.get(loaded.cycle_budget);
+    }
+
+    if (!r.ok()) {
+        std::cerr << "Save state is truncated: " << path << std::endl;
+        return false;
+    }
+    if (loaded.SP > Chip8Core::STACK_SIZE) {
+        std::cerr << "Save state has an invalid stack pointer: " << path << std::endl;
+        return false;
+    }
+    // xorshift never leaves zero, so Cxkk would only ever return 0
+    if (loaded.rng_state == 0) {
+        std::cerr << "Save state has a zero random state: " << path << std::endl;
+        return false;
+    }
+    if (loaded.planes > 3) {
+        std::cerr << "Save state has invalid bitplanes: " << path << std::endl;
+        return false;
+    }
+
+    state = loaded;
+    return true;
+}
@@ -0,0 +1,176 @@
+#include "chip8/trace.hpp"
+
+#include "chip8/core.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+namespace {
+    template<typename T>
+    void writeLE(std::ofstream& out, T value) {
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+
+    template<typename T>
+    bool readLE(std::ifstream& in, T& value) {
+        value = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++) {
+            int byte = in.get();
+            if (byte == std::char_traits<char>::eof())
+                return false;
+            value |= static_cast<T>(static_cast<uint8_t>(byte)) << (8 * i);
+        }
+        return true;
+    }
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const char *path, Chip8Core& target) {
+    close();
+
+    out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open trace for writing: " << path << std::endl;
+        return false;
+    }
+
+    const Chip8Core::State& state = target.getState();
+    out.write(trace_log::MAGIC, sizeof(trace_log::MAGIC));
+    writeLE<uint16_t>(out, trace_log::VERSION);
+    writeLE<uint8_t>(out, static_cast<uint8_t>(target.getVariant()));
+    writeLE<uint64_t>(out, state.instruction_count);
+    writeLE<uint64_t>(out, state.frame_count);
+    writeLE<uint16_t>(out, state.PC & 0xFFF);
+    writeLE<uint16_t>(out, state.I);
+    for (uint8_t v : state.V)
+        writeLE<uint8_t>(out, v);
+
+    // Every block up front, so recording never allocates
+    blocks.start([this](const Block& block) {
+        out.write(reinterpret_cast<const char*>(block.data.data()), static_cast<std::streamsize>(block.size));
+    });
+    blocks.acquire(current_block);
+    block_used = 0;
+
+    next_pc = state.PC & 0xFFF;
+    opcodes.fill(0);
+    recorded = 0;
+    stalls = 0;
+
+    core = &target;
+    core->setTracer(this);
+    return true;
+}
+
+void TraceWriter::close() {
+    if (!core)
+        return;
+
+    core->setTracer(nullptr);
+    core = nullptr;
+
+    blocks[current_block].size = block_used;
+    if (block_used)
+        blocks.submit(current_block);
+    blocks.stop();
+    out.close();
+}
+
+void TraceWriter::submitBlock() {
+    blocks[current_block].size = block_used;
+    blocks.submit(current_block);
+    block_used = 0;
+
+    if (blocks.acquire(current_block))
+        return;
+    // The disk fell a whole queue behind
+    stalls++;
+    while (!blocks.acquire(current_block))
+        std::this_thread::yield();
+}
+
+bool TraceReader::open(const char *path) {
+    in.open(path, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open trace: " << path << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(trace_log::MAGIC)];
+    in.read(magic, sizeof(magic));
+    uint16_t version = 0;
+    if (in.gcount() != sizeof(magic) || !std::equal(magic, magic + sizeof(magic), trace_log::MAGIC) ||
+        !readLE(in, version) || version != trace_log::VERSION) {
+        std::cerr << "Not a trace file (or an unsupported version): " << path << std::endl;
+        return false;
+    }
+
+    uint8_t variant_byte = 0;
+    bool ok = readLE(in, variant_byte) && readLE(in, start.instruction) && readLE(in, start.frame) &&
+              readLE(in, start.pc) && readLE(in, start.I);
+    for (uint8_t& v : start.V)
+        ok = ok && readLE(in, v);
+    if (!ok || variant_byte > static_cast<uint8_t>(Variant::Vip)) {
+        std::cerr << "Truncated trace header: " << path << std::endl;
+        return false;
+    }
+
+    variant = static_cast<Variant>(variant_byte);
+    current = start;
+    next_pc = start.pc;
+    opcodes.fill(0);
+    return true;
+}
+
+bool TraceReader::read16(uint16_t& value) {
+    if (readLE(in, value))
+        return true;
+    truncated = true;
+    return false;
+}
+
+bool TraceReader::next(trace_log::Record& record) {
+    int flags;
+    while ((flags = in.get()) == trace_log::FRAME)
+        current.frame++;
+    if (flags == std::char_traits<char>::eof())
+        return false;
+
+    uint16_t pc = next_pc;
+    if ((flags & trace_log::HAS_PC) && !read16(pc))
+        return false;
+    current.pc = pc & 0xFFF;
+
+    if ((flags & trace_log::HAS_OPCODE) && !read16(opcodes[current.pc]))
+        return false;
+    current.opcode = opcodes[current.pc];
+
+    if ((flags & trace_log::HAS_I) && !read16(current.I))
+        return false;
+
+    if (flags & trace_log::HAS_V) {
+        uint16_t mask;
+        if (!read16(mask))
+            return false;
+        for (int x = 0; x < 16; x++) {
+            if (!(mask & (1 << x)))
+                continue;
+            int value = in.get();
+            if (value == std::char_traits<char>::eof()) {
+                truncated = true;
+                return false;
+            }
+            current.V[x] = static_cast<uint8_t>(value);
+        }
+    }
+
+    record = current;
+    current.instruction++;
+    next_pc = (current.pc + 2) & 0xFFF;
+    return true;
+}
@@ -0,0 +1,48 @@
+#include "chip8/variant.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+Quirks variantQuirks(Variant variant) {
+    switch (variant)
+    {
+    case Variant::SuperChip: return variant::SuperChip::QUIRKS;
+    case Variant::XoChip: return variant::XoChip::QUIRKS;
+    case Variant::Vip: return variant::Vip::QUIRKS;
+    default: return variant::Chip8::QUIRKS;
+    }
+}
+
+const char *variantName(Variant variant) {
+    switch (variant)
+    {
+    case Variant::SuperChip: return "schip";
+    case Variant::XoChip: return "xochip";
+    case Variant::Vip: return "vip";
+    default: return "chip8";
+    }
+}
+
+bool parseVariant(const char *name, Variant& variant) {
+    for (Variant candidate : {Variant::Chip8, Variant::SuperChip, Variant::XoChip, Variant::Vip}) {
+        if (strcmp(name, variantName(candidate)) == 0) {
+            variant = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+Variant variantForRom(const char *rom_path) {
+    std::string extension = std::filesystem::path(rom_path).extension().string();
+    for (char& c : extension)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+    if (extension == ".sc8")
+        return Variant::SuperChip;
+    if (extension == ".xo8")
+        return Variant::XoChip;
+    return Variant::Chip8;
+}
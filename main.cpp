@@ -1,19 +1,362 @@
+#include "chip8/capture.hpp"
 #include "chip8/chip8.hpp"
+#include "chip8/core.hpp"
+#include "chip8/input_log.hpp"
+#include "chip8/jit.hpp"
+#include "chip8/rom_library.hpp"
+#include "chip8/trace.hpp"
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <memory>
+#include <string>
+
+// How long --netplay waits for the other instance to start
+static constexpr std::chrono::seconds NETPLAY_TIMEOUT{60};
+
+struct Options {
+    const char *rom_path = nullptr;
+    // ROM to start in a directory or archive, by name or SHA-1
+    const char *rom_name = nullptr;
+    bool turbo = false;
+    // 0.25, 0.5, 1, 2, 4 or max
+    const char *speed = nullptr;
+    bool use_jit = false;
+    // Forced variant; by default it follows the ROM's file extension
+    bool has_variant = false;
+    Variant variant = Variant::Chip8;
+    std::size_t headless_frames = 0;
+    bool has_seed = false;
+    uint64_t seed = 0;
+    const char *record_path = nullptr;
+    const char *replay_path = nullptr;
+    const char *stats_path = nullptr;
+    // Execution trace of a headless or replayed run, for chip8_tracediff
+    const char *trace_path = nullptr;
+    // Animated GIF of the display, with the sound gate in <file>.audio
+    const char *capture_path = nullptr;
+    // Rollback netplay: local UDP port and the peer's host and port
+    uint16_t netplay_port = 0;
+    std::string netplay_host;
+    uint16_t netplay_peer_port = 0;
+    uint32_t instructions_per_second = 0;
+    bool vip_timing = false;
+    bool vsync = false;
+    bool threaded = false;
+    bool latency_probe = false;
+    // Start in the debugger monitor
+    bool debug = false;
+    bool has_catch_up = false;
+    std::size_t catch_up = 0;
+};
+
+static void printUsage() {
+    std::cout << "Usage: chip8_emulator [--turbo] [--speed <0.25|0.5|1|2|4|max>] [--jit]\n"
+              << "                      [--headless <frames>] [--seed <n>]\n"
+              << "                      [--record <input log>] [--replay <input log>] [--stats <file>]\n"
+              << "                      [--trace <file>] [--capture <gif>] [--netplay <port> <host:port>]\n"
+              << "                      [--ips <n>] [--vip-timing] [--vsync] [--catch-up <ticks>]\n"
+              << "                      [--threaded] [--latency-probe] [--debug] [--variant chip8|schip|xochip|vip]\n"
+              << "                      [--rom <name or sha1>] <ROM file, directory or archive>" << std::endl;
+}
+
+static void printSummary(const Chip8Core& core, std::chrono::duration<double> elapsed) {
+    double ips = elapsed.count() > 0 ? core.getInstructionCount() / elapsed.count() : 0.0;
+    std::cout << "frames: " << core.getFrameCount()
+              << ", instructions: " << core.getInstructionCount()
+              << ", seconds: " << elapsed.count()
+              << ", IPS: " << static_cast<uint64_t>(ips)
+              << ", display hash: " << std::hex << core.hashDisplay() << std::dec << std::endl;
+    if (core.getCallStackFaultCount())
+        std::cout << "call stack faults: " << core.getCallStackFaultCount() << std::endl;
+}
+
+// Opcode counts and PC heatmap of a finished headless run
+static void writeStats(const Options& options, const Chip8Core& core) {
+    if (!options.stats_path)
+        return;
+
+    std::ofstream out(options.stats_path, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Failed to write stats to " << options.stats_path << std::endl;
+        return;
+    }
+    core.writeProfile(out);
+}
+
+static bool startTrace(const Options& options, TraceWriter& trace, Chip8Core& core) {
+    return !options.trace_path || trace.open(options.trace_path, core);
+}
+
+static void finishTrace(const Options& options, TraceWriter& trace) {
+    if (!trace.isOpen())
+        return;
+    trace.close();
+    std::cout << trace.getRecordCount() << " instructions traced to " << options.trace_path;
+    if (trace.getStallCount())
+        std::cout << " (waited on the disk " << trace.getStallCount() << " times)";
+    std::cout << std::endl;
+}
+
+static bool startCapture(const Options& options, FrameCapture& capture) {
+    return !options.capture_path || capture.open(options.capture_path);
+}
+
+static void finishCapture(const Options& options, FrameCapture& capture) {
+    if (!capture.isOpen())
+        return;
+    capture.close();
+    std::cout << capture.getFrameCount() << " frames captured to " << options.capture_path << std::endl;
+}
+
+static bool loadRom(const Options& options, Chip8Core& core) {
+    RomLibrary library;
+    if (!library.open(options.rom_path))
+        return false;
+
+    std::size_t index = options.rom_name ? library.find(options.rom_name) : 0;
+    if (index == library.size()) {
+        std::cerr << "No ROM named " << options.rom_name << " in " << options.rom_path << std::endl;
+        return false;
+    }
+
+    library.load(index, core);
+    if (options.has_variant)
+        core.setVariant(options.variant);
+    return true;
+}
+
+static void configureClock(const Options& options, Chip8Core& core) {
+    if (options.vip_timing) {
+        core.setCycleCosts(&Chip8Core::VIP_CYCLES);
+        core.setInstructionsPerSecond(Chip8Core::VIP_CYCLES_PER_SECOND);
+    }
+    if (options.instructions_per_second)
+        core.setInstructionsPerSecond(options.instructions_per_second);
+}
+
+// Run the ROM without a window for a fixed number of frames, as fast as possible
+static int runHeadless(const Options& options) {
+    Chip8Core core;
+    if (!loadRom(options, core))
+        return 1;
+    if (options.has_seed)
+        core.seed(options.seed);
+    configureClock(options, core);
+
+    bool use_jit = options.use_jit;
+    if (use_jit && !Chip8Jit::isSupported()) {
+        std::cout << "JIT is not supported on this host, using the interpreter." << std::endl;
+        use_jit = false;
+    }
+    if (use_jit && core.hasCycleCosts()) {
+        std::cout << "The JIT does not charge cycle costs, using the interpreter." << std::endl;
+        use_jit = false;
+    }
+
+    TraceWriter trace;
+    if (!startTrace(options, trace, core))
+        return 1;
+    FrameCapture capture;
+    if (!startCapture(options, capture))
+        return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Chip8Jit> jit;
+    if (use_jit)
+        jit = std::make_unique<Chip8Jit>(core);
+    if (!capture.isOpen()) {
+        if (jit)
+            jit->runFrames(options.headless_frames);
+        else
+            core.runFrames(options.headless_frames);
+    } else {
+        // One frame at a time, faster than real time, so capturing waits
+        // for the encoder rather than dropping frames
+        for (std::size_t i = 0; i < options.headless_frames; i++) {
+            if (jit)
+                jit->runFrames(1);
+            else
+                core.runFrames(1);
+            capture.addFrame(core, true);
+        }
+    }
+
+    printSummary(core, std::chrono::steady_clock::now() - start);
+    finishTrace(options, trace);
+    finishCapture(options, capture);
+    writeStats(options, core);
+    return 0;
+}
+
+// Feed a recorded session back into the core at full speed
+static int runReplay(const Options& options) {
+    Chip8Core core;
+    InputReplayer replayer;
+    if (!loadRom(options, core) || !replayer.open(options.replay_path))
+        return 1;
+
+    replayer.start(core);
+
+    TraceWriter trace;
+    if (!startTrace(options, trace, core))
+        return 1;
+    FrameCapture capture;
+    if (!startCapture(options, capture))
+        return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    while (replayer.runFrame(core)) {
+        if (capture.isOpen())
+            capture.addFrame(core, true);
+    }
+
+    printSummary(core, std::chrono::steady_clock::now() - start);
+    finishTrace(options, trace);
+    finishCapture(options, capture);
+    writeStats(options, core);
+    if (replayer.isDesynced()) {
+        std::cout << "Replay desynced: an event arrived after the instruction it was recorded at." << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--turbo") == 0) {
+            options.turbo = true;
+        } else if (strcmp(argv[i], "--speed") == 0 && has_value) {
+            options.speed = argv[++i];
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.use_jit = true;
+        } else if (strcmp(argv[i], "--variant") == 0 && has_value) {
+            if (!parseVariant(argv[++i], options.variant)) {
+                printUsage();
+                return 1;
+            }
+            options.has_variant = true;
+        } else if (strcmp(argv[i], "--rom") == 0 && has_value) {
+            options.rom_name = argv[++i];
+        } else if (strcmp(argv[i], "--headless") == 0 && has_value) {
+            options.headless_frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            options.has_seed = true;
+            options.seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+            options.record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+            options.replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 && has_value) {
+            options.stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            options.trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && has_value) {
+            options.capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--netplay") == 0 && i + 2 < argc) {
+            options.netplay_port = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+            const char *peer = argv[++i];
+            const char *colon = std::strrchr(peer, ':');
+            if (!options.netplay_port || !colon) {
+                printUsage();
+                return 1;
+            }
+            options.netplay_host.assign(peer, colon);
+            options.netplay_peer_port = static_cast<uint16_t>(std::strtoul(colon + 1, nullptr, 10));
+        } else if (strcmp(argv[i], "--ips") == 0 && has_value) {
+            options.instructions_per_second = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--vip-timing") == 0) {
+            options.vip_timing = true;
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            options.vsync = true;
+        } else if (strcmp(argv[i], "--threaded") == 0) {
+            options.threaded = true;
+        } else if (strcmp(argv[i], "--latency-probe") == 0) {
+            options.latency_probe = true;
+        } else if (strcmp(argv[i], "--debug") == 0) {
+            options.debug = true;
+        } else if (strcmp(argv[i], "--catch-up") == 0 && has_value) {
+            options.has_catch_up = true;
+            options.catch_up = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!options.rom_path) {
+            options.rom_path = argv[i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (!options.rom_path) {
         std::cout << "Enter ROM file path." << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    if (options.netplay_port && (options.replay_path || options.headless_frames > 0)) {
+        std::cout << "--netplay needs a window; chip8_netplay tests it headless." << std::endl;
+        return 1;
+    }
+
+    if (options.replay_path)
+        return runReplay(options);
+
+    if (options.headless_frames > 0)
+        return runHeadless(options);
+
+    if (options.trace_path) {
+        std::cout << "--trace needs --headless or --replay." << std::endl;
+        return 1;
+    }
+    if (options.netplay_port && (options.record_path || options.debug || options.use_jit)) {
+        std::cout << "--netplay cannot be combined with --record, --debug or --jit." << std::endl;
         return 1;
     }
 
     Chip8 chip8;
-    if (!chip8.loadRom(argv[1]) || !chip8.init())
+    if (!chip8.openLibrary(options.rom_path, options.rom_name) || !chip8.init())
         return 1;
 
+    if (options.has_variant)
+        chip8.setVariant(options.variant);
+    if (options.has_seed)
+        chip8.setSeed(options.seed);
+    if (options.capture_path && !chip8.startCapture(options.capture_path))
+        return 1;
+    if (options.stats_path)
+        chip8.setStatsFile(options.stats_path);
+
+    if (options.vip_timing)
+        chip8.setVipTiming(true);
+    if (options.instructions_per_second)
+        chip8.setInstructionsPerSecond(options.instructions_per_second);
+    // The log header records the seed, variant and clock, so after setting them
+    if (options.record_path && !chip8.startRecording(options.record_path))
+        return 1;
+    if (options.vsync)
+        chip8.setVsync(true);
+    if (options.has_catch_up)
+        chip8.setMaxCatchUp(options.catch_up);
+    // The handshake compares the ROM and clock, so after configuring them
+    if (options.netplay_port &&
+        !chip8.startNetplay(options.netplay_port, options.netplay_host.c_str(), options.netplay_peer_port, NETPLAY_TIMEOUT))
+        return 1;
+
+    chip8.setThreaded(options.threaded);
+    chip8.setLatencyProbe(options.latency_probe);
+    chip8.setBreakAtStart(options.debug);
+    chip8.setTurbo(options.turbo);
+    if (options.speed && !chip8.setSpeed(options.speed))
+        return 1;
+    if (options.use_jit)
+        chip8.setJit(true);
     chip8.run();
-    
+
     return 0;
 }
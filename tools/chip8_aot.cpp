@@ -0,0 +1,365 @@
+#include "chip8/core.hpp"
+#include "chip8/variant.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Compiles a ROM ahead of time into C++ for the Chip8Aot runtime. The control
+// flow graph is built from 0x200 by following jumps, calls and skips; every
+// basic block becomes one function. Instructions are identified through the
+// core's own decoder, so the generated code follows the variant's quirks.
+// Register, timer and branch instructions are emitted inline, everything else
+// goes through Chip8Core::executeInstruction.
+
+namespace {
+    constexpr std::size_t MAX_BLOCK_LENGTH = 64;
+
+    // printf into a string; the attribute has the compiler check formats
+    __attribute__((format(printf, 1, 2)))
+    std::string formatted(const char *format, ...) {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        return std::string(buffer);
+    }
+
+    enum class Kind {
+        Nop, Jump, SkipEq, SkipNe, SkipRegEq, SkipRegNe, SkipKey, SkipNoKey,
+        Load, Add, Move, Or, And, Xor, AddCarry, Sub, ShiftRight, SubN, ShiftLeft,
+        LoadI, Random, GetDelay, SetDelay, SetSound, AddI, Font,
+        // Through executeInstruction, the block continues
+        Call,
+        // Through executeInstruction, the block ends: the instruction moves PC
+        // or writes RAM that may hold the rest of the block
+        CallEnd,
+    };
+
+    struct Compiler {
+        Variant variant;
+        Quirks quirks;
+        std::vector<uint8_t> rom;
+        std::map<Chip8Core::DecodedOp::handler_t, Kind> kinds;
+
+        std::set<uint16_t> leaders;
+        struct Block { uint16_t start; std::vector<uint16_t> addresses; uint16_t next; bool falls_through; };
+        std::map<uint16_t, Block> blocks;
+
+        Compiler(Variant variant_, std::vector<uint8_t> rom_) : variant(variant_), quirks(variantQuirks(variant_)), rom(std::move(rom_)) {
+            // Reference encodings for the instructions emitted inline
+            const std::pair<uint16_t, Kind> inline_ops[] = {
+                {0x0000, Kind::Nop}, {0x1000, Kind::Jump}, {0x3000, Kind::SkipEq}, {0x4000, Kind::SkipNe},
+                {0x5000, Kind::SkipRegEq}, {0x9000, Kind::SkipRegNe}, {0xE09E, Kind::SkipKey}, {0xE0A1, Kind::SkipNoKey},
+                {0x6000, Kind::Load}, {0x7000, Kind::Add}, {0x8000, Kind::Move}, {0x8001, Kind::Or},
+                {0x8002, Kind::And}, {0x8003, Kind::Xor}, {0x8004, Kind::AddCarry}, {0x8005, Kind::Sub},
+                {0x8006, Kind::ShiftRight}, {0x8007, Kind::SubN}, {0x800E, Kind::ShiftLeft}, {0xA000, Kind::LoadI},
+                {0xC000, Kind::Random}, {0xF007, Kind::GetDelay}, {0xF015, Kind::SetDelay}, {0xF018, Kind::SetSound},
+                {0xF01E, Kind::AddI}, {0xF029, Kind::Font},
+            };
+            for (const auto& [instruction, kind] : inline_ops)
+                kinds[Chip8Core::decode(instruction, variant).handler] = kind;
+
+            // XO-CHIP skips step over F000 nnnn as a whole, which depends on RAM
+            if (variant == Variant::XoChip) {
+                for (uint16_t instruction : {0x3000, 0x4000, 0x5000, 0x9000, 0xE09E, 0xE0A1})
+                    kinds[Chip8Core::decode(instruction, variant).handler] = Kind::CallEnd;
+            }
+
+            const uint16_t ending[] = {0x00EE, 0x00FD, 0x2000, 0xB000, 0xF00A, 0xF033, 0xF055, 0x5002, 0xF000};
+            for (uint16_t instruction : ending) {
+                Chip8Core::DecodedOp op = Chip8Core::decode(instruction, variant);
+                if (kinds.count(op.handler) == 0)
+                    kinds[op.handler] = Kind::CallEnd;
+            }
+        }
+
+        uint16_t romEnd() const { return static_cast<uint16_t>(Chip8Core::ROM_START + rom.size()); }
+
+        // Whole instruction inside the ROM
+        bool inRom(uint16_t address) const { return address >= Chip8Core::ROM_START && address + 2 <= romEnd(); }
+
+        uint16_t fetch(uint16_t address) const {
+            const std::size_t offset = address - Chip8Core::ROM_START;
+            return rom[offset] << 8 | rom[offset + 1];
+        }
+
+        Kind kindOf(uint16_t instruction) const {
+            auto it = kinds.find(Chip8Core::decode(instruction, variant).handler);
+            return it != kinds.end() ? it->second : Kind::Call;
+        }
+
+        static bool isSkip(Kind kind) { return kind >= Kind::SkipEq && kind <= Kind::SkipNoKey; }
+        static bool endsBlock(Kind kind) { return kind == Kind::Jump || isSkip(kind) || kind == Kind::CallEnd; }
+
+        // Addresses execution can continue at after the instruction
+        void successors(uint16_t address, uint16_t instruction, std::vector<uint16_t>& out) const {
+            const Kind kind = kindOf(instruction);
+            if (kind == Kind::Jump) {
+                out.push_back(instruction & 0xFFF);
+            } else if (isSkip(kind)) {
+                out.push_back(address + 2);
+                out.push_back(address + 4);
+            } else if (kind == Kind::CallEnd) {
+                if ((instruction & 0xF000) == 0x2000)
+                    out.push_back(instruction & 0xFFF);
+                // Fx0A and 00FD can stay on themselves; XO-CHIP skips can also
+                // step over a four byte F000 nnnn
+                if (instruction == 0x00FD || (instruction & 0xF0FF) == 0xF00A)
+                    out.push_back(address);
+                out.push_back(address + 2);
+                if (variant == Variant::XoChip && (instruction & 0xF000) != 0x2000) {
+                    out.push_back(address + 4);
+                    out.push_back(address + 6);
+                }
+            }
+        }
+
+        void findLeaders() {
+            std::vector<uint16_t> work = {Chip8Core::ROM_START};
+            std::set<uint16_t> seen;
+            std::vector<uint16_t> next;
+            while (!work.empty()) {
+                uint16_t address = work.back();
+                work.pop_back();
+                if (!inRom(address) || !leaders.insert(address).second)
+                    continue;
+
+                // Walk the straight line until something ends it
+                while (inRom(address) && seen.insert(address).second) {
+                    const uint16_t instruction = fetch(address);
+                    if (endsBlock(kindOf(instruction))) {
+                        next.clear();
+                        successors(address, instruction, next);
+                        work.insert(work.end(), next.begin(), next.end());
+                        break;
+                    }
+                    address += 2;
+                }
+            }
+        }
+
+        void buildBlocks() {
+            std::vector<uint16_t> work(leaders.begin(), leaders.end());
+            while (!work.empty()) {
+                const uint16_t start = work.back();
+                work.pop_back();
+                if (blocks.count(start))
+                    continue;
+
+                Block block{start, {}, start, true};
+                uint16_t address = start;
+                while (inRom(address) && (address == start || leaders.count(address) == 0)) {
+                    if (block.addresses.size() == MAX_BLOCK_LENGTH) {
+                        // Long runs are split so a block fits in a frame's budget
+                        leaders.insert(address);
+                        work.push_back(address);
+                        break;
+                    }
+                    const uint16_t instruction = fetch(address);
+                    block.addresses.push_back(address);
+                    address += 2;
+                    if (endsBlock(kindOf(instruction))) {
+                        block.falls_through = false;
+                        break;
+                    }
+                }
+                block.next = address;
+                if (!block.addresses.empty())
+                    blocks[start] = block;
+            }
+        }
+
+        std::string emitInstruction(uint16_t address, uint16_t instruction, bool& uses_core) const {
+            const Chip8Core::DecodedOp op = Chip8Core::decode(instruction, variant);
+            const unsigned x = op.x, y = op.y, kk = op.kk, nnn = op.nnn;
+            auto skip = [&](const std::string& condition) {
+                return formatted("    s.PC = %s ? 0x%03X : 0x%03X;\n", condition.c_str(), address + 4, address + 2);
+            };
+            const std::string vx = formatted("s.V[0x%X]", x), vy = formatted("s.V[0x%X]", y);
+            const std::string vf_reset = quirks.logic_resets_vf ? "    s.V[0xF] = 0;\n" : "";
+            const std::string source = quirks.shift_reads_vy ? vy : vx;
+
+            switch (kindOf(instruction)) {
+            case Kind::Nop: return "";
+            case Kind::Jump: return formatted("    s.PC = 0x%03X;\n", nnn);
+            case Kind::SkipEq: return skip(formatted("(%s == 0x%02X)", vx.c_str(), kk));
+            case Kind::SkipNe: return skip(formatted("(%s != 0x%02X)", vx.c_str(), kk));
+            case Kind::SkipRegEq: return skip("(" + vx + " == " + vy + ")");
+            case Kind::SkipRegNe: return skip("(" + vx + " != " + vy + ")");
+            case Kind::SkipKey: return skip("s.keypad[" + vx + " & 0xF]");
+            case Kind::SkipNoKey: return skip("!s.keypad[" + vx + " & 0xF]");
+            case Kind::Load: return formatted("    %s = 0x%02X;\n", vx.c_str(), kk);
+            case Kind::Add: return formatted("    %s += 0x%02X;\n", vx.c_str(), kk);
+            case Kind::Move: return "    " + vx + " = " + vy + ";\n";
+            case Kind::Or: return "    " + vx + " |= " + vy + ";\n" + vf_reset;
+            case Kind::And: return "    " + vx + " &= " + vy + ";\n" + vf_reset;
+            case Kind::Xor: return "    " + vx + " ^= " + vy + ";\n" + vf_reset;
+            case Kind::AddCarry:
+                return "    { uint16_t r = " + vx + " + " + vy + "; " + vx + " = r & 0xFF; s.V[0xF] = r > 0xFF; }\n";
+            case Kind::Sub:
+                return "    { uint8_t f = " + vx + " >= " + vy + "; " + vx + " -= " + vy + "; s.V[0xF] = f; }\n";
+            case Kind::SubN:
+                return "    { uint8_t f = " + vy + " >= " + vx + "; " + vx + " = " + vy + " - " + vx + "; s.V[0xF] = f; }\n";
+            case Kind::ShiftRight:
+                return "    { uint8_t v = " + source + "; " + vx + " = v >> 1; s.V[0xF] = v & 0x1; }\n";
+            case Kind::ShiftLeft:
+                return "    { uint8_t v = " + source + "; " + vx + " = v << 1; s.V[0xF] = (v & 0x80) >> 7; }\n";
+            case Kind::LoadI: return formatted("    s.I = 0x%03X;\n", nnn);
+            case Kind::Random: return formatted("    %s = Chip8Aot::nextRandom(s) & 0x%02X;\n", vx.c_str(), kk);
+            case Kind::GetDelay: return "    " + vx + " = s.delay_timer;\n";
+            case Kind::SetDelay: return "    s.delay_timer = " + vx + ";\n";
+            case Kind::SetSound: return "    s.sound_timer = " + vx + ";\n";
+            case Kind::AddI: return "    s.I += " + vx + ";\n";
+            case Kind::Font: return "    s.I = " + vx + " * 5;\n";
+            case Kind::Call:
+                uses_core = true;
+                return formatted("    core.executeInstruction(0x%04X);\n", instruction);
+            case Kind::CallEnd:
+                // The handler expects PC already past the instruction
+                uses_core = true;
+                return formatted("    s.PC = 0x%03X;\n    core.executeInstruction(0x%04X, 0x%03X);\n", address + 2, instruction, address);
+            }
+            return "";
+        }
+
+        std::string emit(const std::string& name) const {
+            std::ostringstream out;
+            out << "// Generated by chip8_aot from " << name << " (" << variantName(variant) << "), do not edit\n"
+                << "#include \"chip8/aot.hpp\"\n\n"
+                << "namespace {\n\n"
+                << "const uint8_t ROM[" << rom.size() << "] = {";
+            for (std::size_t i = 0; i < rom.size(); i++) {
+                if (i % 16 == 0)
+                    out << "\n   ";
+                char byte[8];
+                std::snprintf(byte, sizeof(byte), " 0x%02X,", rom[i]);
+                out << byte;
+            }
+            out << "\n};\n";
+
+            for (const auto& [start, block] : blocks) {
+                bool uses_core = false;
+                std::string body;
+                for (uint16_t address : block.addresses) {
+                    const uint16_t instruction = fetch(address);
+                    char comment[32];
+                    std::snprintf(comment, sizeof(comment), "    // %03X: %04X\n", address, instruction);
+                    body += comment + emitInstruction(address, instruction, uses_core);
+                }
+                if (block.falls_through) {
+                    char tail[32];
+                    std::snprintf(tail, sizeof(tail), "    s.PC = 0x%03X;\n", block.next);
+                    body += tail;
+                }
+
+                char header[96];
+                std::snprintf(header, sizeof(header), "\nvoid block_%03X(Chip8Core::State& s, Chip8Core&%s) {\n",
+                              start, uses_core ? " core" : "");
+                out << header << body << "}\n";
+            }
+
+            out << "\nconst Chip8Aot::Block BLOCKS[] = {\n";
+            for (const auto& [start, block] : blocks) {
+                char entry[96];
+                std::snprintf(entry, sizeof(entry), "    {0x%03X, 0x%03X, %zu, &block_%03X},\n",
+                              start, block.addresses.back() + 2, block.addresses.size(), start);
+                out << entry;
+            }
+            out << "};\n\n"
+                << "}\n\n"
+                << "int main(int argc, char **argv) {\n"
+                << "    const Chip8Aot::Program program = {\n"
+                << "        \"" << name << "\", static_cast<Variant>(" << static_cast<int>(variant) << "),\n"
+                << "        ROM, sizeof(ROM), BLOCKS, sizeof(BLOCKS) / sizeof(BLOCKS[0]),\n"
+                << "    };\n"
+                << "    return Chip8Aot::main(program, argc, argv);\n"
+                << "}\n";
+            return out.str();
+        }
+    };
+}
+
+static void printUsage() {
+    std::cout << "Usage: chip8_aot [--variant chip8|schip|xochip|vip] <rom> <out.cpp>" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const char *rom_path = nullptr;
+    const char *out_path = nullptr;
+    bool variant_forced = false;
+    Variant variant = Variant::Chip8;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--variant") == 0 && i + 1 < argc) {
+            if (!parseVariant(argv[++i], variant)) {
+                std::cerr << "Unknown variant: " << argv[i] << std::endl;
+                return 1;
+            }
+            variant_forced = true;
+        } else if (argv[i][0] == '-') {
+            printUsage();
+            return 1;
+        } else if (!rom_path) {
+            rom_path = argv[i];
+        } else if (!out_path) {
+            out_path = argv[i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (!rom_path || !out_path) {
+        printUsage();
+        return 1;
+    }
+    if (!variant_forced)
+        variant = variantForRom(rom_path);
+
+    std::ifstream file(rom_path, std::ios::binary);
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file && !file.eof()) {
+        std::cerr << "Failed to read " << rom_path << std::endl;
+        return 1;
+    }
+    if (rom.empty() || rom.size() > Chip8Core::MAX_ROM_SIZE) {
+        std::cerr << "Not a CHIP-8 ROM: " << rom_path << std::endl;
+        return 1;
+    }
+
+    Compiler compiler(variant, std::move(rom));
+    compiler.findLeaders();
+    compiler.buildBlocks();
+
+    // Only the file name, so the output does not depend on the build directory
+    std::string name = rom_path;
+    std::size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos)
+        name = name.substr(slash + 1);
+    for (char& c : name) {
+        if (c == '"' || c == '\\')
+            c = '_';
+    }
+
+    std::ofstream out(out_path);
+    out << compiler.emit(name);
+    if (!out) {
+        std::cerr << "Failed to write " << out_path << std::endl;
+        return 1;
+    }
+
+    std::size_t instructions = 0;
+    for (const auto& entry : compiler.blocks)
+        instructions += entry.second.addresses.size();
+    std::cerr << compiler.blocks.size() << " blocks, " << instructions << " instructions compiled from "
+              << name << std::endl;
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include "chip8/core.hpp"
+#include "chip8/jit.hpp"
+#include "work_stealing_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs every ROM of a corpus headless for a fixed number of frames and
+// reports the final display hash, instruction count and wall time per ROM.
+// Each ROM gets its own core, so the runs are independent and spread over
+// all hardware threads.
+
+struct Options {
+    std::vector<std::string> inputs;
+    const char *list_path = nullptr;
+    const char *script_path = nullptr;
+    std::size_t frames = 600;
+    std::size_t threads = 0;
+    uint64_t seed = 0;
+    // Forced variant; by default it follows each ROM's file extension
+    bool has_variant = false;
+    Variant variant = Variant::Chip8;
+    bool use_jit = false;
+    bool json = false;
+};
+
+// One line of the input script: "<frame> <key> down|up", key in hex
+struct ScriptEvent {
+    uint64_t frame;
+    uint8_t key;
+    bool pressed;
+};
+
+struct Result {
+    std::string rom;
+    bool loaded = false;
+    uint64_t instructions = 0;
+    uint64_t display_hash = 0;
+    double wall_ms = 0.0;
+};
+
+static void printUsage() {
+    std::cout << "Usage: chip8_batch [--frames <n>] [--threads <n>] [--seed <n>] [--jit]\n"
+              << "                   [--variant chip8|schip|xochip|vip]\n"
+              << "                   [--script <file>] [--list <file>] [--format csv|json]\n"
+              << "                   <ROM file or directory>..." << std::endl;
+}
+
+static bool loadScript(const char *path, std::vector<ScriptEvent>& events) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open input script: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    std::size_t line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        uint64_t frame;
+        std::string key, action;
+        if (!(fields >> frame))
+            continue;
+
+        char *end = nullptr;
+        unsigned long value = (fields >> key >> action) ? std::strtoul(key.c_str(), &end, 16) : 0x10;
+        if (value > 0xF || (end && *end) || (action != "down" && action != "up")) {
+            std::cerr << path << ":" << line_number << ": expected \"<frame> <key> down|up\"" << std::endl;
+            return false;
+        }
+        events.push_back({frame, static_cast<uint8_t>(value), action == "down"});
+    }
+
+    std::stable_sort(events.begin(), events.end(),
+                     [](const ScriptEvent& a, const ScriptEvent& b) { return a.frame < b.frame; });
+    return true;
+}
+
+// Expands directories (non-recursive, sorted) so the output order is stable
+static void collectRoms(const std::string& input, std::vector<std::string>& roms) {
+    std::error_code error;
+    if (!std::filesystem::is_directory(input, error)) {
+        roms.push_back(input);
+        return;
+    }
+
+    std::vector<std::string> entries;
+    for (const auto& entry : std::filesystem::directory_iterator(input, error)) {
+        if (entry.is_regular_file(error))
+            entries.push_back(entry.path().string());
+    }
+    std::sort(entries.begin(), entries.end());
+    roms.insert(roms.end(), entries.begin(), entries.end());
+}
+
+static Result runRom(const std::string& rom, const Options& options, const std::vector<ScriptEvent>& script) {
+    Result result;
+    result.rom = rom;
+
+    Chip8Core core;
+    if (!core.loadRom(rom.c_str()))
+        return result;
+    result.loaded = true;
+    core.seed(options.seed);
+    core.setVariant(options.has_variant ? options.variant : variantForRom(rom.c_str()));
+
+    std::unique_ptr<Chip8Jit> jit;
+    if (options.use_jit)
+        jit = std::make_unique<Chip8Jit>(core);
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t next_event = 0;
+    for (uint64_t frame = 0; frame < options.frames; frame++) {
+        for (; next_event < script.size() && script[next_event].frame == frame; next_event++)
+            core.setKey(script[next_event].key, script[next_event].pressed);
+
+        if (jit)
+            jit->runFrames(1);
+        else
+            core.runFrames(1);
+    }
+    result.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    result.instructions = core.getInstructionCount();
+    result.display_hash = core.hashDisplay();
+    return result;
+}
+
+static std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+static void printResults(const std::vector<Result>& results, const Options& options) {
+    char hash[17];
+
+    if (!options.json) {
+        std::cout << "rom,status,frames,instructions,display_hash,wall_ms\n";
+        for (const Result& result : results) {
+            std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(result.display_hash));
+            std::string rom = result.rom;
+            if (rom.find_first_of(",\"") != std::string::npos) {
+                std::string quoted = "\"";
+                for (char c : rom)
+                    quoted += c == '"' ? std::string("\"\"") : std::string(1, c);
+                rom = quoted + "\"";
+            }
+            std::cout << rom << ',' << (result.loaded ? "ok" : "load_failed") << ','
+                      << options.frames << ',' << result.instructions << ','
+                      << hash << ',' << result.wall_ms << '\n';
+        }
+        std::cout.flush();
+        return;
+    }
+
+    std::cout << "[\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(result.display_hash));
+        std::cout << "  {\"rom\": \"" << jsonEscape(result.rom) << "\", "
+                  << "\"status\": \"" << (result.loaded ? "ok" : "load_failed") << "\", "
+                  << "\"frames\": " << options.frames << ", "
+                  << "\"instructions\": " << result.instructions << ", "
+                  << "\"display_hash\": \"" << hash << "\", "
+                  << "\"wall_ms\": " << result.wall_ms << "}"
+                  << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            options.threads = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            options.seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.use_jit = true;
+        } else if (strcmp(argv[i], "--variant") == 0 && has_value) {
+            if (!parseVariant(argv[++i], options.variant)) {
+                printUsage();
+                return 1;
+            }
+            options.has_variant = true;
+        } else if (strcmp(argv[i], "--script") == 0 && has_value) {
+            options.script_path = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0 && has_value) {
+            options.list_path = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && has_value) {
+            const char *format = argv[++i];
+            if (strcmp(format, "json") != 0 && strcmp(format, "csv") != 0) {
+                printUsage();
+                return 1;
+            }
+            options.json = strcmp(format, "json") == 0;
+        } else if (argv[i][0] == '-') {
+            printUsage();
+            return 1;
+        } else {
+            options.inputs.push_back(argv[i]);
+        }
+    }
+
+    if (options.list_path) {
+        std::ifstream list(options.list_path);
+        if (!list.is_open()) {
+            std::cerr << "Failed to open ROM list: " << options.list_path << std::endl;
+            return 1;
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line[0] != '#')
+                options.inputs.push_back(line);
+        }
+    }
+
+    std::vector<std::string> roms;
+    for (const std::string& input : options.inputs)
+        collectRoms(input, roms);
+
+    if (roms.empty()) {
+        std::cout << "No ROMs given." << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    std::vector<ScriptEvent> script;
+    if (options.script_path && !loadScript(options.script_path, script))
+        return 1;
+
+    if (options.use_jit && !Chip8Jit::isSupported()) {
+        std::cerr << "JIT is not supported on this host, using the interpreter." << std::endl;
+        options.use_jit = false;
+    }
+
+    std::size_t threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    WorkStealingPool pool(std::min<std::size_t>(threads ? threads : 1, roms.size()));
+
+    // Each worker writes only its own slot, so the results need no lock
+    std::vector<Result> results(roms.size());
+    auto start = std::chrono::steady_clock::now();
+    pool.run(roms.size(), [&](std::size_t index) {
+        results[index] = runRom(roms[index], options, script);
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printResults(results, options);
+
+    uint64_t instructions = 0;
+    std::size_t failed = 0;
+    for (const Result& result : results) {
+        instructions += result.instructions;
+        failed += !result.loaded;
+    }
+    std::cerr << roms.size() << " ROMs on " << pool.getThreadCount() << " threads in "
+              << elapsed.count() << " s, aggregate IPS: "
+              << static_cast<uint64_t>(elapsed.count() > 0 ? instructions / elapsed.count() : 0.0)
+              << ", steals: " << pool.getStealCount() << std::endl;
+
+    return failed ? 1 : 0;
+}
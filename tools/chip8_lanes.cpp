@@ -0,0 +1,132 @@
+#include "chip8/core.hpp"
+#include "chip8/lanes.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Runs one ROM in N lanes of the lockstep engine and in N independent scalar
+// cores with the same seeds and input, checks that every lane ends in the same
+// state as its scalar twin, and prints the aggregate instruction rate of both.
+
+struct Options {
+    const char *rom_path = nullptr;
+    std::size_t lanes = 256;
+    std::size_t frames = 600;
+    uint64_t seed = 0;
+    bool random_keys = false;
+};
+
+static void printUsage() {
+    std::cout << "Usage: chip8_lanes [--lanes <n>] [--frames <n>] [--seed <n>] [--random-keys] <ROM file path>" << std::endl;
+}
+
+// Per-lane input pattern: every 8 frames a lane presses or releases a key
+// picked from its own hash, so lanes diverge the way a search workload would
+static bool keyEvent(std::size_t lane, uint64_t frame, uint8_t& key, bool& pressed) {
+    if (frame % 8 != 0)
+        return false;
+
+    uint64_t h = (lane + 1) * 0x9E3779B97F4A7C15ull ^ frame * 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 31;
+    key = h & 0xF;
+    pressed = (h >> 4) & 1;
+    return true;
+}
+
+static bool sameState(const Chip8Core::State& a, const Chip8Core::State& b) {
+    return a.RAM == b.RAM && a.V == b.V && a.I == b.I && a.PC == b.PC
+        && a.delay_timer == b.delay_timer && a.sound_timer == b.sound_timer
+        && a.stack == b.stack && a.SP == b.SP && a.keypad == b.keypad
+        && a.waiting_for_key_release == b.waiting_for_key_release
+        && a.audio_pattern == b.audio_pattern && a.pitch == b.pitch
+        && a.audio_pattern_loaded == b.audio_pattern_loaded
+        && a.display == b.display && a.hires == b.hires && a.planes == b.planes
+        && a.rpl_flags == b.rpl_flags && a.rng_state == b.rng_state
+        && a.instruction_count == b.instruction_count && a.frame_count == b.frame_count
+        && a.rate_remainder == b.rate_remainder && a.cycle_budget == b.cycle_budget;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--lanes") == 0 && has_value) {
+            options.lanes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            options.seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--random-keys") == 0) {
+            options.random_keys = true;
+        } else if (!options.rom_path && argv[i][0] != '-') {
+            options.rom_path = argv[i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (!options.rom_path || options.lanes == 0) {
+        printUsage();
+        return 1;
+    }
+
+    Chip8Lanes lanes(options.lanes);
+    if (!lanes.loadRom(options.rom_path))
+        return 1;
+
+    std::vector<Chip8Core> cores(options.lanes);
+    for (std::size_t l = 0; l < options.lanes; l++) {
+        cores[l].loadRom(options.rom_path);
+        cores[l].seed(options.seed + l);
+        lanes.seed(l, options.seed + l);
+    }
+
+    uint8_t key;
+    bool pressed;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t frame = 0; frame < options.frames; frame++) {
+        for (std::size_t l = 0; options.random_keys && l < options.lanes; l++) {
+            if (keyEvent(l, frame, key, pressed))
+                lanes.setKey(l, key, pressed);
+        }
+        lanes.runFrames(1);
+    }
+    std::chrono::duration<double> lanes_elapsed = std::chrono::steady_clock::now() - start;
+
+    // Scalar cores one after another, as N independent instances would run on one thread
+    start = std::chrono::steady_clock::now();
+    for (std::size_t l = 0; l < options.lanes; l++) {
+        for (uint64_t frame = 0; frame < options.frames; frame++) {
+            if (options.random_keys && keyEvent(l, frame, key, pressed))
+                cores[l].setKey(key, pressed);
+            cores[l].runFrames(1);
+        }
+    }
+    std::chrono::duration<double> scalar_elapsed = std::chrono::steady_clock::now() - start;
+
+    std::size_t mismatches = 0;
+    for (std::size_t l = 0; l < options.lanes; l++) {
+        if (!sameState(lanes.getLaneState(l), cores[l].getState())) {
+            if (mismatches++ < 8)
+                std::cout << "lane " << l << " differs from its scalar core" << std::endl;
+        }
+    }
+
+    double total = static_cast<double>(lanes.getInstructionCount()) * options.lanes;
+    std::cout << "lanes: " << options.lanes
+              << ", frames: " << options.frames
+              << ", groups per instruction: " << static_cast<double>(lanes.getGroupCount()) / lanes.getInstructionCount()
+              << "\nlockstep IPS: " << static_cast<uint64_t>(total / lanes_elapsed.count())
+              << ", scalar IPS: " << static_cast<uint64_t>(total / scalar_elapsed.count())
+              << ", speedup: " << scalar_elapsed.count() / lanes_elapsed.count()
+              << "\nmismatching lanes: " << mismatches << std::endl;
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+#include "chip8/core.hpp"
+#include "chip8/netplay.hpp"
+#include "chip8/rom_library.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Loopback test of rollback netplay. Two sessions run on threads of their
+// own in this process and talk through a relay on 127.0.0.1 that holds every
+// packet for a latency (plus random jitter, which also reorders them) and
+// drops some. Each player presses scripted random keys, player one on keys
+// 0-7 and player two on 8-F. Once both have run every frame with the other's
+// actual input, both cores must match each other and a plain run of the
+// same merged input.
+
+struct Options {
+    const char *rom_path = nullptr;
+    uint32_t frames = 600;
+    // Host time per frame; 16 is real time
+    uint32_t frame_ms = 4;
+    uint32_t latency_ms = 30;
+    uint32_t jitter_ms = 10;
+    uint32_t loss_percent = 5;
+    uint16_t port = 47600;
+    uint64_t seed = 1;
+};
+
+static void printUsage() {
+    std::cout << "Usage: chip8_netplay [--frames <n>] [--frame-ms <ms>] [--latency <ms>] [--jitter <ms>]\n"
+              << "                     [--loss <percent>] [--port <first of 4>] [--seed <n>] <ROM>" << std::endl;
+}
+
+// Keys held by each player, frame by frame
+static std::vector<uint16_t> makeScript(uint32_t frames, int first_key, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<uint16_t> script(frames);
+    uint16_t keys = 0;
+    uint32_t hold = 0;
+    for (uint16_t& mask : script) {
+        if (hold == 0) {
+            keys = static_cast<uint16_t>((rng() & 0xFF) << first_key);
+            hold = 1 + rng() % 20;
+        }
+        hold--;
+        mask = keys;
+    }
+    return script;
+}
+
+static int bindUdp(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (fd < 0 || bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Failed to bind relay port " << port << std::endl;
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Forwards what arrives on one socket to a port from the other, late
+class Relay {
+public:
+    Relay(const Options& options_) : options(options_), rng(options_.seed ^ 0x5EED) {}
+
+    // Player one talks to port + 2 and player two to port + 3
+    bool open() {
+        a_side = bindUdp(options.port + 2);
+        b_side = bindUdp(options.port + 3);
+        return a_side >= 0 && b_side >= 0;
+    }
+
+    ~Relay() {
+        if (a_side >= 0)
+            close(a_side);
+        if (b_side >= 0)
+            close(b_side);
+    }
+
+    void run(const std::atomic<bool>& stop) {
+        while (!stop.load()) {
+            take(a_side, b_side, options.port + 1);
+            take(b_side, a_side, options.port);
+            deliver();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    uint64_t getDropped() const { return dropped; }
+    uint64_t getForwarded() const { return forwarded; }
+
+private:
+    struct Packet {
+        std::chrono::steady_clock::time_point due;
+        int from;
+        uint16_t to;
+        std::vector<uint8_t> data;
+    };
+
+    const Options& options;
+    std::mt19937_64 rng;
+    int a_side = -1;
+    int b_side = -1;
+    std::vector<Packet> held;
+    uint64_t dropped = 0;
+    uint64_t forwarded = 0;
+
+    void take(int in, int out, uint16_t to) {
+        uint8_t buffer[1500];
+        for (;;) {
+            const ssize_t size = recv(in, buffer, sizeof(buffer), 0);
+            if (size < 0)
+                return;
+            if (rng() % 100 < options.loss_percent) {
+                dropped++;
+                continue;
+            }
+            const uint32_t delay = options.latency_ms + (options.jitter_ms ? rng() % (options.jitter_ms + 1) : 0);
+            held.push_back({std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), out, to,
+                            std::vector<uint8_t>(buffer, buffer + size)});
+        }
+    }
+
+    void deliver() {
+        const auto now = std::chrono::steady_clock::now();
+        auto due = std::partition(held.begin(), held.end(), [&](const Packet& p) { return p.due > now; });
+        for (auto it = due; it != held.end(); ++it) {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(it->to);
+            sendto(it->from, it->data.data(), it->data.size(), 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            forwarded++;
+        }
+        held.erase(due, held.end());
+    }
+};
+
+struct Player {
+    Chip8Core core;
+    Netplay netplay;
+    std::vector<uint16_t> script;
+    bool ok = false;
+};
+
+// One side of the session, paced at frame_ms per frame
+static void runPlayer(const Options& options, Player& player, std::atomic<int>& finished) {
+    if (!player.netplay.connect(player.core, std::chrono::seconds(10))) {
+        finished++;
+        return;
+    }
+
+    const auto period = std::chrono::milliseconds(options.frame_ms);
+    auto next = std::chrono::steady_clock::now();
+    const auto deadline = next + std::chrono::milliseconds(uint64_t(options.frames) * options.frame_ms) + std::chrono::seconds(10);
+    bool done = false;
+    // Keep answering until both sides are done, so the other one gets its
+    // input acknowledged
+    while (finished.load() < 2 && std::chrono::steady_clock::now() < deadline) {
+        const Netplay& netplay = player.netplay;
+        if (netplay.getFrame() < options.frames)
+            player.netplay.runFrame(player.core, player.script[netplay.getFrame()]);
+        else
+            player.netplay.poll(player.core);
+
+        if (!done && netplay.getConfirmedFrame() == options.frames && netplay.getAcknowledgedFrame() == options.frames) {
+            done = true;
+            player.ok = true;
+            finished++;
+        }
+
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
+    if (!done)
+        finished++;
+}
+
+static bool sameState(const Chip8Core& a, const Chip8Core& b) {
+    const Chip8Core::State& x = a.getState();
+    const Chip8Core::State& y = b.getState();
+    return x.RAM == y.RAM && x.V == y.V && x.I == y.I && x.PC == y.PC && x.SP == y.SP && x.stack == y.stack &&
+           x.delay_timer == y.delay_timer && x.sound_timer == y.sound_timer && x.display == y.display &&
+           x.rng_state == y.rng_state && x.instruction_count == y.instruction_count && x.frame_count == y.frame_count;
+}
+
+static void printPlayer(const char *label, const Player& player) {
+    const Netplay& netplay = player.netplay;
+    std::printf("%s: %u frames, %llu rollbacks, %llu frames simulated again, %llu stalls, display %016llX\n", label,
+                netplay.getFrame(), static_cast<unsigned long long>(netplay.getRollbackCount()),
+                static_cast<unsigned long long>(netplay.getResimulatedFrames()),
+                static_cast<unsigned long long>(netplay.getStallCount()),
+                static_cast<unsigned long long>(player.core.hashDisplay()));
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            options.frames = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--frame-ms") == 0 && has_value) {
+            options.frame_ms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--latency") == 0 && has_value) {
+            options.latency_ms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--jitter") == 0 && has_value) {
+            options.jitter_ms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--loss") == 0 && has_value) {
+            options.loss_percent = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--port") == 0 && has_value) {
+            options.port = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (argv[i][0] != '-' && !options.rom_path) {
+            options.rom_path = argv[i];
+        } else {
+            printUsage();
+            return 2;
+        }
+    }
+    if (!options.rom_path || options.frames == 0) {
+        printUsage();
+        return 2;
+    }
+    if (!Netplay::isSupported()) {
+        std::cout << "Netplay is not supported on this host" << std::endl;
+        return 2;
+    }
+
+    RomLibrary library;
+    if (!library.open(options.rom_path))
+        return 2;
+
+    Player one, two;
+    Chip8Core reference;
+    library.load(0, one.core);
+    library.load(0, two.core);
+    library.load(0, reference);
+    // Different seeds on purpose: connecting settles on the lower one
+    one.core.seed(options.seed + 1);
+    two.core.seed(options.seed);
+    reference.seed(options.seed);
+    one.script = makeScript(options.frames, 0, options.seed * 2 + 1);
+    two.script = makeScript(options.frames, 8, options.seed * 2 + 2);
+
+    Relay relay(options);
+    if (!relay.open() ||
+        !one.netplay.open(options.port, "127.0.0.1", static_cast<uint16_t>(options.port + 2)) ||
+        !two.netplay.open(static_cast<uint16_t>(options.port + 1), "127.0.0.1", static_cast<uint16_t>(options.port + 3)))
+        return 2;
+
+    std::atomic<bool> stop_relay{false};
+    std::atomic<int> finished{0};
+    std::thread relay_thread([&] { relay.run(stop_relay); });
+    std::thread one_thread(runPlayer, std::cref(options), std::ref(one), std::ref(finished));
+    std::thread two_thread(runPlayer, std::cref(options), std::ref(two), std::ref(finished));
+    one_thread.join();
+    two_thread.join();
+    stop_relay.store(true);
+    relay_thread.join();
+
+    for (uint32_t f = 0; f < options.frames; f++) {
+        const uint16_t keys = one.script[f] | two.script[f];
+        for (uint8_t key = 0; key < 16; key++)
+            reference.setKey(key, (keys >> key) & 1);
+        reference.runFrames(1);
+    }
+
+    printPlayer("Player one", one);
+    printPlayer("Player two", two);
+    std::printf("Relay: %llu packets forwarded, %llu dropped\n", static_cast<unsigned long long>(relay.getForwarded()),
+                static_cast<unsigned long long>(relay.getDropped()));
+
+    if (!one.ok || !two.ok) {
+        std::printf("FAIL: the session did not finish\n");
+        return 1;
+    }
+    if (!sameState(one.core, two.core) || !sameState(one.core, reference)) {
+        std::printf("FAIL: the players %s, reference display %016llX\n",
+                    sameState(one.core, two.core) ? "agree but differ from the reference" : "diverged",
+                    static_cast<unsigned long long>(reference.hashDisplay()));
+        return 1;
+    }
+    std::printf("OK: both players match the reference run\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "chip8/core.hpp"
+#include "chip8/rom_library.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Lists the index of a ROM directory or archive (SHA-1, size, detected
+// variant and quirks) and packs ROMs into an archive for RomLibrary.
+
+static void printUsage() {
+    std::cout << "Usage: chip8_romlib <ROM directory or archive>\n"
+              << "       chip8_romlib --pack <archive> <ROM file or directory>..." << std::endl;
+}
+
+static int pack(const char *archive_path, const std::vector<std::string>& inputs) {
+    // Expand directories through the library itself so the order matches
+    std::vector<std::string> roms;
+    for (const std::string& input : inputs) {
+        RomLibrary library;
+        if (!library.open(input.c_str()) || library.isArchive()) {
+            std::cerr << "Not a ROM file or directory: " << input << std::endl;
+            return 1;
+        }
+        for (const RomLibrary::Entry& entry : library.getEntries())
+            roms.push_back(entry.name);
+    }
+
+    if (!RomLibrary::writeArchive(archive_path, roms))
+        return 1;
+    std::cerr << roms.size() << " ROMs packed into " << archive_path << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 4 && strcmp(argv[1], "--pack") == 0)
+        return pack(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    if (argc != 2 || argv[1][0] == '-') {
+        printUsage();
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    RomLibrary library;
+    if (!library.open(argv[1]))
+        return 1;
+    std::chrono::duration<double, std::milli> indexed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "sha1,size,variant,quirks,name\n";
+    for (const RomLibrary::Entry& entry : library.getEntries()) {
+        const Quirks& q = entry.quirks;
+        std::cout << sha1Hex(entry.sha1) << ',' << entry.size << ',' << variantName(entry.variant) << ','
+                  << (q.logic_resets_vf ? "vf_reset " : "") << (q.shift_reads_vy ? "shift_vy " : "")
+                  << (q.load_store_moves_i ? "memory_i " : "") << (q.jump_adds_vx ? "jump_vx " : "")
+                  << (q.wrap_sprites ? "wrap" : "") << ',' << entry.name << '\n';
+    }
+    std::cout.flush();
+
+    // Switching cost: every ROM loaded into a core from the mapping
+    Chip8Core core;
+    constexpr int ROUNDS = 100;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (std::size_t i = 0; i < library.size(); i++)
+            library.load(i, core);
+    }
+    std::chrono::duration<double, std::micro> loading = std::chrono::steady_clock::now() - start;
+
+    std::cerr << library.size() << " ROMs indexed in " << indexed.count() << " ms, "
+              << loading.count() / (ROUNDS * library.size()) << " us per switch" << std::endl;
+    return 0;
+}
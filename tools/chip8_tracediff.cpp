@@ -0,0 +1,73 @@
+#include "chip8/trace.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+// Compares two execution traces (--trace) record by record and reports the
+// first instruction where they disagree, e.g. between two builds or cores
+// replaying the same input log. Both files are streamed once.
+
+static void printRecord(const char *label, const trace_log::Record& r) {
+    std::printf("  %s instruction %llu, frame %llu: PC %03X opcode %04X I %03X V",
+                label, static_cast<unsigned long long>(r.instruction), static_cast<unsigned long long>(r.frame),
+                r.pc, r.opcode, r.I);
+    for (uint8_t v : r.V)
+        std::printf(" %02X", v);
+    std::printf("\n");
+}
+
+static bool sameRecord(const trace_log::Record& a, const trace_log::Record& b) {
+    return a.pc == b.pc && a.opcode == b.opcode && a.I == b.I && a.V == b.V && a.frame == b.frame;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cout << "Usage: chip8_tracediff <trace a> <trace b>" << std::endl;
+        return 2;
+    }
+
+    TraceReader a, b;
+    if (!a.open(argv[1]) || !b.open(argv[2]))
+        return 2;
+
+    if (a.getVariant() != b.getVariant())
+        std::printf("Variants differ: %s vs %s\n", variantName(a.getVariant()), variantName(b.getVariant()));
+    if (!sameRecord(a.getStart(), b.getStart()) || a.getStart().instruction != b.getStart().instruction) {
+        std::printf("Traces start from different states\n");
+        printRecord("a", a.getStart());
+        printRecord("b", b.getStart());
+        return 1;
+    }
+
+    trace_log::Record ra, rb;
+    trace_log::Record last = a.getStart();
+    uint64_t compared = 0;
+    for (;;) {
+        const bool has_a = a.next(ra);
+        const bool has_b = b.next(rb);
+
+        if (!has_a || !has_b) {
+            if (a.isTruncated() || b.isTruncated())
+                std::printf("Trace %s is truncated\n", a.isTruncated() ? "a" : "b");
+            if (has_a == has_b) {
+                std::printf("Traces match over %llu instructions\n", static_cast<unsigned long long>(compared));
+                return a.isTruncated() || b.isTruncated() ? 1 : 0;
+            }
+            std::printf("Trace %s ends after %llu instructions; the other goes on\n", has_a ? "b" : "a",
+                        static_cast<unsigned long long>(compared));
+            printRecord(has_a ? "a" : "b", has_a ? ra : rb);
+            return 1;
+        }
+
+        if (!sameRecord(ra, rb)) {
+            std::printf("First divergence after %llu matching instructions\n", static_cast<unsigned long long>(compared));
+            printRecord(compared ? "both" : "start", last);
+            printRecord("a", ra);
+            printRecord("b", rb);
+            return 1;
+        }
+
+        last = ra;
+        compared++;
+    }
+}
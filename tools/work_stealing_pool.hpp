@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a fixed set of indexed jobs on worker threads. Every worker owns a
+// deque: it takes work from the back of its own and, once that is empty,
+// steals from the front of the others. Jobs here are whole ROM runs, so a
+// mutex per deque costs nothing measurable compared to the work itself.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(std::size_t thread_count)
+        : queues(thread_count ? thread_count : 1) {}
+
+    // Calls job(index) once for every index in [0, count) and waits for all of them
+    void run(std::size_t count, const std::function<void(std::size_t)>& job) {
+        for (std::size_t i = 0; i < count; i++)
+            queues[i % queues.size()].jobs.push_back(i);
+
+        std::vector<std::thread> workers;
+        for (std::size_t w = 1; w < queues.size(); w++)
+            workers.emplace_back([this, w, &job] { work(w, job); });
+        work(0, job);
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    std::size_t getThreadCount() const { return queues.size(); }
+    std::size_t getStealCount() const { return steals.load(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::size_t> jobs;
+    };
+
+    std::vector<Queue> queues;
+    std::atomic<std::size_t> steals{0};
+
+    bool popOwn(std::size_t w, std::size_t& index) {
+        std::lock_guard<std::mutex> lock(queues[w].mutex);
+        if (queues[w].jobs.empty())
+            return false;
+        index = queues[w].jobs.back();
+        queues[w].jobs.pop_back();
+        return true;
+    }
+
+    bool steal(std::size_t w, std::size_t& index) {
+        for (std::size_t k = 1; k < queues.size(); k++) {
+            Queue& victim = queues[(w + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                index = victim.jobs.front();
+                victim.jobs.pop_front();
+                steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(std::size_t w, const std::function<void(std::size_t)>& job) {
+        // No job spawns new jobs, so once every queue is empty we are done
+        std::size_t index;
+        while (popOwn(w, index) || steal(w, index))
+            job(index);
+    }
+};